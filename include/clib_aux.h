@@ -28,16 +28,32 @@ extern "C" {
 
 #include <stdio.h> /* for snprintf() */
 #include <stdint.h>
+#include <stddef.h> /* for size_t, ptrdiff_t */
 
 //#define USE_INTRINSICS_SSE
 
+/*  If no switch is defined explicitly the intrinsics the compiler targets
+*   are used (e.g. -march=native or /arch:AVX2). The library and the code calling
+*   the helpers below must be compiled with the same target flags */
+#if !defined (USE_INTRINSICS_SSE) && !defined (USE_INTRINSICS_AVX) && !defined (NO_INTRINSICS)
+#if defined (__AVX2__)
+#define USE_INTRINSICS_AVX
+#elif defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define USE_INTRINSICS_SSE
+#endif // __AVX2__
+#endif // USE_INTRINSICS_SSE
+
 #if UINTPTR_MAX == 0xffffffffffffffff
 /* we're on 64-bit */
 #define USE_64BIT_TARGET
 #endif // UINTPTR_MAX
 
 #if defined (USE_INTRINSICS_SSE) || defined (USE_INTRINSICS_AVX)
+#ifdef _MSC_VER
 #include <intrin.h>
+#else
+#include <immintrin.h>
+#endif // _MSC_VER
 #endif // defined
 
 #ifdef USE_64BIT_TARGET
@@ -56,31 +72,42 @@ extern "C" {
 #define find_charpos(a,b,c) find_charpos_avx(a,b,c)
 #define find_charptr(a,b,c) find_charptr_avx(a,b,c)
 #define find_ptrnpos(a,b,c,d) find_ptrnpos_avx(a,b,c,d)
+#define find_strspec(a,b) find_strspec_avx(a,b)
+#define find_escape(a,b,c) find_escape_avx(a,b,c)
 #elif defined(USE_INTRINSICS_SSE)
 #define find_charpos(a,b,c) find_charpos_sse(a,b,c)
 #define find_charptr(a,b,c) find_charptr_sse(a,b,c)
 #define find_ptrnpos(a,b,c,d) find_ptrnpos_sse(a,b,c,d)
+#define find_strspec(a,b) find_strspec_sse(a,b)
+#define find_escape(a,b,c) find_escape_sse(a,b,c)
 #elif defined(USE_64BIT_TARGET)
 #define find_charpos(a,b,c) find_charpos_64(a,b,c)
 #define find_charptr(a,b,c) find_charptr_64(a,b,c)
 #define find_ptrnpos(a,b,c,d) find_ptrnpos_64(a,b,c,d)
+#define find_strspec(a,b) find_strspec_64(a,b)
+#define find_escape(a,b,c) find_escape_64(a,b,c)
 #else
 #define find_charpos(a,b,c) find_charpos_32(a,b,c)
 #define find_charptr(a,b,c) find_charptr_32(a,b,c)
 #define find_ptrnpos(a,b,c,d) find_ptrnpos_32(a,b,c,d)
+#define find_strspec(a,b) find_strspec_32(a,b)
+#define find_escape(a,b,c) find_escape_32(a,b,c)
 #endif // USE_INTRINSICS_AVX
 
 /*  See: Sean Eron Anderson's trick to find out if there's a zero byte
 *   https://graphics.stanford.edu/~seander/bithacks.html */
 #define haszero(v) (((v) - 0x01010101UL) & ~(v) & 0x80808080UL)
 #define haszeroll(v) (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
+/* same trick to find out if there's a byte less than n (n <= 128) */
+#define hasless(v, n) (((v) - 0x01010101UL*(n)) & ~(v) & 0x80808080UL)
+#define haslessll(v, n) (((v) - 0x0101010101010101ULL*(n)) & ~(v) & 0x8080808080808080ULL)
 
 #define REPLICATE4(a, b) (a=(~0UL/0xff*(b)))
 #define REPLICATE8(a, b) (a=(~0ULL/0xff*(b)))
 
 /** Return NULL position in ascii string - a replacement for strlen() */
-int astrlen_32(const char *s);
-int astrlen_64(const char *s);
+size_t astrlen_32(const char *s);
+size_t astrlen_64(const char *s);
 
 /** compare two null terminated strings - if returned 0 the strings are equal*/
 int astrcmp_32(const char *s1, const char *s2);
@@ -99,14 +126,34 @@ int memcmpeq_64(const char *a, const char *b, size_t len);
 char *find_charptr_32(const char *s, const char ch, size_t len);
 char *find_charptr_64(const char *s, const char ch, size_t len);
 /** same but return byte's position in the buffer */
-int find_charpos_32(const char *s, const char ch, size_t len);
-int find_charpos_64(const char *s, const char ch, size_t len);
+ptrdiff_t find_charpos_32(const char *s, const char ch, size_t len);
+ptrdiff_t find_charpos_64(const char *s, const char ch, size_t len);
 
 /** same but use processor intrinsics */
 char *find_charptr_sse(const char *s, char ch, size_t len);
-int find_charpos_sse(const char *s, char ch, size_t len);
+ptrdiff_t find_charpos_sse(const char *s, char ch, size_t len);
 char *find_charptr_avx(const char *s, char ch, size_t len);
-int find_charpos_avx(const char *s, char ch, size_t len);
+ptrdiff_t find_charpos_avx(const char *s, char ch, size_t len);
+
+/** The following functions search a JSON string for the first byte which
+*   ends a plain run of characters: '"', '\\' or a control character (< 0x20)
+*   Return: the byte's position in the buffer or -1 if there's none in len bytes
+*/
+ptrdiff_t find_strspec_32(const char *s, size_t len);
+ptrdiff_t find_strspec_64(const char *s, size_t len);
+/** same but use processor intrinsics */
+ptrdiff_t find_strspec_sse(const char *s, size_t len);
+ptrdiff_t find_strspec_avx(const char *s, size_t len);
+
+/** The following functions search a string for the first byte a JSON serializer
+*   escapes: '"', '\\', a control character (< 0x20) and '/' if slash != 0
+*   Return: the byte's position in the buffer or -1 if there's none in len bytes
+*/
+ptrdiff_t find_escape_32(const char *s, size_t len, int slash);
+ptrdiff_t find_escape_64(const char *s, size_t len, int slash);
+/** same but use processor intrinsics */
+ptrdiff_t find_escape_sse(const char *s, size_t len, int slash);
+ptrdiff_t find_escape_avx(const char *s, size_t len, int slash);
 
 /** The functions search in a buffer for a pattern (the pattern must be more than 1 byte long),
 *   Return: pattern's first byte's offset in the buffer or
@@ -152,6 +199,19 @@ int itoa_aux(long long n, char* buf, int len);
 */
 int dtoa_aux(double n, char* buf, int len);
 
+/**
+*   Convert decimal number w * 10^q to the nearest double (ties to even)
+*   Input: w - decimal significand (the first 19 significant digits)
+*           q - decimal exponent
+*           neg - not 0 if the number is negative
+*           trunc - not 0 if non zero digits were dropped after the first 19 ones
+*   Output: out - result, +-0 on underflow, +-Inf on overflow
+*   Return - not 0 on success
+*           0 - the dropped digits decide the rounding (rare case), the number
+*               must be converted from all its digits, e.g. by strtod()
+*/
+int decimal_to_double(uint64_t w, int q, int neg, int trunc, double *out);
+
 #ifdef  __cplusplus
 }
 #endif // __cplusplus
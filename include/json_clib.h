@@ -39,20 +39,22 @@ extern "C" {
 below) which may be more secure but slightly slower */
 
 //#define JSON_NO_MEMALLOC
-/*  no dynamic memory allocation - json_ctx structure including
-json_node pool with JSON_MAX_NODES will be allocated once in calling json_init() */
+/*  no dynamic memory allocation per node - json_init() creates a nodes pool
+of JSON_SLAB_NODES nodes which grows by slabs on demand up to JSON_MAX_NODES */
 
 /* setting limits to protect against malicious data */
 #ifdef JSON_LIMIT_CHECK
 #define JSON_MAX_STRING_SIZE    512
-#define JSON_MAX_DEPTH          10
+#define JSON_MAX_DEPTH          10  /* default value of ctx->max_depth */
 #endif // JSON_LIMIT_CHECK
 
-/* If JSON_NO_MEMALLOC is defined setting lowest possible value for JSON_MAX_NODES
-*   will require less memory for the json nodes pool. Otherwise the value's main purpose
-*   is to safeguard against malicious inputs */
+/* Default maximum # nodes in a context. The value's main purpose
+*   is to safeguard against malicious inputs, see json_init_pool() */
 #define JSON_MAX_NODES          1000000
 
+/* Default # nodes in the first slab of the nodes pool */
+#define JSON_SLAB_NODES         4096
+
 typedef enum json_error{
     ERR_JSON_OK,             /* successfully parsed */
     ERR_JSON_INCOMPLETE,     /* must get more data */
@@ -67,7 +69,9 @@ typedef enum json_error{
     ERR_JSON_OVERFLOW,       /* not enough space in the buffer */
     ERR_JSON_NOTACONTAINER,  /* not a container type (object or array) of a node */
     ERR_JSON_TYPE,           /* not expected type of the json value */
-    ERR_JSON_NOSTRING        /* String is missing in non empty JSON object type */
+    ERR_JSON_NOSTRING,       /* String is missing in non empty JSON object type */
+    ERR_JSON_CANCELED,       /* parsing was stopped by a json_sax callback */
+    ERR_JSON_FILE            /* the file can't be opened, read or mapped */
 } json_error;
 
 typedef enum json_type{
@@ -77,7 +81,9 @@ typedef enum json_type{
     JSON_STRING,
     JSON_DOUBLE,
     JSON_INTEGER,
-    JSON_BOOL
+    JSON_BOOL,
+    JSON_NUMBER_RAW,    /* a number not converted yet, see json_ctx.raw_numbers */
+    JSON_FREE           /* not a JSON type - marks a released slot of the nodes pool */
 } json_type;
 
 /* we access all JSON values through this union */
@@ -90,39 +96,196 @@ typedef union json_value{
 
 typedef struct json_node{
     json_type       type;
+    uint32_t        key_len;        /* # bytes of key if it is not null terminated (see json_parse_view()), 0 otherwise */
     json_value      val;
     const char*     key;            /* pointer to the key value */
     struct json_node*    parent;    /* points to the parent node (null for root node) */
     struct json_node*    next;      /* points at the next sibling node (siblings have same parent) of the tree */
     struct json_node*    first_child;    /* points at the first child node if any - for object or array types */
+    struct json_node*    last_child;     /* points at the last child node - lets json_add_last() append in O(1) */
+    size_t          str_len;        /* # bytes of string_value if it is not null terminated (see json_parse_view()),
+                                        # bytes of the digits of JSON_NUMBER_RAW, 0 otherwise */
 } json_node;
 
+/* Nodes pool (arena mode): a chunk of memory the nodes are carved from */
+typedef struct json_slab{
+    struct json_slab*   next;       /* previously allocated slab */
+    int                 nnodes;     /* # nodes in the slab */
+    json_node           nodes[];
+} json_slab;
+
+/* Memory for the tokens json_parse_feed() puts together from the pieces
+*   and the strings json_parse_view() decodes */
+typedef struct json_scratch{
+    struct json_scratch* next;      /* previously allocated block */
+    size_t              size;       /* # bytes in the block */
+    size_t              used;       /* # bytes used */
+    char                data[];
+} json_scratch;
+
+/* Default size of a scratch memory block */
+#define JSON_SCRATCH_SIZE       4096
+
+/* Event callbacks of json_parse_sax(). Any of them may be NULL - the event is skipped.
+*   user is the pointer passed to json_parse_sax(). A callback returns 0 to stop
+*   parsing (ctx->err is set to ERR_JSON_CANCELED), not 0 to go on.
+*   Keys and strings are null terminated and point into the parsed buffer */
+typedef struct json_sax{
+    int (*start_object)(void* user);
+    int (*end_object)(void* user);
+    int (*start_array)(void* user);
+    int (*end_array)(void* user);
+    int (*key)(void* user, const char* key);        /* precedes the value of an object member */
+    int (*string)(void* user, const char* str);     /* also a number too long to be converted */
+    int (*integer)(void* user, long long val);
+    int (*dbl)(void* user, double val);
+    int (*boolean)(void* user, int val);            /* 0 - false, ~0 - true */
+    int (*null)(void* user);
+} json_sax;
+
 /* JSON context structure */
 typedef struct json_ctx{
     json_node*      root;       /* pointer to the root node */
-#ifdef JSON_NO_MEMALLOC
-    json_node       pool[JSON_MAX_NODES];   /* if no dynamic allocations -
-                                            the root pointer will be equal to &pool[0]  */
-#endif // JSON_NO_MEMALLOC
-    int             pos;        /* # bytes parsed */
+    size_t          pos;        /* # bytes parsed */
     int             nused;      /* number of nodes used\allocated */
-    int             ndepth;     /* indentation depth counter */
+    int             ndepth;     /* nesting depth of the parser */
     int             decode;     /* if not 0 - strings are decoded to utf-8 */
     json_error      err;        /* error code */
+    int             max_nodes;  /* maximum # nodes, JSON_MAX_NODES by default */
+    json_slab*      slabs;      /* nodes pool: the slabs list, the current slab comes first */
+    json_slab*      spare_slabs;/* nodes pool: slabs kept by json_reset() for reuse */
+    int             slab_next;  /* nodes pool: next never used node in the current slab */
+    int             slab_size;  /* # nodes in the first slab, 0 - no pool, nodes are calloc()'ed */
+    int             pool_size;  /* # nodes in all slabs */
+    json_node*      free_nodes; /* released pool nodes linked through json_node.next */
+    uint32_t*       index;      /* structural index - offsets of the tokens, see json_parse_indexed() */
+    size_t          index_size; /* # offsets the index can hold */
+    int             max_depth;  /* maximum nesting depth, 0 - unlimited. JSON_MAX_DEPTH by default
+                                    if JSON_LIMIT_CHECK defined, 0 otherwise */
+    int             raw_numbers;/* not 0 - numbers are checked but not converted: the nodes are JSON_NUMBER_RAW
+                                    views of the digits, see json_get_integer(). 0 by default */
+    json_node*      cur;        /* parser: the container being parsed */
+    const char*     key;        /* parser: the key of the next value */
+    size_t          key_len;    /* parser: # bytes of key, json_parse_view() only */
+    int             view;       /* parser: not 0 - the buffer is not modified, see json_parse_view() */
+    int             state;      /* parser: what is expected next */
+    int             feed;       /* parser: not 0 - the input comes in pieces, see json_parse_feed() */
+    const json_sax* sax;        /* parser: not NULL - no tree is built, the values go to the callbacks (json_parse_sax()) */
+    void*           sax_user;   /* parser: passed to the callbacks */
+    int             check;      /* parser: not 0 - the buffer is only read, strings are not decoded (json_validate()) */
+    char*           partial;    /* json_parse_feed(): the beginning of a token cut by the end of a buffer */
+    size_t          partial_len;/* # bytes in partial */
+    size_t          partial_size;   /* # bytes allocated for partial */
+    json_scratch*   scratch;    /* scratch memory, released by json_reset() */
+    uint64_t*       nest;       /* no tree (see sax): a bit per nesting level, 1 - object */
+    int             nest_size;  /* # 64 bit words in nest */
+    char*           file_buf;   /* json_parse_file(): the file mapped (or read) into memory */
+    size_t          file_size;  /* # bytes of file_buf */
 } json_ctx;
 
+/* On-demand access: a value in the raw buffer, see json_ondemand() */
+typedef struct json_cursor{
+    json_ctx*       ctx;        /* the context the values are materialized in */
+    const char*     buf;        /* the buffer */
+    size_t          len;        /* # bytes in the buffer */
+    size_t          pos;        /* the first byte of the value */
+} json_cursor;
+
+/* A record (line) of NDJSON, see json_parse_batch() */
+typedef struct json_record{
+    json_node*      root;       /* the root node of the record, NULL on error */
+    json_error      err;        /* error code of the record */
+    size_t          offset;     /* the first byte of the record in the buffer */
+    size_t          pos;        /* # bytes of the record parsed, where the parser stopped on error */
+} json_record;
+
+/* A worker of json_parse_batch(): its part of the buffer and the records found there */
+typedef struct json_worker{
+    json_ctx*       ctx;        /* the nodes of the records live here */
+    json_record*    records;    /* the records of the part in input order */
+    size_t          nrecords;   /* # records of the part */
+    size_t          size;       /* # records allocated */
+    char*           buf;        /* the buffer */
+    size_t          beg;        /* the first byte of the part */
+    size_t          end;        /* the byte after the last one of the part */
+    int             decode;     /* as ctx->decode */
+    int             max_nodes;  /* maximum # nodes of a record */
+    json_error      err;        /* error code of the part */
+    json_node*      array;      /* json_parse_parallel(): the array the elements of the part belong to */
+    json_node*      holder;     /* json_parse_parallel(): the elements of the part are parsed as its children */
+    int             depth;      /* json_parse_parallel(): the nesting depth of the array */
+} json_worker;
+
+/* NDJSON batch parser, see json_batch_init() */
+typedef struct json_batch{
+    json_record*    records;    /* the records in input order */
+    size_t          nrecords;   /* # records */
+    size_t          nfailed;    /* # records with an error */
+    size_t          size;       /* # records allocated */
+    int             max_nodes;  /* maximum # nodes of a record, JSON_MAX_NODES by default */
+    int             max_depth;  /* maximum nesting depth of a record, as json_ctx.max_depth */
+    int             raw_numbers;/* as json_ctx.raw_numbers */
+    json_error      err;        /* error code of the batch as a whole (not of a record) */
+    size_t          pos;        /* json_parse_parallel(): # bytes parsed, where the parser stopped on error */
+    int             nthreads;   /* # workers */
+    json_worker*    workers;    /* a worker per thread */
+    void*           threads;    /* the thread handles */
+} json_batch;
+
+/* Layout of the formatted output, see json_to_string_fmt().
+*   A zeroed struct is the format of json_to_string(nd, out, outlen, 0) */
+typedef struct json_format{
+    int             indent;     /* # spaces per nesting level, 0 - a tab */
+    int             lf;         /* not 0 - the lines end with LF, 0 - CR LF */
+    int             expand_arrays;  /* not 0 - an element of an array per line,
+                                    0 - an array is kept on a line (an object in it starts a new one) */
+} json_format;
+
+/* Output sink of json_write(), see json_writer_buffer() */
+typedef struct json_writer{
+    char*           buf;        /* json_writer_buffer(): the output, the staging buffer otherwise */
+    size_t          pos;        /* # bytes in buf */
+    size_t          size;       /* # bytes buf can take */
+    size_t          total;      /* # bytes passed to flush so far */
+    int             (*flush)(void* user, const char* data, size_t len);  /* the sink, NULL - buf grows.
+                                    Returns 0 if the bytes can't be written, not 0 otherwise */
+    void*           user;       /* passed to flush as is */
+    int             owned;      /* not 0 - buf is allocated by the writer */
+    int             no_escape_slash;    /* not 0 - '/' is written as is (e.g. in URLs), "\/" by default */
+    const json_format*  format; /* the layout of the formatted output, NULL - as json_to_string() */
+    json_error      err;        /* error code, a failed writer writes nothing more */
+} json_writer;
+
 /** Initialize a new JSON context structure
 *    Return: pointer to the json_ctx struct
 *    Remark: the function allocates and zeroes  json_ctx struct.
-*       If JSON_NO_MEMALLOC defined it also makes one-time allocation for
-*       a pool of JSON_MAX_NODES. Otherwise calloc() is called for every
-*       node when it is created.
+*       If JSON_NO_MEMALLOC defined it is json_init_pool(JSON_SLAB_NODES, JSON_MAX_NODES).
+*       Otherwise calloc() is called for every node when it is created.
 *       A call to json_remove_node() releases the memory for a particular node and
 *       for all its descendants.
 *       A call to json_destroy(ctx) releases everything.
 */
 json_ctx* json_init(void);
 
+/** Initialize a new JSON context structure with a nodes pool (arena mode)
+*   Input:
+*       init_nodes - # nodes in the first slab, allocated right away,
+*               if <= 0 JSON_SLAB_NODES is used
+*       max_nodes - maximum # nodes in the context, if <= 0 JSON_MAX_NODES is used
+*   Return: pointer to the json_ctx struct or NULL on allocation error
+*   Remark: nodes are carved out of slabs. When the pool is exhausted a new slab
+*       doubles its capacity (up to max_nodes), so a parse costs a few malloc() calls
+*       instead of one calloc() per node and none at all once the pool is warm
+*       (see json_reset()).
+*       Nodes released by json_remove_node() go to the pool's free list and are
+*       reused by the following json_add_*() calls.
+*       json_destroy(ctx) releases all slabs at once without walking the tree.
+*/
+json_ctx* json_init_pool(int init_nodes, int max_nodes);
+
+/** Same as json_init_pool(slab_nodes, JSON_MAX_NODES) */
+json_ctx* json_init_arena(int slab_nodes);
+
 /**
 *   Parse existing JSON string
 *   Input:
@@ -144,10 +307,208 @@ json_ctx* json_init(void);
 *           - end of buffer reached
 *           - error encountered
 *           on return ctx->err is set to json_error value
+*       The parser is not recursive, the nesting depth is limited by ctx->max_depth only
+*       (set it after json_init(), 0 - unlimited), exceeding it sets ERR_JSON_DEPTH.
+*       Parsing starts at ctx->pos, so consecutive documents in one buffer may be parsed
+*       by consecutive calls. The tree of the previous document must be released first:
+*       json_reset() sets ctx->pos to 0, keep it across the call
+*       (pos = ctx->pos; json_reset(ctx); ctx->pos = pos;).
 *       The parser accepts only UTF-8 encoded strings.
 *       Don't try to parse string literals! They're read-only and will cause segmentation fault.
+*       json_parse_view() parses them without modification.
+*/
+json_node* json_parse(json_ctx* ctx, char* buf, size_t buflen, int to_utf8);
+
+/** Same as json_parse() but the buffer is not modified
+*   Return: pointer to root json_node structure or NULL on error (ctx->err is set)
+*   Remarks:
+*       Keys and string values are views into the buffer: they are not null terminated,
+*       their lengths are json_node.key_len and json_node.str_len. A string with escapes
+*       is decoded into the scratch memory of ctx (released by json_reset()) when it is
+*       met, the empty ones point to a static "". So read-only memory (string literals,
+*       mapped files) may be parsed, but it must stay valid as long as the tree is used.
+*       A number too long to be converted is a view of its digits, so unlike json_parse()
+*       it may end the buffer: such a root value is parsed (json_parse() fails with
+*       ERR_JSON_INCOMPLETE at pos 0 - there is no room for the null terminator), and a
+*       document cut after it fails at its end (json_parse() gives the number's offset).
+*       json_get_node() and json_to_string() take the lengths into account,
+*       json_node.str_len\key_len must be reset to 0 when a null terminated string
+*       is assigned to a node of the tree.
+*/
+json_node* json_parse_view(json_ctx* ctx, const char* buf, size_t buflen, int to_utf8);
+
+/** Parse a JSON file
+*   Input:
+*       ctx - pointer to json_ctx structure, it is reset first (see json_reset())
+*       fname - the file name
+*       to_utf8 - as in json_parse()
+*   Return: pointer to root json_node structure or NULL on error (ctx->err is set,
+*       ERR_JSON_FILE - the file can't be opened, read or mapped)
+*   Remarks:
+*       The file is mapped into memory read-only (where mmap() is available, it is
+*       read into a buffer otherwise) and parsed by json_parse_view(): the keys
+*       and the strings of the tree are views into the mapping, so nothing is copied.
+*       The mapping is advised for sequential access (and huge pages if supported)
+*       while the file is parsed. It lives until json_reset() or json_destroy().
+*       Define JSON_NO_MMAP to read the file with fread() anyway.
+*/
+json_node* json_parse_file(json_ctx* ctx, const char* fname, int to_utf8);
+
+/** Parse a JSON document which comes in pieces (e.g. socket reads)
+*   Input: same as json_parse(), buf is the next piece of the document,
+*       buflen == 0 marks the end of input (it is needed only if the document is
+*       a single number, otherwise the document ends with its root value)
+*   Return: pointer to root json_node structure when the document is complete
+*       NULL - if ctx->err == ERR_JSON_INCOMPLETE the function waits for the next piece,
+*           otherwise an error occurred
+*       ctx->pos - # bytes of the buf parsed
+*   Remarks:
+*       The partial tree and the parser state are kept in ctx, every call continues
+*       where the previous one stopped, even in the middle of a string or a number.
+*       As with json_parse() the tree points into the buffers, so all of them must
+*       stay valid as long as the tree is used. A token split between the buffers
+*       is put together in the scratch memory of ctx.
+*       Call json_reset() before the next document.
+*/
+json_node* json_parse_feed(json_ctx* ctx, char* buf, size_t buflen, int to_utf8);
+
+/** Parse JSON string without building a tree - the callbacks are called instead
+*   Input:
+*       ctx - pointer to json_ctx structure, no nodes are taken from it
+*       buf, buflen, to_utf8 - as in json_parse()
+*       sax - the callbacks
+*       user - passed to every callback as is
+*   Return: ~0 - the value is parsed, 0 - an error occurred (ctx->err is set)
+*   Remark: the parser of json_parse() without the tree, so the errors and ctx->pos are
+*       the same. Strings are decoded in place and keys and strings passed to the callbacks
+*       are valid as long as the buffer is. Numbers are always converted (ctx->raw_numbers
+*       is not used). Parsing starts at ctx->pos, nesting depth is limited by ctx->max_depth.
+*/
+int json_parse_sax(json_ctx* ctx, char* buf, size_t buflen, int to_utf8, const json_sax* sax, void* user);
+
+/** Start on-demand access to JSON string - nothing is parsed up front
+*   Input:
+*       ctx - pointer to json_ctx structure, it is reset
+*       buf - the buffer, it is not modified
+*       buflen - # bytes in the buffer
+*       to_utf8 - as in json_parse()
+*   Output: cur - the cursor at the root value
+*   Return: ~0 - success, 0 - an error occurred (ctx->err is set)
+*   Remark: json_cursor_get() and json_cursor_element() scan forward from the
+*       start of a container and skip the values they pass over by counting braces
+*       and brackets outside the strings. Only json_cursor_value() parses (and fully
+*       validates) a value. The skipped values are not validated.
+*       The buffer must stay valid while the cursors are used.
+*/
+int json_ondemand(json_ctx* ctx, const char* buf, size_t buflen, int to_utf8, json_cursor* cur);
+
+/** Find a member of an object by its key
+*   Output: out - the cursor at the value
+*   Return: ~0 - found, 0 - not found (ctx->err == ERR_JSON_OK) or an error occurred
+*   Remark: the first member with the key is found
+*/
+int json_cursor_get(const json_cursor* obj, const char* key, json_cursor* out);
+
+/** Find an element of an array by its index
+*   Output: out - the cursor at the element
+*   Return: ~0 - found, 0 - not found (ctx->err == ERR_JSON_OK) or an error occurred
+*/
+int json_cursor_element(const json_cursor* arr, int index, json_cursor* out);
+
+/** Move the cursor at an element of an array (or at a member of an object) to the next one
+*   Return: ~0 - moved, 0 - it was the last one (ctx->err == ERR_JSON_OK) or an error occurred
+*/
+int json_cursor_next(json_cursor* cur);
+
+/** Get the type of the value at the cursor without parsing it */
+json_type json_cursor_type(const json_cursor* cur);
+
+/** Parse the value at the cursor into nodes
+*   Return: pointer to the value's node or NULL on error (ctx->err is set)
+*   Remark: the value is parsed from a copy kept in the scratch memory. Its node
+*       is added to ctx->root - an array of all the values materialized since
+*       json_ondemand(), they live until json_reset() or json_destroy()
+*/
+json_node* json_cursor_value(const json_cursor* cur);
+
+/** Check that the buffer holds well-formed JSON within the limits - no tree is built
+*   Input:
+*       ctx - pointer to json_ctx structure, no nodes are taken from it
+*       buf - the buffer, it is not modified
+*       buflen - # bytes in the buffer
+*   Return: ~0 - valid, 0 - not valid (ctx->err and ctx->pos are set as
+*       json_parse(ctx, buf, buflen, 1) sets them)
+*   Remark: the parser of json_parse() with no tree, which only reads the buffer: the
+*       strings are scanned by find_strspec() (SSE2\AVX2 if available) and checked but
+*       not decoded. Validation stops after the root value like json_parse() does.
+*       One difference: escapes json.org doesn't list (e.g. \q) are rejected at the char
+*       after the backslash, json_parse() copies them as they are
 */
-json_node* json_parse(json_ctx* ctx, char* buf, int buflen, int to_utf8);
+int json_validate(json_ctx* ctx, const char* buf, size_t buflen);
+
+/** Same as json_parse() but the input is parsed in two stages
+*   Remark: the first stage classifies the buffer 64 bytes at a time (with SSE2\AVX2
+*       if available) and builds an index of structural characters, string and scalar
+*       values offsets (ctx->index) skipping whitespace and string contents. The second
+*       stage walks the index and builds the same tree json_parse() does, an invalid
+*       document gets the same ctx->err and ctx->pos.
+*       The index memory is kept by json_reset() and released by json_destroy().
+*       The offsets of the index are 32 bit - a document of 4 GB or more is rejected
+*       with ERR_JSON_OVERFLOW.
+*/
+json_node* json_parse_indexed(json_ctx* ctx, char* buf, size_t buflen, int to_utf8);
+
+/** Create a batch parser of newline delimited JSON (NDJSON, JSON Lines)
+*   Input: nthreads - # worker threads, if <= 0 - # online CPUs
+*   Return: pointer to the json_batch struct or NULL on allocation error
+*   Remark: every worker has a context with a nodes pool of its own, the pools
+*       are kept between the batches. Where POSIX threads are not available
+*       (or JSON_NO_THREADS is defined) there is a single worker.
+*/
+json_batch* json_batch_init(int nthreads);
+
+/** Parse a batch of records - one JSON value per line
+*   Input:
+*       batch - the batch parser
+*       buf, buflen, to_utf8 - as in json_parse(), the buffer is modified the same way
+*   Return: ~0 - the batch is parsed, 0 - an error occurred (batch->err is set)
+*       batch->records - the roots, error codes and offsets of the records in input order,
+*       batch->nfailed - # records with an error, a failed record doesn't stop the others
+*   Remarks:
+*       The buffer is split into parts at line feeds, one per worker. A worker finds
+*       the line feeds of its part with find_charpos() (SSE2\AVX2 if available) and
+*       parses the records one by one with json_parse(). Blank lines are skipped,
+*       anything but whitespace after the value of a record is ERR_JSON_UNEXPECTED.
+*       batch->max_nodes and batch->max_depth limit every record.
+*       The trees live until the next json_parse_batch() or json_batch_destroy().
+*/
+int json_parse_batch(json_batch* batch, char* buf, size_t buflen, int to_utf8);
+
+/** Parse a single large document with the workers of the batch parser
+*   Input:
+*       batch - the batch parser (see json_batch_init())
+*       buf, buflen, to_utf8 - as in json_parse(), the buffer is modified the same way
+*   Return: pointer to the root json_node structure or NULL on error
+*       (batch->err is set, batch->pos is where the parser stopped)
+*   Remarks:
+*       The structural index of json_parse_indexed() finds the array with the most bytes
+*       outside its largest element (the root array of records, "features" of a GeoJSON
+*       collection, the coordinates of a huge polygon) and the commas between its elements.
+*       The elements are split there into parts of about the same size, every worker parses
+*       its part into its own nodes pool, then the parts are linked into the array in order.
+*       The rest of the document is parsed by the calling thread. The tree and the errors are
+*       the ones json_parse() gives, batch->max_nodes and batch->max_depth limit
+*       the whole document.
+*       A document too small to split (or without such an array) is parsed by json_parse().
+*       The nodes belong to the contexts of the workers: the tree lives until the next
+*       json_parse_batch()\json_parse_parallel() or json_batch_destroy() and
+*       json_remove_node() must not be called for its nodes.
+*       The offsets of the index are 32 bit - a document of 4 GB or more is not split.
+*/
+json_node* json_parse_parallel(json_batch* batch, char* buf, size_t buflen, int to_utf8);
+
+/** Release the batch parser, the contexts of its workers and all the trees */
+void json_batch_destroy(json_batch* batch);
 
 /** Get node by a given key
 *   Input:
@@ -168,6 +529,23 @@ json_node* json_get_element(json_node* parent, int index);
 */
 int json_get_nelements(json_node* parent);
 
+/** Get the value of a number node
+*   Input:
+*       nd - JSON_INTEGER, JSON_DOUBLE or JSON_NUMBER_RAW node
+*   Output: val - the value
+*   Return: 0 on error - nd is not a number, a double is asked for as an integer or the number
+*       can't be converted without precision loss (see json_atonum()), not 0 otherwise
+*   Remarks:
+*       JSON_NUMBER_RAW node is converted on the first call and becomes JSON_INTEGER or
+*       JSON_DOUBLE node, the next calls just read its value. From then on it is serialized
+*       from the value (a double in the shortest form which reads back the same).
+*       A number which can't be converted stays JSON_NUMBER_RAW.
+*       json_get_double() converts an integer to double.
+*       The conversion changes the node, the tree must not be read by other threads meanwhile.
+*/
+int json_get_integer(json_node* nd, long long* val);
+int json_get_double(json_node* nd, double* val);
+
 /** Add json node
 *    Input:  ctx - pointer to the json_ctx structure
 *       parent - pointer to parent node (must be object or array type)
@@ -198,6 +576,15 @@ void json_remove_node(json_ctx* ctx, json_node *nd);
 */
 void json_destroy(json_ctx* ctx);
 
+/** Prepare json_ctx structure for parsing a new document
+*   Remark: the tree is deleted, the parser state (pos, nused, err and the depth counter)
+*       is cleared, but the memory is kept: the slabs of the nodes pool are reused
+*       by the next json_parse() which does not allocate anything until it needs
+*       more nodes than the previous documents did.
+*       Without the nodes pool the nodes are released one by one.
+*/
+void json_reset(json_ctx* ctx);
+
 /**
 *   Serialize json_node object into preallocated buffer
 *   Input:
@@ -210,8 +597,106 @@ void json_destroy(json_ctx* ctx);
 *   Remark: null terminator is placed at the end of output string even if
 *       the object is serialized partially
 *       if nd == ctx->root the whole object will be serialized
+*       The output size need not be known in advance with json_write()
+*       The tree is walked without recursion (by the parent links), so any depth is
+*       written, and it is only read: several threads may serialize one tree at once
+*/
+ptrdiff_t json_to_string(json_node* nd, char* out, size_t outlen, int compact);
+
+/** Get the exact # bytes json_to_string() writes for a node without writing it
+*   Input: nd, compact - as in json_to_string()
+*   Return: # bytes (not including null terminator) or -1 if the node can't be serialized
+*       (a key is missing in an object, an unexpected type, Inf or NaN)
+*   Remark: the runs of the strings without escapes are skipped 16\32 bytes at a time
+*       (as json_to_string() finds them) and the digits of the integers are counted without
+*       converting them, only the doubles are converted (to find their shortest form).
+*       A buffer of the size + 1 bytes takes the output of json_to_string().
+*       '/' is counted escaped, see json_write_size() for the output of a writer
+*/
+ptrdiff_t json_serialized_size(json_node* nd, int compact);
+
+/** Serialize json_node object into preallocated buffer, formatted as fmt tells
+*   Input: nd, out, outlen - as in json_to_string()
+*       fmt - the line breaks, the indentation and the layout of the arrays,
+*               NULL - as json_to_string(nd, out, outlen, 0)
+*   Return: # bytes written (not including null terminator) or -1 on error
+*   Remark: e.g. {2, 1, 0} - LF and 2 spaces per level, the arrays on a line.
+*       A line break and its indentation are copied at once from a table
+*       filled once per call, so the formatted output costs little more than
+*       the compact one beyond the extra bytes. json_write() takes the format
+*       from json_writer.format
+*/
+ptrdiff_t json_to_string_fmt(json_node* nd, char* out, size_t outlen, const json_format* fmt);
+
+/** Same as json_serialized_size(nd, 0) for the output of json_to_string_fmt(nd, .., fmt) */
+ptrdiff_t json_serialized_size_fmt(json_node* nd, const json_format* fmt);
+
+/** Set up a writer which serializes into a growable buffer
+*   Input:
+*       w - the writer
+*       size - # bytes allocated up front, the buffer doubles when it is full
+*   Return: ~0 - success, 0 - allocation error (w->err is set)
+*   Remark: the output is w->buf, w->pos bytes long and null terminated. It is kept
+*       until json_writer_close() - to keep it longer take w->buf and set it to NULL
+*       before the call (release it with free()).
+*/
+int json_writer_buffer(json_writer* w, size_t size);
+
+/** Set up a writer which serializes into a file (or a file descriptor)
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*   Remark: the output is staged in a 64 KB buffer, the file gets it when the buffer is full
+*       and on json_writer_flush()\json_writer_close(). A write error is ERR_JSON_FILE.
+*/
+int json_writer_file(json_writer* w, FILE* fp);
+int json_writer_fd(json_writer* w, int fd);
+
+/** Set up a writer which passes the output to a callback
+*   Input:
+*       w - the writer
+*       flush - called with the staged bytes when the buffer is full (and on json_writer_flush()),
+*               returns 0 to stop the output (w->err is set to ERR_JSON_FILE), not 0 to go on
+*       user - passed to flush as is
+*       stage - the staging buffer, NULL - it is allocated
+*       size - # bytes of stage, at least 64 (if stage == NULL less than 64 means 64 KB)
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*   Remark: a string too long for the staging buffer is passed to flush straight from the tree
+*/
+int json_writer_callback(json_writer* w, int (*flush)(void* user, const char* data, size_t len),
+                         void* user, char* stage, size_t size);
+
+/** Serialize json_node object into the writer
+*   Input: nd, compact - as in json_to_string()
+*   Return: # bytes of the output or -1 on error (w->err is set)
+*   Remarks:
+*       The output is appended to what the writer already has, so a sequence of values
+*       may be written (see json_writer_put() for the separators). Nothing fails for lack of
+*       space: the buffer grows or the staged bytes are flushed. The output is the same
+*       json_to_string() gives, '/' is not escaped if w->no_escape_slash is set.
+*       The last bytes stay in the staging buffer until json_writer_flush()\json_writer_close().
+*/
+ptrdiff_t json_write(json_writer* w, json_node* nd, int compact);
+
+/** Get the exact # bytes json_write(w, nd, compact) writes without writing it
+*   Return: # bytes or -1 if the node can't be serialized
+*   Remark: the settings of the writer are taken into account (w->no_escape_slash,
+*       w->format), nothing is written to it
+*/
+ptrdiff_t json_write_size(const json_writer* w, json_node* nd, int compact);
+
+/** Append len bytes to the output as is (e.g. a line feed between NDJSON records)
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*/
+int json_writer_put(json_writer* w, const char* data, size_t len);
+
+/** Pass the staged output to the sink (fflush() for a file)
+*   Return: ~0 - success, 0 - an error occurred
+*/
+int json_writer_flush(json_writer* w);
+
+/** Flush the writer and release its buffer
+*   Return: ~0 - success, 0 - the output is not complete (an error occurred earlier or now)
 */
-int json_to_string(json_node* nd, char* out, int outlen, int compact);
+int json_writer_close(json_writer* w);
 
 /* just a forward declaration - for use in tests  - see source file for full description */
 int json_atonum(char* buf, int* len, void* jnum);
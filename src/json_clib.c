@@ -21,9 +21,45 @@ SOFTWARE.
 */
 #include "json_clib.h"
 
-#ifdef JSON_NO_MEMALLOC
 #include <string.h>
-#endif // JSON_NO_MEMALLOC
+#include <limits.h>
+#include <float.h>
+#include <locale.h>
+
+/* json_parse_file() maps the file, fread() is used where mmap() is not available */
+#if (defined(__unix__)||defined(__APPLE__))&&(!defined(JSON_NO_MMAP))
+#define JSON_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* the fread() path of json_parse_file() - long is 32 bit on Windows */
+#ifdef _WIN32
+#define json_fseek _fseeki64
+#define json_ftell _ftelli64
+#else
+#define json_fseek fseek
+#define json_ftell ftell
+#endif // _WIN32
+
+/* json_parse_batch() runs the workers in threads, the calling thread does all the work otherwise */
+#if (defined(__unix__)||defined(__APPLE__))&&(!defined(JSON_NO_THREADS))
+#define JSON_USE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* json_writer_fd() */
+#if defined(__unix__)||defined(__APPLE__)
+#define JSON_USE_FD
+#include <unistd.h>
+#include <errno.h>
+#elif defined(_WIN32)
+#define JSON_USE_FD
+#include <io.h>
+#endif
 
 #ifdef _MSC_VER
 #define __func__ __FUNCTION__
@@ -33,7 +69,7 @@ SOFTWARE.
 #define JSON_SHOW_ERROR(TXT) \
 do{ \
     fprintf(stderr, "%s failed in line %d: %s\n", __func__, __LINE__, TXT); \
-    fprintf(stderr, "cursor position %d\n", ctx->pos); \
+    fprintf(stderr, "cursor position %llu\n", (unsigned long long)ctx->pos); \
 } while(0)
 #else
 #define JSON_SHOW_ERROR(TXT)
@@ -47,24 +83,114 @@ do{ \
 #define LLONG_MAX ((long long)((unsigned long long)~0 >> 1))
 #endif // LLONG_MAX
 
-#define CUTOFF_POS (LLONG_MAX/10)
-#define TRESHOLD_POS ((int)(LLONG_MAX%10))
+#define IS_DIGIT_GEZ(c) ((unsigned)((c) - 0x30) < 10)
+
+#if (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)) || \
+    defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#define JSON_LITTLE_ENDIAN
+#endif // __BYTE_ORDER__
+
+/** # trailing zeros of a non-zero word */
+static __inline int json_ctz64(uint64_t v)
+{
+#ifdef _MSC_VER
+    unsigned long c = 0;
+    _BitScanForward64(&c, v);
+    return (int)c;
+#else
+    return __builtin_ctzll(v);
+#endif // _MSC_VER
+}
+
+/* a byte of the result is 0 if the byte of x is an ascii digit: its high nibble is 3
+   and adding 6 doesn't carry into it. A carry out of a non-digit byte may spoil
+   the bytes above it, the lowest non-digit byte is always right */
+#define NON_DIGITS(x) ((((x) & 0xf0f0f0f0f0f0f0f0ULL) | \
+                        ((((x) + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ^ 0x3333333333333333ULL)
+
+#ifdef JSON_LITTLE_ENDIAN
+/** 8 ascii digits of a little-endian word to their value, the first byte is the
+*   most significant digit: the pairs, the quads and the octet are merged by three
+*   multiply-shifts
+*/
+static __inline uint32_t json_eight_digits(uint64_t x)
+{
+    x = ((x & 0x0f0f0f0f0f0f0f0fULL) * 2561) >> 8;
+    x = ((x & 0x00ff00ff00ff00ffULL) * 6553601) >> 16;
+    return (uint32_t)(((x & 0x0000ffff0000ffffULL) * 42949672960001ULL) >> 32);
+}
 
-#define CUTOFF_NEG (LLONG_MIN/10)
-#define TRESHOLD_NEG (-(int)(LLONG_MAX%10))
+/** Append 8 digits at buf[*i] to *mant if they all are digits and there is room for them
+*   Return: not 0 if the digits are appended
+*/
+static __inline int json_append_digits(const char* buf, int* i, uint64_t* mant, int room)
+{
+    uint64_t x;
+    if(room < 8) return 0;
+    memcpy(&x, buf + *i, 8);
+    if(NON_DIGITS(x)) return 0;
+    *mant = *mant * 100000000ULL + json_eight_digits(x);
+    *i += 8;
+    return ~0;
+}
+#endif // JSON_LITTLE_ENDIAN
 
-#define IS_DIGIT_GEZ(c) ((unsigned)(c - 0x30) < 10)
+/* a length for the functions which take int, the lengths they need are short */
+#define INT_CLAMP(x) (((x) > INT_MAX) ? INT_MAX : (int)(x))
 
 /** Largest possible base 10 exponent. Any larger number
 *   will result in overflow or underflow so we stop the parsing
 */
 #define MAX_EXPONENT 511
 
-/** To to convert decimal into floating point numbers. Usage: 10^2^i */
-static double pof_ten[] = {10., 100., 1.0e4, 1.0e8, 1.0e16, 1.0e32, 1.0e64, 1.0e128, 1.0e256};
-static double tens_map[] = {1.,10.,100.,1000.,1.0e4,1.0e5,1.0e6,1.0e7,1.0e8,1.0e9,1.0e10,
-1.0e11,1.0e12,1.0e13,1.0e14,1.0e15,1.0e16,1.0e17,1.0e18};
+/* default ctx->max_depth */
+#ifdef JSON_LIMIT_CHECK
+#define JSON_DEPTH_LIMIT JSON_MAX_DEPTH
+#else
+#define JSON_DEPTH_LIMIT 0
+#endif // JSON_LIMIT_CHECK
+
+/* json_parse_batch(): minimum # bytes of a worker's part */
+#define JSON_BATCH_MIN_PART     (64 * 1024)
+
+/* json_parse_parallel(): the arrays nested deeper are not split */
+#define JSON_SPLIT_DEPTH        64
+
+/* # decimal digits which always fit into uint64_t */
+#define MAX_SIG_DIGITS 19
+
+/* json_strtod(): the numbers shorter are copied on the stack */
+#define JSON_NUM_BUF 64
+
+/* the byte of the number or 0 past the end of the buffer */
+#define NUM_CH(k) (((k) < rlen) ? buf[k] : '\0')
 
+/**
+*   Correctly rounded conversion of the number from all its digits, for the rare
+*   cases decimal_to_double() can't decide from the first 19 ones
+*   Input: buf - valid JSON number
+*           len - its length
+*   Output: dbl - result
+*   Return: 0 - memory allocation error
+*/
+static int json_strtod(const char* buf, int len, double* dbl)
+{
+    char tmp[JSON_NUM_BUF];
+    char* s = tmp;
+    char* dp;
+    if(len >= JSON_NUM_BUF){
+        s = malloc(len + 1);
+        if(!s) return 0;
+    }
+    memcpy(s, buf, len);
+    s[len] = '\0';
+    /* strtod() expects the decimal point of the current locale */
+    dp = memchr(s, '.', len);
+    if(dp) *dp = localeconv()->decimal_point[0];
+    *dbl = strtod(s, NULL);
+    if(s != tmp) free(s);
+    return ~0;
+}
 
 /**
 *   Turn valid JSON ascii sequence into a number value: long long, or double
@@ -89,206 +215,205 @@ static double tens_map[] = {1.,10.,100.,1000.,1.0e4,1.0e5,1.0e6,1.0e7,1.0e8,1.0e
 *           If pointer to the union of long long and double is
 *           provided as input, the result will be casted automatically
 *           The initial string is unmodified
+*           The numbers with a fraction or an exponent are rounded to the nearest
+*           double (ties to even) whatever the number of digits is. The integers
+*           out of long long range, the exponents larger than MAX_EXPONENT and
+*           the numbers out of double range are kept as strings (-2)
 */
 int json_atonum(char* buf, int* len, void* jnum)
 {
     long long* intgr = (long long*)jnum;
     double* dbl = (double*)jnum;
     char** str = jnum;
-    double  dexp = 1.0;
-    long long rint = 0LL;   /* value read from integer part */
+    uint64_t mant = 0;      /* the first MAX_SIG_DIGITS significant digits */
+    int nsig = 0;           /* # digits in mant */
+    int dexp = 0;           /* decimal exponent of mant */
+    int trunc = 0;          /* non zero digits were dropped after the first ones */
     int rexp = 0;           /* value read from exponent part */
     int i = 0, rlen = *len;
     int neg = 0;            /* sign - negative or positive */
     int neg_exp = 0;        /* exponent sign */
-    int nbeforedp;          /* # digits before decimal point */
-    int nmantissa;          /* # digits in mantissa */
     char ch;
     if(buf[i] == '-'){
         i++;
         neg = 1;
     }
-    ch = buf[i];
-    if(IS_DIGIT_GEZ(ch)){
-        if(ch == '0'){
-            ch = buf[++i];
-            if(ch == '.'){
-                i++;
-                goto LB_FRAC;
-            }
-            if((ch == 'e')||
-               (ch == 'E')){
-                    i++;
-                    goto LB_EXP;
-               }
-            if(IS_DIGIT_GEZ(ch)){
-                *len = i;
-                return -1; /* leading 0s are not allowed */
-            }
-            *intgr = 0LL;
-            *len = i;
-            return 1; /* return 0 */
-        }
-        ch -= '0';
-        if(neg) rint -= ch;
-        else  rint += ch;
+    ch = NUM_CH(i);
+    if(!IS_DIGIT_GEZ(ch)){
+        *len = i;
+        return -1;
+    }
+    if(ch == '0'){
         i++;
-    } else return -1;
-    /* continue parsing integer part */
-    while(i < rlen){
-        ch = buf[i];
+        ch = NUM_CH(i);
         if(IS_DIGIT_GEZ(ch)){
-            /* next digit */
-            if(neg){
-                if((rint < CUTOFF_NEG)||(rint == CUTOFF_NEG && ch > TRESHOLD_NEG)){
-                    goto LB_OFL_INT;
-                }
-                else{
-                    rint *= 10;
-                    rint -= ch - '0';
-                }
+            *len = i;
+            return -1; /* leading 0s are not allowed */
+        }
+    }
+    else{
+        /* integer part */
+#ifdef JSON_LITTLE_ENDIAN
+        while((i + 8 <= rlen)&&(json_append_digits(buf, &i, &mant, MAX_SIG_DIGITS - nsig))) nsig += 8;
+#endif // JSON_LITTLE_ENDIAN
+        while(i < rlen){
+            ch = buf[i];
+            if(!IS_DIGIT_GEZ(ch)) break;
+            if(nsig < MAX_SIG_DIGITS){
+                mant = mant * 10 + (ch - '0');
+                nsig++;
             }
             else{
-                if((rint > CUTOFF_POS)||(rint == CUTOFF_POS && ch > TRESHOLD_POS)){
-                    goto LB_OFL_INT;
-                }
-                else{
-                    rint *= 10;
-                    rint += ch - '0';
-                }
+                dexp++;
+                if(ch != '0') trunc = 1;
             }
-        }
-        else if(ch == '.') { i++; goto LB_FRAC;}
-        else if((ch == 'e')||(ch == 'E')){
-            *dbl = (double)rint;
             i++;
-            goto LB_EXP;
         }
-        else break;
-        i++;
+        ch = NUM_CH(i);
     }
-    *intgr = rint;
-    *len = i;
-    return 1; /* the result is long long */
-LB_FRAC:
-    /* here we have buf[i-1] == ',' */
-    /* get number of digits before decimal point */
-    nbeforedp = neg?(i-2):(i-1);
-    nmantissa = nbeforedp;
-    /* JSON number must have at least one digit after the dec pt */
-    ch = buf[i];
-    if(!IS_DIGIT_GEZ(ch)){
+    if((ch != '.')&&(ch != 'e')&&(ch != 'E')){
+        /* the result is long long if it fits */
+        if(dexp || (mant > (uint64_t)LLONG_MAX + neg)) goto LB_OFL;
+        if(neg && mant) *intgr = -(long long)(mant - 1) - 1;
+        else *intgr = (long long)mant;
         *len = i;
-        return -1;
+        return 1;
     }
-    while(i < rlen){
-        if(IS_DIGIT_GEZ(ch)){
-            if(nmantissa > 18){
-                /* the value is too long. It can not be represented without rounding */
-                /* we threat this as overflow */
+    if(ch == '.'){
+        i++;
+        /* JSON number must have at least one digit after the dec pt */
+        if(!IS_DIGIT_GEZ(NUM_CH(i))){
+            *len = i;
+            return -1;
+        }
+        /* leading 0s of the fraction are not significant */
+        if(!mant){
+            while((i < rlen)&&(buf[i] == '0')){
                 i++;
-                goto LB_OFL_DEC;
-            }
-            /* continue consuming the fractional part */
-            if(neg){
-                rint = rint * 10 - (ch - '0');
-            } else{
-                rint = rint * 10 + (ch - '0');
+                dexp--;
             }
         }
-        else if((ch == 'e')||(ch == 'E')){
+#ifdef JSON_LITTLE_ENDIAN
+        while((i + 8 <= rlen)&&(json_append_digits(buf, &i, &mant, MAX_SIG_DIGITS - nsig))){
+            nsig += 8;
+            dexp -= 8;
+        }
+#endif // JSON_LITTLE_ENDIAN
+        while(i < rlen){
+            ch = buf[i];
+            if(!IS_DIGIT_GEZ(ch)) break;
+            if(nsig < MAX_SIG_DIGITS){
+                mant = mant * 10 + (ch - '0');
+                dexp--;
+                nsig++;
+            }
+            else if(ch != '0') trunc = 1;
             i++;
-            *dbl = (double)rint/(tens_map[nmantissa - nbeforedp]);
-            goto LB_EXP;
         }
-        else break;
-        ch = buf[++i];
-        nmantissa++;
+        ch = NUM_CH(i);
     }
-    /* the result is double */
-    *dbl = (double)rint/(tens_map[nmantissa - nbeforedp]);
-    *len = i;
-    return 2;
-LB_EXP:
-    /* here we have exponent symbol at buf[i-1] */
-    if(buf[i] == '-'){
+    if((ch == 'e')||(ch == 'E')){
         i++;
-        neg_exp = 1;
-    }
-    else if (buf[i] == '+') i++;
-    /* at least one digit must follow exponent symbol */
-    if(!IS_DIGIT_GEZ(buf[i])) return -1;
-    /* trim leading 0s */
-    while(buf[i] == '0'){
-        if(i >= rlen) break;
-        i++;
-    }
-    while(i < rlen){
-        ch = buf[i];
-        if(IS_DIGIT_GEZ(ch)){
-            rexp = rexp * 10 + (ch - '0');
-            if(rexp > MAX_EXPONENT) goto LB_OFL_EXP;
+        if(NUM_CH(i) == '-'){
+            i++;
+            neg_exp = 1;
+        }
+        else if (NUM_CH(i) == '+') i++;
+        /* at least one digit must follow exponent symbol */
+        if(!IS_DIGIT_GEZ(NUM_CH(i))){
+            *len = i;
+            return -1;
+        }
+        while(i < rlen){
+            ch = buf[i];
+            if(!IS_DIGIT_GEZ(ch)) break;
+            if(rexp <= MAX_EXPONENT) rexp = rexp * 10 + (ch - '0');
             i++;
-        } else  break;
-    }
-     /* Generate a floating-point number that represents the exponent.
-        Process one bit at a time to combine many powers of 2 of 10.
-        Then combine the exponent with the fractional part */
-    for (int k = 0; rexp != 0; k++){
-        if (rexp & 1){
-            dexp *= pof_ten[k];
         }
-        rexp >>= 1;
+        if(rexp > MAX_EXPONENT) goto LB_OFL;
+        dexp += neg_exp ? -rexp : rexp;
     }
-    if(neg_exp) *dbl /= dexp;
-    else *dbl *= dexp;
-    *len = i;
-    return 2;
-LB_OFL_INT:
-    while(i < rlen){
-        ch = buf[i++];
-        if(IS_DIGIT_GEZ(ch)) continue;
-        if(ch == '.') goto LB_OFL_DEC;
-        if((ch == 'e')||(ch == 'E')) goto LB_OFL_EXP;
 #ifdef JSON_LIMIT_CHECK
-        if(i > JSON_MAX_STRING_SIZE) return -1;
+    if(i > JSON_MAX_STRING_SIZE){
+        *len = i;
+        return -1;
+    }
 #endif // JSON_LIMIT_CHECK
+    if(!decimal_to_double(mant, dexp, neg, trunc, dbl)){
+        if(!json_strtod(buf, i, dbl)) goto LB_OFL;
     }
+    /* out of double range */
+    if((*dbl > DBL_MAX)||(*dbl < -DBL_MAX)) goto LB_OFL;
     *len = i;
-    *str = buf;
-    return -2;
-LB_OFL_DEC:
-    if(!IS_DIGIT_GEZ(buf[i])){
-        return -1; /* format error */
-    }
-    i++;
-    while(i < rlen){
-        ch = buf[i++];
-        if(IS_DIGIT_GEZ(ch)) continue;
-        if((ch == 'e')||(ch == 'E')) goto LB_OFL_DEC_EXP;
+    return 2;
+LB_OFL:
 #ifdef JSON_LIMIT_CHECK
-        if(i > JSON_MAX_STRING_SIZE) return -1;
-#endif // JSON_LIMIT_CHECK
+    if(i > JSON_MAX_STRING_SIZE){
+        *len = i;
+        return -1;
     }
+#endif // JSON_LIMIT_CHECK
     *len = i;
     *str = buf;
     return -2;
-LB_OFL_DEC_EXP:
-    ch = buf[i];
-    if((ch == '+')||(ch == '-')) i++;
-    if(!IS_DIGIT_GEZ(buf[i])) return -1;
-    i++;
-LB_OFL_EXP:
-    while(i < rlen){
-        ch = buf[i++];
-        if(!IS_DIGIT_GEZ(ch)) break;
+}
+
+/** Skip a run of digits from buf[i], 8 bytes at a time while there are 8
+*   Return: position after the run
+*/
+static __inline size_t json_skip_digits(const char* buf, size_t i, size_t len)
+{
+    uint64_t x;
+    while(i + 8 <= len){
+        memcpy(&x, buf + i, 8);
+        x = NON_DIGITS(x);
+        if(x){
+#ifdef JSON_LITTLE_ENDIAN
+            /* the first non-digit byte */
+            return i + (json_ctz64(x) >> 3);
+#else
+            break;
+#endif // JSON_LITTLE_ENDIAN
+        }
+        i += 8;
+    }
+    while((i < len)&&(IS_DIGIT_GEZ(buf[i]))) i++;
+    return i;
+}
+
+/** Check the number syntax without converting it - the grammar of json_atonum()
+*   Return: # bytes of the number or -1 if it is not valid
+*/
+static ptrdiff_t json_check_number(const char* buf, size_t len)
+{
+    size_t i = 0, beg;
+    if(buf[i] == '-') i++;
+    if((i >= len)||(!IS_DIGIT_GEZ(buf[i]))) return -1;
+    if(buf[i] == '0'){
+        i++;
+        /* leading 0s are not allowed */
+        if((i < len)&&(IS_DIGIT_GEZ(buf[i]))) return -1;
+    }
+    else i = json_skip_digits(buf, i, len);
+    if((i < len)&&(buf[i] == '.')){
+        beg = ++i;
+        i = json_skip_digits(buf, i, len);
+        /* at least one digit must follow decimal point */
+        if(i == beg) return -1;
+    }
+    if((i < len)&&((buf[i] == 'e')||(buf[i] == 'E'))){
+        i++;
+        if((i < len)&&((buf[i] == '+')||(buf[i] == '-'))) i++;
+        beg = i;
+        i = json_skip_digits(buf, i, len);
+        /* at least one digit must follow exponent symbol */
+        if(i == beg) return -1;
+    }
 #ifdef JSON_LIMIT_CHECK
-        if(i > JSON_MAX_STRING_SIZE) return -1;
+    /* json_atonum() keeps a long number as string */
+    if(i > JSON_MAX_STRING_SIZE) return -1;
 #endif // JSON_LIMIT_CHECK
-    }
-    *len = i;
-    *str = buf;
-    return -2;
+    return (ptrdiff_t)i;
 }
 
 #define IS_SURROGATE_HIGH(a) (((a>=0xd800)&&(a<=0xdbff)) ? 1 : 0)
@@ -346,14 +471,83 @@ static const char hex_val[]= "0123456789abcdef";
 
 json_ctx* json_init(void)
 {
+#ifdef JSON_NO_MEMALLOC
+    return json_init_pool(JSON_SLAB_NODES, JSON_MAX_NODES);
+#else
     json_ctx* new_ctx;
     if(!(new_ctx = calloc(1, sizeof(json_ctx)))){
         fprintf(stderr, "json_init() failed: memory allocation error\n");
         return NULL;
     }
+    new_ctx->max_nodes = JSON_MAX_NODES;
+    new_ctx->max_depth = JSON_DEPTH_LIMIT;
+    return new_ctx;
+#endif // JSON_NO_MEMALLOC
+}
+
+/** Add a slab to the nodes pool - a spare one if json_reset() kept any or a new one.
+*   The first slab has ctx->slab_size nodes, every next one doubles the pool's capacity
+*   Return: 0 on error (ctx->err is set)
+*/
+static int json_grow_pool(json_ctx* ctx)
+{
+    json_slab* slab;
+    if(ctx->spare_slabs){
+        slab = ctx->spare_slabs;
+        ctx->spare_slabs = slab->next;
+    }
+    else{
+        int nnodes = (ctx->pool_size > ctx->slab_size) ? ctx->pool_size : ctx->slab_size;
+        if(nnodes > ctx->max_nodes - ctx->pool_size){
+            nnodes = ctx->max_nodes - ctx->pool_size;
+        }
+        if(nnodes <= 0){
+            JSON_SHOW_ERROR("maximum # nodes reached");
+            ctx->err = ERR_JSON_NODES;
+            return 0;
+        }
+        slab = malloc(sizeof(json_slab) + nnodes * sizeof(json_node));
+        if(!slab){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            return 0;
+        }
+        slab->nnodes = nnodes;
+        ctx->pool_size += nnodes;
+    }
+    slab->next = ctx->slabs;
+    ctx->slabs = slab;
+    ctx->slab_next = 0;
+    return ~0;
+}
+
+json_ctx* json_init_pool(int init_nodes, int max_nodes)
+{
+    json_ctx* new_ctx;
+    if(!(new_ctx = calloc(1, sizeof(json_ctx)))){
+        fprintf(stderr, "json_init_pool() failed: memory allocation error\n");
+        return NULL;
+    }
+    new_ctx->max_nodes = (max_nodes > 0) ? max_nodes : JSON_MAX_NODES;
+    new_ctx->max_depth = JSON_DEPTH_LIMIT;
+    new_ctx->slab_size = (init_nodes > 0) ? init_nodes : JSON_SLAB_NODES;
+    if(new_ctx->slab_size > new_ctx->max_nodes){
+        new_ctx->slab_size = new_ctx->max_nodes;
+    }
+    /* the first slab is the initial footprint */
+    if(!json_grow_pool(new_ctx)){
+        fprintf(stderr, "json_init_pool() failed: memory allocation error\n");
+        free(new_ctx);
+        return NULL;
+    }
     return new_ctx;
 }
 
+json_ctx* json_init_arena(int slab_nodes)
+{
+    return json_init_pool(slab_nodes, JSON_MAX_NODES);
+}
+
 int json_get_nelements(json_node* parent)
 {
     if((!parent)||((parent->type != JSON_ARRAY)&&(parent->type != JSON_OBJECT))){
@@ -368,6 +562,47 @@ int json_get_nelements(json_node* parent)
     return i;
 }
 
+/** Convert JSON_NUMBER_RAW node to JSON_INTEGER or JSON_DOUBLE in place
+*   Return: 0 if the number can't be converted without precision loss
+*/
+static int json_number_convert(json_node* nd)
+{
+    json_value val;
+    int parsed = INT_CLAMP(nd->str_len);
+    switch(json_atonum(nd->val.string_value, &parsed, &val)){
+        case 1:
+            nd->type = JSON_INTEGER;
+            break;
+        case 2:
+            nd->type = JSON_DOUBLE;
+            break;
+        default:
+            return 0;
+    }
+    nd->val = val;
+    nd->str_len = 0;
+    return ~0;
+}
+
+int json_get_integer(json_node* nd, long long* val)
+{
+    if((!nd)||(!val)) return 0;
+    if((nd->type == JSON_NUMBER_RAW)&&(!json_number_convert(nd))) return 0;
+    if(nd->type != JSON_INTEGER) return 0;
+    *val = nd->val.integer_value;
+    return ~0;
+}
+
+int json_get_double(json_node* nd, double* val)
+{
+    if((!nd)||(!val)) return 0;
+    if((nd->type == JSON_NUMBER_RAW)&&(!json_number_convert(nd))) return 0;
+    if(nd->type == JSON_INTEGER) *val = (double)nd->val.integer_value;
+    else if(nd->type == JSON_DOUBLE) *val = nd->val.double_value;
+    else return 0;
+    return ~0;
+}
+
 
 /** Get previous json_node sibling
 *   Return NULL if it is the first child
@@ -389,23 +624,80 @@ static __inline json_node* json_get_prev(json_node* nd)
     return child;
 }
 
-static void json_free_all(json_ctx* ctx, json_node* nd)
+/** Get a zeroed node - from the free list, the nodes pool's untouched tail
+*   or the heap if there is no nodes pool
+*   Return: pointer to the node or NULL on error (ctx->err is set)
+*/
+static __inline json_node* json_new_node(json_ctx* ctx)
 {
-    json_node* n = nd->first_child;
-    json_node* nn;
-    /* delete all children nodes recursively */
-    while(n){
-        nn = n->next;
-        json_free_all(ctx, n);
-        n = nn;
+    json_node* newnode;
+    if(ctx->nused >= ctx->max_nodes){
+        JSON_SHOW_ERROR("maximum # nodes reached");
+        ctx->err = ERR_JSON_NODES;
+        return NULL;
+    }
+#ifndef JSON_NO_MEMALLOC
+    if(!ctx->slab_size){
+        newnode = calloc(1, sizeof(json_node));
+        if(!newnode){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            return NULL;
+        }
+        ctx->nused++;
+        return newnode;
     }
-#ifdef JSON_NO_MEMALLOC
-    /* mark the object as dummy */
-    nd->type = JSON_DUMMY;
-#else
-    free(nd);
 #endif // JSON_NO_MEMALLOC
+    if(ctx->free_nodes){
+        /* reuse the most recently released node */
+        newnode = ctx->free_nodes;
+        ctx->free_nodes = newnode->next;
+    }
+    else{
+        if((!ctx->slabs)||(ctx->slab_next >= ctx->slabs->nnodes)){
+            /* the current slab is exhausted */
+            if(!json_grow_pool(ctx)) return NULL;
+        }
+        newnode = &ctx->slabs->nodes[ctx->slab_next++];
+    }
+    memset(newnode, 0, sizeof(json_node));
+    ctx->nused++;
+    return newnode;
+}
+
+/** Give the node back - a pool node is pushed on the free list */
+static __inline void json_release_node(json_ctx* ctx, json_node* nd)
+{
     ctx->nused--;
+#ifndef JSON_NO_MEMALLOC
+    if(!ctx->slab_size){
+        free(nd);
+        return;
+    }
+#endif // JSON_NO_MEMALLOC
+    /* JSON_DUMMY is a valid json null value, so the node gets its own mark */
+    nd->type = JSON_FREE;
+    nd->next = ctx->free_nodes;
+    ctx->free_nodes = nd;
+}
+
+static void json_free_all(json_ctx* ctx, json_node* nd)
+{
+    json_node* top = nd;
+    json_node* parent;
+    /* no recursion: go down detaching the first child, release the leaves
+       on the way back up - the tree itself keeps the path */
+    while(nd){
+        if(nd->first_child){
+            parent = nd;
+            nd = nd->first_child;
+            parent->first_child = nd->next;
+            continue;
+        }
+        parent = (nd == top) ? NULL : nd->parent;
+        json_release_node(ctx, nd);
+        nd = parent;
+    }
 }
 
 void json_remove_node(json_ctx* ctx, json_node* nd)
@@ -421,54 +713,100 @@ void json_remove_node(json_ctx* ctx, json_node* nd)
         if(nd->parent) nd->parent->first_child = nd->next;
         else ctx->root = NULL;
     }
+    if((nd->parent)&&(nd->parent->last_child == nd)){
+        nd->parent->last_child = prev;
+    }
     json_free_all(ctx, nd);
 }
 
-void json_destroy(json_ctx* ctx)
+/** Release the file json_parse_file() mapped or read */
+static void json_close_file(json_ctx* ctx)
+{
+    if(!ctx->file_buf) return;
+#ifdef JSON_USE_MMAP
+    munmap(ctx->file_buf, ctx->file_size);
+#else
+    free(ctx->file_buf);
+#endif // JSON_USE_MMAP
+    ctx->file_buf = NULL;
+    ctx->file_size = 0;
+}
+
+void json_reset(json_ctx* ctx)
 {
     if(!ctx) return;
-    if(ctx->root){
-        json_free_all(ctx, ctx->root);
+    if(ctx->slab_size){
+        /* move all slabs to the spare list - they will be reused as they are */
+        json_slab* slab = ctx->slabs;
+        while(slab){
+            json_slab* next = slab->next;
+            slab->next = ctx->spare_slabs;
+            ctx->spare_slabs = slab;
+            slab = next;
+        }
+        ctx->slabs = NULL;
+        ctx->slab_next = 0;
     }
+    else{
+        if(ctx->root){
+            json_free_all(ctx, ctx->root);
+        }
 #ifdef JSON_ON_DEBUG
-    if(ctx->nused != 0){
-        fprintf(stderr, "json_destroy() failed: unable to delete %d nodes\n", ctx->nused);
-    }
+        if(ctx->nused != 0){
+            fprintf(stderr, "%s failed: unable to delete %d nodes\n", __func__, ctx->nused);
+        }
 #endif // JSON_ON_DEBUG
-#ifndef JSON_NO_MEMALLOC
+    }
+    ctx->free_nodes = NULL;
+    ctx->root = NULL;
+    ctx->nused = 0;
+    ctx->pos = 0;
+    ctx->ndepth = 0;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = 0;
+    ctx->feed = 0;
+    ctx->view = 0;
+    ctx->partial_len = 0;
+    json_close_file(ctx);
+    /* keep one block of the scratch memory for reuse */
+    if(ctx->scratch){
+        json_scratch* blk = ctx->scratch->next;
+        while(blk){
+            json_scratch* next = blk->next;
+            free(blk);
+            blk = next;
+        }
+        ctx->scratch->next = NULL;
+        ctx->scratch->used = 0;
+    }
+    ctx->decode = 0;
+    ctx->err = ERR_JSON_OK;
+}
+
+void json_destroy(json_ctx* ctx)
+{
+    if(!ctx) return;
+    /* pool nodes are dropped at once - no tree walk */
+    json_reset(ctx);
+    json_slab* slab = ctx->spare_slabs;
+    while(slab){
+        json_slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(ctx->index);
+    free(ctx->partial);
+    free(ctx->scratch);
+    free(ctx->nest);
     free(ctx);
-#endif // JSON_NO_MEMALLOC
 }
 
 json_node* json_add_last(json_ctx* ctx, json_node *parent, json_type tp, const char* key)
 {
-    if(ctx->nused >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("maximum # nodes reached");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    json_node* newnode;
-#ifdef JSON_NO_MEMALLOC
-    /* find not used slot in the factory which has JSON_DUMMY type */
-    int i = 0;
-    for( ; i < JSON_MAX_NODES; i++){
-        if(ctx->pool[i].type == JSON_DUMMY) break;
-    }
-    if(i >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("JSON_MAX_NODES exceeded");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    newnode = &ctx->pool[i];
-    memset(newnode, 0, sizeof(json_node));
-#else
-    newnode = calloc(1, sizeof(json_node));
-    if(!newnode){
-        JSON_SHOW_ERROR("memory allocation error");
-        return NULL;
-    }
-#endif // JSON_NO_MEMALLOC
-    ctx->nused++;
+    json_node* newnode = json_new_node(ctx);
+    if(!newnode) return NULL;
     /* populate the new object and place it in the list */
     newnode->type = tp;
     newnode->key = key;
@@ -478,14 +816,14 @@ json_node* json_add_last(json_ctx* ctx, json_node *parent, json_type tp, const c
         ctx->root = newnode;
     }
     else{
-        json_node* nd = parent->first_child;
-        if(nd){
-            while(nd->next) nd = nd->next;
-            nd->next = newnode;
+        /* the tail pointer saves us walking the whole sibling list */
+        if(parent->last_child){
+            parent->last_child->next = newnode;
         }
         else{
             parent->first_child = newnode;
         }
+        parent->last_child = newnode;
     }
     return newnode;
 }
@@ -504,33 +842,8 @@ json_node* json_add_first(json_ctx* ctx, json_node *parent, json_type tp, const
             return NULL;
        }
     }
-    if(ctx->nused >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("maximum # nodes reached");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    json_node* newnode;
-#ifdef JSON_NO_MEMALLOC
-    /* find not used slot the factory which has JSON_DUMMY type */
-    int i = 0;
-    for( ; i < JSON_MAX_NODES; i++){
-        if(ctx->pool[i].type == JSON_DUMMY) break;
-    }
-    if(i >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("JSON_MAX_NODES exceeded");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    newnode = &ctx->pool[i];
-    memset(newnode, 0, sizeof(json_node));
-#else
-    newnode = calloc(1, sizeof(json_node));
-    if(!newnode){
-        JSON_SHOW_ERROR("memory allocation error");
-        return NULL;
-    }
-#endif // JSON_NO_MEMALLOC
-    ctx->nused++;
+    json_node* newnode = json_new_node(ctx);
+    if(!newnode) return NULL;
     /* populate the new object and place it in the list */
     newnode->type = tp;
     newnode->key = key;
@@ -542,6 +855,7 @@ json_node* json_add_first(json_ctx* ctx, json_node *parent, json_type tp, const
     else{
         newnode->next = parent->first_child;
         parent->first_child = newnode;
+        if(!parent->last_child) parent->last_child = newnode;
     }
     return newnode;
 }
@@ -553,39 +867,17 @@ json_node* json_add_after(json_ctx* ctx, json_node *nd, json_type tp, const char
         ctx->err = ERR_JSON_NULLPTR;
         return NULL;
     }
-    if(ctx->nused >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("maximum # nodes reached");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
+    json_node* newnode = json_new_node(ctx);
+    if(!newnode) return NULL;
+    /* populate the new object and place it in the list */
+    newnode->type = tp;
+    newnode->key = key;
+    newnode->parent = nd->parent;
+    newnode->next = nd->next;
+    nd->next = newnode;
+    if((nd->parent)&&(nd->parent->last_child == nd)){
+        nd->parent->last_child = newnode;
     }
-    json_node* newnode;
-#ifdef JSON_NO_MEMALLOC
-    /* find not used slot the factory which has JSON_DUMMY type */
-    int i = 0;
-    for( ; i < JSON_MAX_NODES; i++){
-        if(ctx->pool[i].type == JSON_DUMMY) break;
-    }
-    if(i >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("JSON_MAX_NODES exceeded");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    newnode = &ctx->pool[i];
-    memset(newnode, 0, sizeof(json_node));
-#else
-    newnode = calloc(1, sizeof(json_node));
-    if(!newnode){
-        JSON_SHOW_ERROR("memory allocation error");
-        return NULL;
-    }
-#endif // JSON_NO_MEMALLOC
-    ctx->nused++;
-    /* populate the new object and place it in the list */
-    newnode->type = tp;
-    newnode->key = key;
-    newnode->parent = nd->parent;
-    newnode->next = nd->next;
-    nd->next = newnode;
     return newnode;
 }
 
@@ -596,33 +888,8 @@ json_node* json_add_before(json_ctx* ctx, json_node *nd, json_type tp, const cha
         ctx->err = ERR_JSON_NULLPTR;
         return NULL;
     }
-    if(ctx->nused >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("maximum # nodes reached");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    json_node* newnode;
-#ifdef JSON_NO_MEMALLOC
-    /* find not used slot the factory which has JSON_DUMMY type */
-    int i = 0;
-    for( ; i < JSON_MAX_NODES; i++){
-        if(ctx->pool[i].type == JSON_DUMMY) break;
-    }
-    if(i >= JSON_MAX_NODES){
-        JSON_SHOW_ERROR("JSON_MAX_NODES exceeded");
-        ctx->err = ERR_JSON_NODES;
-        return NULL;
-    }
-    newnode = &ctx->pool[i];
-    memset(newnode, 0, sizeof(json_node));
-#else
-    newnode = calloc(1, sizeof(json_node));
-    if(!newnode){
-        JSON_SHOW_ERROR("memory allocation error");
-        return NULL;
-    }
-#endif // JSON_NO_MEMALLOC
-    ctx->nused++;
+    json_node* newnode = json_new_node(ctx);
+    if(!newnode) return NULL;
     /* populate the new object and place it in the list */
     newnode->type = tp;
     newnode->key = key;
@@ -648,8 +915,16 @@ json_node* json_get_node(json_node* parent, const char* key)
     }
     json_node* nd = parent->first_child;
     while(nd){
-        if((nd->key)&&(!astrcmp(nd->key, key))){
-            return nd;
+        if(nd->key){
+            if(nd->key_len){
+                /* a view into the parsed buffer - see json_parse_view() */
+                if((!strncmp(nd->key, key, nd->key_len))&&(!key[nd->key_len])) return nd;
+            }
+            else if(!nd->key[0]){
+                /* empty: no word reads, a json_parse_view() one points to the 1 byte json_empty_str */
+                if(!key[0]) return nd;
+            }
+            else if((key[0])&&(!astrcmp(nd->key, key))) return nd;
         }
         nd = nd->next;
     }
@@ -670,729 +945,2868 @@ json_node* json_get_element(json_node* parent, int index)
     return nd;
 }
 
-static char* parse_string(json_ctx* ctx, char* ptr, int len)
+/** Decode 4 hex digits of u-escape
+*   Return: code unit value or -1 if a digit is invalid
+*/
+static __inline int hex4_val(const char* s)
+{
+    int b1, b2, b3, b4;
+    if(((b1 = hex_tb[(unsigned char)s[0]]) < 0)||
+       ((b2 = hex_tb[(unsigned char)s[1]]) < 0)||
+       ((b3 = hex_tb[(unsigned char)s[2]]) < 0)||
+       ((b4 = hex_tb[(unsigned char)s[3]]) < 0)){
+        return -1;
+    }
+    return (b1 << 12)|(b2 << 8)|(b3 << 4)|b4;
+}
+
+/** Allocate memory which lives until json_reset() - for the tokens json_parse_feed()
+*   puts together from the pieces and the strings json_parse_view() decodes
+*/
+static char* json_scratch_alloc(json_ctx* ctx, size_t len)
+{
+    json_scratch* blk = ctx->scratch;
+    if((!blk)||(blk->size - blk->used < len)){
+        size_t size = (len > JSON_SCRATCH_SIZE) ? len : JSON_SCRATCH_SIZE;
+        if(!(blk = malloc(sizeof(json_scratch) + size))){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            return NULL;
+        }
+        blk->size = size;
+        blk->used = 0;
+        blk->next = ctx->scratch;
+        ctx->scratch = blk;
+    }
+    blk->used += len;
+    return blk->data + blk->used - len;
+}
+
+/** Find the closing quote of the string in the buffer
+*   Input: pos - position of an escape in the string
+*   Return: position of the closing quote or -1 if the string goes on
+*/
+static ptrdiff_t json_string_end(const char* ptr, size_t pos, size_t len)
+{
+    ptrdiff_t run;
+    while(pos < len){
+        run = find_strspec(ptr + pos, len - pos);
+        if(run < 0) return -1;
+        pos += run;
+        if(ptr[pos] == '"') return (ptrdiff_t)pos;
+        /* skip an escaped char, a control char will be reported by the parser */
+        pos += (ptr[pos] == '\\') ? 2 : 1;
+    }
+    return -1;
+}
+
+/* the empty string views point to */
+static char json_empty_str[] = "";
+
+/** Decode the escape at ptr[ctx->pos] - the char after the backslash
+*   Output: out - the decoded bytes, 4 at most
+*   Return: # bytes written, -1 on error (ctx->err is set)
+*   Remark: an escape json.org doesn't list is left untouched - only the backslash
+*       is written, the next char is a plain one. So is \u if ctx->decode is 0.
+*       ctx->check (json_validate()) rejects them at the char after the backslash
+*/
+static __inline int json_unescape(json_ctx* ctx, const char* ptr, size_t len, char* out)
+{
+    int cp, cpl;
+    switch(ptr[ctx->pos]){
+        case '\\': /* double // */
+        case '/':
+        case '"':
+            out[0] = ptr[ctx->pos];
+            break;
+        case 'b': /* backspace */
+            out[0] = '\b';
+            break;
+        case 'f': /* form feed */
+            out[0] = '\f';
+            break;
+        case 'n': /* new line */
+            out[0] = '\n';
+            break;
+        case 'r': /* CR */
+            out[0] = '\r';
+            break;
+        case 't': /* tab */
+            out[0] = '\t';
+            break;
+        case 'u':
+            if(!ctx->decode){
+                /* keep the escape, the digits follow as plain characters */
+                out[0] = '\\';
+                return 1;
+            }
+            ctx->pos++;
+            if((ctx->pos + 4 > len)||((cp = hex4_val(ptr + ctx->pos)) < 0)){
+                JSON_SHOW_ERROR("invalid UNICODE escape");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return -1;
+            }
+            ctx->pos += 4;
+            if(IS_SURROGATE_HIGH(cp)){
+                /* must be followed by the low surrogate */
+                if((ctx->pos + 6 > len)||
+                    (ptr[ctx->pos] != '\\')||
+                    (ptr[ctx->pos + 1] != 'u')||
+                    ((cpl = hex4_val(ptr + ctx->pos + 2)) < 0)||
+                    (!IS_SURROGATE_LOW(cpl))){
+                    JSON_SHOW_ERROR("invalid UTF16 low surrogate");
+                    ctx->err = ERR_JSON_UNEXPECTED;
+                    return -1;
+                }
+                ctx->pos += 6;
+                cp = ((cp - 0xd800) << 10) + (cpl - 0xdc00) + 0x0010000UL;
+            }
+            else if(IS_SURROGATE_LOW(cp)){
+                JSON_SHOW_ERROR("invalid UTF16 high surrogate");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return -1;
+            }
+            if(cp < 0x80){
+                out[0] = (char)cp;
+                return 1;
+            }
+            if(cp < 0x800){
+                out[0] = (cp>>6) | 0xC0;
+                out[1] = (cp & 0x3F) | 0x80;
+                return 2;
+            }
+            if(cp < 0x10000){
+                out[0] = (cp>>12) | 0xE0;
+                out[1] = ((cp>>6) & 0x3F) | 0x80;
+                out[2] = (cp & 0x3F) | 0x80;
+                return 3;
+            }
+            out[0] = (cp>>18) | 0xF0;
+            out[1] = ((cp>>12) & 0x3F) | 0x80;
+            out[2] = ((cp>>6) & 0x3F) | 0x80;
+            out[3] = (cp & 0x3F) | 0x80;
+            return 4;
+        default:
+            if(ctx->check){
+                JSON_SHOW_ERROR("invalid escape");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return -1;
+            }
+            /* leave untouched */
+            out[0] = '\\';
+            return 1;
+    }
+    ctx->pos++;
+    return 1;
+}
+
+/** Parse the string value in place: escapes are decoded and the null terminator
+*   replaces the closing quote
+*   Input: slen - NULL or where # bytes of the string go. If not NULL the buffer is
+*       not modified (json_parse_view()): a string without escapes is returned
+*       as a view into the buffer, otherwise it is decoded into the scratch memory
+*   Remark: runs of plain characters are found by find_strspec() many bytes
+*       at a time. Nothing is copied until the first escape, after that
+*       each run is moved at once to close the gap the decoded escapes leave.
+*       If ctx->check is set (json_validate()) the string is checked only: nothing
+*       is written or decoded
+*/
+static char* parse_string(json_ctx* ctx, char* ptr, size_t len, size_t* slen)
 {
     /* here we have ptr[ctx->pos-1] == '"' */
     char* beg = ptr + ctx->pos;
-    char* res = beg;
+    char* out = beg;    /* the string returned */
+    char* res = NULL;   /* where the decoded bytes go, NULL - no escapes so far (or ctx->check) */
+    char dummy[4];      /* ctx->check: the decoded bytes of an escape */
+    ptrdiff_t run;
+    size_t rlen;
+    int n;
     char ch;
     while(ctx->pos < len){
+        rlen = len - ctx->pos;
 #ifdef JSON_LIMIT_CHECK
         if((ptr + ctx->pos - beg) > JSON_MAX_STRING_SIZE){
             JSON_SHOW_ERROR("JSON_MAX_STRING_SIZE exceeded");
             ctx->err = ERR_JSON_STRING;
             return NULL;
         }
+        /* don't scan further than the limit */
+        if(rlen > (size_t)(JSON_MAX_STRING_SIZE + 1 - (ptr + ctx->pos - beg))){
+            rlen = (size_t)(JSON_MAX_STRING_SIZE + 1 - (ptr + ctx->pos - beg));
+        }
 #endif // JSON_LIMIT_CHECK
-        if(ptr[ctx->pos] == '"'){
-            *res = '\0';
-            ctx->pos++;
-            return beg;
+        run = find_strspec(ptr + ctx->pos, rlen);
+        if(run < 0) run = (ptrdiff_t)rlen;
+        if(res){
+            memmove(res, ptr + ctx->pos, run);
+            res += run;
         }
-        else if((ch = ptr[ctx->pos])== '\\'){
-            /* escape - see json.org*/
-            ctx->pos++;
-            switch(ptr[ctx->pos]){
-                case '\\': /* double // */
-                case '/':
-                case '"':
-                    *res++ = ptr[ctx->pos++];
-                    break;
-                case 'b': /* backspace */
-                    *res++ = '\b';
-                    ctx->pos++;
-                    break;
-                case 'f': /* form feed */
-                    *res++ = '\f';
-                    ctx->pos++;
-                    break;
-                case 'n': /* new line */
-                    *res++ = '\n';
-                    ctx->pos++;
-                    break;
-                case 'r': /* CR */
-                    *res++ = '\r';
-                    ctx->pos++;
-                    break;
-                case 't': /* tab */
-                    *res++ = '\t';
-                    ctx->pos++;
-                    break;
-                case 'u':
-                    /* decode UNICODE here? */
-                     if(!ctx->decode){
-                        *res++ = ch;
-                        break;
-                    }
-                    if(ctx->pos + 4 < len) break;
-                    int b1, b2, b3, b4;
-                    if(((b1 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                       ((b2 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                       ((b3 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                       ((b4 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)){
-                            JSON_SHOW_ERROR("invalid UNICODE escape");
-                            return 0;
-                       }
-                    b1 <<= 12;
-                    b2 <<= 8;
-                    b3 <<= 4;
-                    int cp = b1|b2|b3|b4;
-                    if(IS_SURROGATE_LOW(cp)){
-                        /* low surrogate */
-                        if(ctx->pos + 6 < len) break;
-                        if((ptr[ctx->pos-1] != '\\')||
-                            (ptr[ctx->pos++] != 'u')||
-                            ((b1 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                            ((b2 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                            ((b3 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)||
-                            ((b4 = hex_tb[(unsigned char)ptr[ctx->pos++]]) < 0)){
-                            JSON_SHOW_ERROR("invalid UTF16 low surrogate");
-                            return 0;
-                        }
-                        b1 <<= 12;
-                        b2 <<= 8;
-                        b3 <<= 4;
-                        int cph = b1|b2|b3|b4;
-                        if(!IS_SURROGATE_HIGH(cph)){
-                            JSON_SHOW_ERROR("invalid UTF16 high surrogate");
-                            return 0;
-                        }
-                        cp = ((cp - 0xd800) << 10) + (cph - 0xdc00) + 0x0010000UL;
-                    }
-                    if(cp < 0x80){
-                        *res++ = (char)cp;
-                    }
-                    else if(cp < 0x800){
-                        *res++ = (cp>>6) | 0xC0;
-                        *res++ = (cp & 0x3F) | 0x80;
-                    }
-                    else if(cp < 0x10000){
-                        *res++ = (cp>>12) | 0xE0;
-                        *res++ = ((cp>>6) & 0x3F) | 0x80;
-                        *res++ = (cp & 0x3F) | 0x80;
-                    }
-                    else if (cp < 0x110000) {
-                        *res++ = (cp>>18) | 0xF0;
-                        *res++ = ((cp>>12) & 0x3F) | 0x80;
-                        *res++ = ((cp>>6) & 0x3F) | 0x80;
-                        *res++ = (cp & 0x3F) | 0x80;
-                    }
-                    break;
-                default:
-                    /* leave untouched */
-                    *res++ = ch;
-                    break;
-            }
+        ctx->pos += run;
+#ifdef JSON_LIMIT_CHECK
+        if((ptr + ctx->pos - beg) > JSON_MAX_STRING_SIZE){
+            JSON_SHOW_ERROR("JSON_MAX_STRING_SIZE exceeded");
+            ctx->err = ERR_JSON_STRING;
+            return NULL;
         }
-        else{
-            *res = ptr[ctx->pos];
-            res++;
+#endif // JSON_LIMIT_CHECK
+        if(ctx->pos >= len) break;
+        if((ch = ptr[ctx->pos]) == '"'){
+            if(slen){
+                /* a view: res is in the scratch memory */
+                *slen = res ? (size_t)(res - out) : (size_t)(ptr + ctx->pos - beg);
+                if(res) *res = '\0';
+                else if(!*slen) out = json_empty_str;
+            }
+            else if(res) *res = '\0';
+            else if(!ctx->check) ptr[ctx->pos] = '\0';
             ctx->pos++;
+            return out;
         }
+        if(ch != '\\'){
+            JSON_SHOW_ERROR("unescaped control character in string");
+            ctx->err = ERR_JSON_UNEXPECTED;
+            return NULL;
+        }
+        /* escape - see json.org*/
+        if((!res)&&(!ctx->check)){
+            /* the buffer is about to be modified, json_parse_feed() can't
+               keep a string it doesn't end in */
+            if((ctx->feed)&&(json_string_end(ptr, ctx->pos, len) < 0)){
+                ctx->err = ERR_JSON_INCOMPLETE;
+                return NULL;
+            }
+            if(slen){
+                /* the decoded string is never longer than the escaped one */
+                ptrdiff_t end = json_string_end(ptr, ctx->pos, len);
+                run = ptr + ctx->pos - beg;
+                if(!(out = json_scratch_alloc(ctx, ((end < 0) ? len : (size_t)end) - (size_t)(beg - ptr) + 1))) return NULL;
+                memcpy(out, beg, run);
+                res = out + run;
+            }
+            else res = ptr + ctx->pos;
+        }
+        ctx->pos++;
+        if(ctx->pos >= len) break;
+        if((n = json_unescape(ctx, ptr, len, res ? res : dummy)) < 0) return NULL;
+        if(res) res += n;
+    }
+    if(!ctx->feed){
+        JSON_SHOW_ERROR("unterminated string");
     }
-    JSON_SHOW_ERROR("unterminated string");
-    ctx->err = ERR_JSON_STRING;
+    ctx->err = ERR_JSON_INCOMPLETE;
     return NULL;
 }
 
 
-static int get_key(json_ctx* ctx, char* ptr, int len, const char** key)
+/* json_parse() states - what the parser expects next */
+enum{
+    JSON_ST_VALUE,          /* a value */
+    JSON_ST_VALUE_OR_END,   /* a value or ']' - right after '[' */
+    JSON_ST_KEY,            /* a key */
+    JSON_ST_KEY_OR_END,     /* a key or '}' - right after '{' */
+    JSON_ST_COLON,          /* ':' after a key */
+    JSON_ST_NEXT,           /* ',' or the end of the current container */
+    JSON_ST_DONE            /* the root value is complete */
+};
+
+/** Does the byte end a scalar value (number, true, false, null) */
+static __inline int json_is_delim(char ch)
 {
-    char* str;
-    while(ctx->pos < len){
-        switch(json_ch_map[(unsigned char)ptr[ctx->pos]]){
-            case '"':
-                ctx->pos++;
-                str = parse_string(ctx, ptr, len);
-                if(!str) return 0;
-                while((ctx->pos < len)&&(json_ch_map[(unsigned char)ptr[ctx->pos]] == 1)){
-                    /* skip tab, cr, lf, whitespace */
-                    ctx->pos++;
-                }
-                if(ptr[ctx->pos] == ':'){
-                    ctx->pos++;
-                    *key = str;
-                    return ~0;
-                }
-                JSON_SHOW_ERROR("expected ':' key-value separator");
-                ctx->err = ERR_JSON_UNEXPECTED;
-                return 0;
-            case 1: /* skip */
-                ctx->pos++;
-                break;
-            case '}':
-                /* don't increment ctx->pos here - we need '}' on return */
-                return ~0;
-            default:
-                JSON_SHOW_ERROR("unexpected char");
-                ctx->err = ERR_JSON_UNEXPECTED;
-                return 0;
+    switch(ch){
+        case ' ': case '\t': case '\n': case '\r':
+        case ',': case ':': case ']': case '}': case '[': case '{': case '"':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/** Keep the beginning of a token split by the end of the buffer (json_parse_feed())
+*   Return: 0 on error
+*/
+static int json_save_partial(json_ctx* ctx, const char* tok, size_t len)
+{
+#ifdef JSON_LIMIT_CHECK
+    if(ctx->partial_len + len > JSON_MAX_STRING_SIZE + 16){
+        JSON_SHOW_ERROR("JSON_MAX_STRING_SIZE exceeded");
+        ctx->err = ERR_JSON_STRING;
+        return 0;
+    }
+#endif // JSON_LIMIT_CHECK
+    if(ctx->partial_len + len > ctx->partial_size){
+        size_t size = 2 * (ctx->partial_len + len);
+        char* partial = realloc(ctx->partial, size);
+        if(!partial){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            return 0;
         }
+        ctx->partial = partial;
+        ctx->partial_size = size;
     }
-    JSON_SHOW_ERROR("end of buffer reached");
-    ctx->err = ERR_JSON_UNEXPECTED;
-    return 0;
+    memcpy(ctx->partial + ctx->partial_len, tok, len);
+    ctx->partial_len += len;
+    ctx->err = ERR_JSON_INCOMPLETE;
+    return ~0;
+}
+
+/* call the json_sax callback if it is set, stop parsing if it returns 0 */
+#define SAX_EVENT(cb, ...) \
+do{ \
+    if((sax->cb)&&(!sax->cb(__VA_ARGS__))) goto LB_CANCEL; \
+} while(0)
+
+/** Enter a container when no tree is built: the nesting bit stack grows on demand
+*   Input: ctx->ndepth - the level entered
+*   Return: 0 on error
+*/
+static int json_nest_push(json_ctx* ctx, int is_object)
+{
+    int n = ctx->ndepth - 1;
+    if((n >> 6) >= ctx->nest_size){
+        int size = ctx->nest_size ? 2 * ctx->nest_size : 4;
+        uint64_t* nest = realloc(ctx->nest, size * sizeof(uint64_t));
+        if(!nest){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            return 0;
+        }
+        ctx->nest = nest;
+        ctx->nest_size = size;
+    }
+    if(is_object) ctx->nest[n >> 6] |= 1ULL << (n & 63);
+    else ctx->nest[n >> 6] &= ~(1ULL << (n & 63));
+    return ~0;
 }
 
+/* is the container of nesting level n an object */
+#define NEST_IS_OBJECT(ctx, n) (((ctx)->nest[(n) >> 6] >> ((n) & 63)) & 1)
 
-static int get_value(json_ctx* ctx, json_node* parent, char* ptr, int len, const char* key)
+/** The parser loop
+*   Remark: no recursion - the nesting is kept by the tree itself: ctx->cur is
+*       the container being parsed, json_node.parent is the stack of the outer
+*       ones. So the depth costs no C stack and ctx->max_depth is just a limit
+*       against malicious inputs. The parser state lives in ctx
+*       (cur, key, state, ndepth, pos) between calls.
+*       If ctx->feed is set a token the buffer ends in is kept in ctx->partial
+*       and ERR_JSON_INCOMPLETE is returned, the next buffer continues it.
+*       If ctx->sax is set no tree is built (json_parse_sax(), json_validate()): the
+*       values go to the callbacks and the nesting is kept by a bit per level in ctx->nest.
+*       If ctx->check is set too the buffer is only read (json_validate()).
+*/
+static int json_parse_run(json_ctx* ctx, char* ptr, size_t len)
 {
+    json_node* parent = ctx->cur;
     json_node* nd;
+    json_value val;
+    json_type tp;
+    const char* str;
+    const json_sax* sax = ctx->sax;
+    void* user = ctx->sax_user;
+    int state = ctx->state;
+    int parsed, rc, obj;
+    size_t tok = 0, slen = 0;
+    /* a null terminator of a number kept as string may overwrite the next char */
+    size_t held_pos = SIZE_MAX;
+    char held_ch = 0;
+    char ch;
+    /* is the current container an object */
+    if(sax) obj = (ctx->ndepth > 0)&&(NEST_IS_OBJECT(ctx, ctx->ndepth - 1));
+    else obj = (parent)&&(parent->type == JSON_OBJECT);
     while(ctx->pos < len){
-      switch(json_ch_map[(unsigned char)ptr[ctx->pos]]){
-            case 0:
+        ch = (ctx->pos == held_pos) ? held_ch : ptr[ctx->pos];
+        if(json_ch_map[(unsigned char)ch] == 1){
+            /* skip tab, cr, lf, whitespace */
+            ctx->pos++;
+            continue;
+        }
+        switch(state){
+            case JSON_ST_NEXT:
+                if(ch == ','){
+                    ctx->pos++;
+                    state = obj ? JSON_ST_KEY : JSON_ST_VALUE;
+                    continue;
+                }
+                if(ch == (obj ? '}' : ']')) break;
                 JSON_SHOW_ERROR("unexpected char");
                 ctx->err = ERR_JSON_UNEXPECTED;
-                return 0;
-            case 1:  /* skip */
-                ctx->pos++;
-                break;
-            case 2:  /* a sign or number? */
-                {
-                    nd = json_add_last(ctx, parent, JSON_DUMMY, key);
-                    if(!nd) return 0;
-                    int parsed = len - ctx->pos;
-                    switch(json_atonum(ptr + ctx->pos, &parsed, &nd->val)){
-                        case 1: /* integer */
-                            nd->type = JSON_INTEGER;
-                            break;
-                        case 2: /* double */
-                            nd->type = JSON_DOUBLE;
-                            break;
-                        case -1:
-                            JSON_SHOW_ERROR("invalid number");
-                            ctx->err = ERR_JSON_NUMBER;
-                            return 0;
-                        case -2: /* overflow - keep it as string value */
-                            /* add NULL terminator */
-                            ptr[ctx->pos + parsed] = '\0';
-                            nd->type = JSON_STRING;
-                            nd->val.string_value = ptr + ctx->pos;
-                            parsed++;
-                            break;
-                        default:
-                            /* should never be here */
-                            return 0;
-                    }
-                    ctx->pos += parsed;
-                    return ~0;
+                goto LB_FAIL;
+            case JSON_ST_KEY_OR_END:
+                if(ch == '}') break;
+                /* fall through */
+            case JSON_ST_KEY:
+                if(ch != '"'){
+                    JSON_SHOW_ERROR("unexpected char");
+                    ctx->err = ERR_JSON_UNEXPECTED;
+                    goto LB_FAIL;
                 }
-            case '{':
-#ifdef JSON_LIMIT_CHECK
-                ctx->ndepth++;
-                if(ctx->ndepth > JSON_MAX_DEPTH){
-                    JSON_SHOW_ERROR("maximum indentation level exceeded");
-                    return 0;
+                tok = ctx->pos++;
+                ctx->key = parse_string(ctx, ptr, len, ctx->view ? &ctx->key_len : NULL);
+                if(!ctx->key) goto LB_TOKEN_FAIL;
+                if(ctx->key_len > UINT32_MAX){
+                    /* json_node.key_len is 32 bit */
+                    JSON_SHOW_ERROR("key is too long");
+                    ctx->err = ERR_JSON_STRING;
+                    goto LB_FAIL;
                 }
-#endif // JSON_LIMIT_CHECK
-                nd = json_add_last(ctx, parent, JSON_OBJECT, key);
-                if(!nd) return 0;
-                ctx->pos++;
-                while(ctx->pos < len){
-                    const char* new_key = NULL;
-                    if(!get_key(ctx, ptr, len, &new_key)) return 0;
-                    if(ptr[ctx->pos] == '}'){
-                        ctx->pos++;
-                        return ~0;
-                    }
-                    if(!get_value(ctx, nd, ptr, len, new_key)) return 0;
-                    while((ctx->pos < len)&&(json_ch_map[(unsigned char)ptr[ctx->pos]] == 1)){
-                    /* skip tab, cr, lf, whitespace */
-                        ctx->pos++;
-                    }
-                    if(ptr[ctx->pos] == ','){
-                        ctx->pos++;
-                        continue;
-                    }
-                    else if(ptr[ctx->pos] == '}'){
-#ifdef JSON_LIMIT_CHECK
-                        ctx->ndepth--;
-#endif // JSON_LIMIT_CHECK
-                        ctx->pos++;
-                        return ~0;
-                    }
-                    else{
-                        JSON_SHOW_ERROR("unexpected char");
-                        ctx->err = ERR_JSON_UNEXPECTED;
-                        return 0;
-                    }
+                state = JSON_ST_COLON;
+                if(sax) SAX_EVENT(key, user, ctx->key);
+                continue;
+            case JSON_ST_COLON:
+                if(ch != ':'){
+                    JSON_SHOW_ERROR("expected ':' key-value separator");
+                    ctx->err = ERR_JSON_UNEXPECTED;
+                    goto LB_FAIL;
                 }
-                break;
-            case '[':
-                nd = json_add_last(ctx, parent, JSON_ARRAY, key);
-                if(!nd) return 0;
                 ctx->pos++;
-                while(ctx->pos < len){
-                    if(!get_value(ctx, nd, ptr, len, 0)) return 0;
-                    while((ctx->pos < len)&&(json_ch_map[(unsigned char)ptr[ctx->pos]] == 1)){
-                    /* skip tab, cr, lf, whitespace */
-                        ctx->pos++;
-                    }
-                    if(ptr[ctx->pos] == ','){
+                state = JSON_ST_VALUE;
+                continue;
+            case JSON_ST_VALUE_OR_END:
+                if(ch == ']') break;
+                /* fall through */
+            case JSON_ST_VALUE:
+                tok = ctx->pos;
+                switch(json_ch_map[(unsigned char)ch]){
+                    case 2:  /* a sign or number? */
+                        /* a number is never that long, json_atonum() takes int length */
+                        parsed = INT_CLAMP(len - ctx->pos);
+                        rc = 0;
+                        if((ctx->raw_numbers)&&(!sax)){
+                            /* check it only, json_atonum() finds where an invalid one stops */
+                            ptrdiff_t n = json_check_number(ptr + ctx->pos, len - ctx->pos);
+                            if(n >= 0){
+                                parsed = INT_CLAMP(n);
+                                rc = 3;
+                            }
+                        }
+                        if(!rc) rc = json_atonum(ptr + ctx->pos, &parsed, &val);
+                        if((ctx->feed)&&(ctx->pos + parsed >= len)){
+                            /* a number must end in this buffer, otherwise the next one may continue it */
+                            ctx->err = ERR_JSON_INCOMPLETE;
+                            goto LB_TOKEN_FAIL;
+                        }
+                        switch(rc){
+                            case 1: /* integer */
+                                tp = JSON_INTEGER;
+                                break;
+                            case 2: /* double */
+                                tp = JSON_DOUBLE;
+                                break;
+                            case 3: /* a view of the digits, converted on demand */
+                                tp = JSON_NUMBER_RAW;
+                                val.string_value = ptr + ctx->pos;
+                                break;
+                            case -2: /* overflow - keep it as string value */
+                                tp = JSON_STRING;
+                                /* a view of the digits needs no terminator */
+                                if(ctx->view) break;
+                                if(ctx->pos + parsed >= len){
+                                    JSON_SHOW_ERROR("no room for null terminator");
+                                    ctx->err = ERR_JSON_INCOMPLETE;
+                                    goto LB_FAIL;
+                                }
+                                /* json_validate() only reads the buffer */
+                                if(ctx->check) break;
+                                /* add NULL terminator, the char it replaces is kept */
+                                held_pos = ctx->pos + parsed;
+                                held_ch = ptr[held_pos];
+                                ptr[held_pos] = '\0';
+                                break;
+                            default:
+                                JSON_SHOW_ERROR("invalid number");
+                                ctx->err = ERR_JSON_NUMBER;
+                                goto LB_FAIL;
+                        }
+                        if(sax){
+                            ctx->pos += parsed;
+                            if(tp == JSON_INTEGER) SAX_EVENT(integer, user, val.integer_value);
+                            else if(tp == JSON_DOUBLE) SAX_EVENT(dbl, user, val.double_value);
+                            else SAX_EVENT(string, user, val.string_value);
+                            break;
+                        }
+                        nd = json_add_last(ctx, parent, tp, ctx->key);
+                        if(!nd) goto LB_FAIL;
+                        nd->val = val;
+                        nd->key_len = (uint32_t)ctx->key_len;
+                        /* the digits are not null terminated */
+                        if((tp == JSON_NUMBER_RAW)||((tp == JSON_STRING)&&(ctx->view))) nd->str_len = parsed;
+                        ctx->pos += parsed;
+                        break;
+                    case '{':
+                    case '[':
+                        ctx->ndepth++;
+                        if((ctx->max_depth > 0)&&(ctx->ndepth > ctx->max_depth)){
+                            JSON_SHOW_ERROR("maximum indentation level exceeded");
+                            ctx->err = ERR_JSON_DEPTH;
+                            goto LB_FAIL;
+                        }
+                        if(sax){
+                            if(!json_nest_push(ctx, ch == '{')) goto LB_FAIL;
+                        }
+                        else{
+                            nd = json_add_last(ctx, parent, (ch == '{') ? JSON_OBJECT : JSON_ARRAY, ctx->key);
+                            if(!nd) goto LB_FAIL;
+                            nd->key_len = (uint32_t)ctx->key_len;
+                            parent = nd;
+                        }
                         ctx->pos++;
+                        ctx->key = NULL;
+                        ctx->key_len = 0;
+                        obj = (ch == '{');
+                        state = obj ? JSON_ST_KEY_OR_END : JSON_ST_VALUE_OR_END;
+                        if(sax){
+                            if(obj) SAX_EVENT(start_object, user);
+                            else SAX_EVENT(start_array, user);
+                        }
                         continue;
-                    }
-                    if(ptr[ctx->pos] == ']'){
+                    case '"':
                         ctx->pos++;
-                        return ~0;
-                    }
-                    else{
+                        str = parse_string(ctx, ptr, len, ctx->view ? &slen : NULL);
+                        if(!str) goto LB_TOKEN_FAIL;
+                        if(sax){
+                            SAX_EVENT(string, user, str);
+                            break;
+                        }
+                        nd = json_add_last(ctx, parent, JSON_STRING, ctx->key);
+                        if(!nd) goto LB_FAIL;
+                        nd->val.string_value = (char*)str;
+                        nd->str_len = slen;
+                        nd->key_len = (uint32_t)ctx->key_len;
+                        break;
+                    case 't':
+                    case 'f':
+                    case 'n':
+                        parsed = (ch == 'f') ? 5 : 4;
+                        if(ctx->pos + parsed > len){
+                            if(!ctx->feed){
+                                JSON_SHOW_ERROR("incomplete json string");
+                            }
+                            ctx->err = ERR_JSON_INCOMPLETE;
+                            goto LB_TOKEN_FAIL;
+                        }
+                        if(!memcmpeq_32(ptr + ctx->pos, (ch == 't') ? "true" : (ch == 'f') ? "false" : "null", parsed)){
+                            JSON_SHOW_ERROR("unexpected char");
+                            ctx->err = ERR_JSON_UNEXPECTED;
+                            goto LB_FAIL;
+                        }
+                        if(sax){
+                            ctx->pos += parsed;
+                            if(ch == 'n') SAX_EVENT(null, user);
+                            else SAX_EVENT(boolean, user, (ch == 't') ? ~0 : 0);
+                            break;
+                        }
+                        nd = json_add_last(ctx, parent, (ch == 'n') ? JSON_DUMMY : JSON_BOOL, ctx->key);
+                        if(!nd) goto LB_FAIL;
+                        nd->key_len = (uint32_t)ctx->key_len;
+                        if(ch == 't') nd->val.bool_value = ~0;
+                        ctx->pos += parsed;
+                        break;
+                    default:
                         JSON_SHOW_ERROR("unexpected char");
                         ctx->err = ERR_JSON_UNEXPECTED;
-                        return 0;
-                    }
+                        goto LB_FAIL;
                 }
-                break;
-            case ']':
-                /* don't increment ctx->pos here - we need ']' on return */
-                return ~0;
-            case '"':
-                ctx->pos++;
-                nd = json_add_last(ctx, parent, JSON_STRING, key);
-                if(!nd) return 0;
-                nd->val.string_value = parse_string(ctx, ptr, len);
-                if(!nd->val.string_value) return 0;
-                return ~0;
-            case 't':
-                    if(memcmpeq_32(ptr + ctx->pos, "true", 4)){
-                        nd = json_add_last(ctx, parent, JSON_BOOL, key);
-                        if(!nd) return 0;
-                        nd->val.bool_value = ~0;
-                        ctx->pos += 4;
-                        return ~0;
-                    }
-                    JSON_SHOW_ERROR("unexpected char");
-                    ctx->err = ERR_JSON_UNEXPECTED;
-                    return 0;
-            case 'f':
-                    if(memcmpeq_32(ptr + ctx->pos, "false", 5)){
-                        nd = json_add_last(ctx, parent, JSON_BOOL, key);
-                        if(!nd) return 0;
-                        nd->val.bool_value = 0;
-                        ctx->pos += 5;
-                        return ~0;
-                    }
-                    JSON_SHOW_ERROR("unexpected char");
-                    ctx->err = ERR_JSON_UNEXPECTED;
-                    return 0;
-            case 'n':
-                    if(memcmpeq_32(ptr + ctx->pos, "null", 4)){
-                        if(!json_add_last(ctx, parent, JSON_DUMMY, key)){
-                            return 0;
-                        }
-                        ctx->pos += 4;
-                        return ~0;
-                    }
+                /* a scalar value is done */
+                ctx->key = NULL;
+                ctx->key_len = 0;
+                if((sax) ? (!ctx->ndepth) : (!parent)){
+                    state = JSON_ST_DONE;
+                    goto LB_DONE;
+                }
+                state = JSON_ST_NEXT;
+                continue;
+            default:
+                /* should never be here */
+                goto LB_FAIL;
+        }
+        /* the current container is closed */
+        ctx->pos++;
+        ctx->ndepth--;
+        if(sax){
+            if(obj) SAX_EVENT(end_object, user);
+            else SAX_EVENT(end_array, user);
+            if(!ctx->ndepth){
+                state = JSON_ST_DONE;
+                goto LB_DONE;
+            }
+            obj = NEST_IS_OBJECT(ctx, ctx->ndepth - 1);
+        }
+        else{
+            parent = parent->parent;
+            if(!parent){
+                state = JSON_ST_DONE;
+                goto LB_DONE;
+            }
+            obj = (parent->type == JSON_OBJECT);
+        }
+        state = JSON_ST_NEXT;
+    }
+    if(!ctx->feed){
+        JSON_SHOW_ERROR("incomplete json string");
+    }
+    ctx->err = ERR_JSON_INCOMPLETE;
+    goto LB_FAIL;
+LB_CANCEL:
+    /* a callback stopped the parser */
+    ctx->err = ERR_JSON_CANCELED;
+    goto LB_FAIL;
+LB_TOKEN_FAIL:
+    /* the token is cut by the end of the buffer - keep it for the next one */
+    if((ctx->feed)&&(ctx->err == ERR_JSON_INCOMPLETE)){
+        if(json_save_partial(ctx, ptr + tok, len - tok)) ctx->pos = len;
+    }
+LB_FAIL:
+    ctx->cur = parent;
+    ctx->state = state;
+    return 0;
+LB_DONE:
+    ctx->cur = NULL;
+    ctx->state = state;
+    return ~0;
+}
+
+json_node* json_parse(json_ctx* parser, char* buf, size_t buflen, int to_utf8)
+{
+    if(!parser){
+        fprintf(stderr, "json_parse() failed: null pointer received\n");
+        return NULL;
+    }
+    parser->decode = to_utf8;
+    parser->cur = NULL;
+    parser->key = NULL;
+    parser->key_len = 0;
+    parser->state = JSON_ST_VALUE;
+    parser->ndepth = 0;
+    parser->feed = 0;
+    parser->view = 0;
+    parser->partial_len = 0;
+    if(json_parse_run(parser, buf, buflen)){
+        return parser->root;
+    }
+    return NULL;
+}
+
+json_node* json_parse_view(json_ctx* ctx, const char* buf, size_t buflen, int to_utf8)
+{
+    if(!ctx){
+        fprintf(stderr, "json_parse_view() failed: null pointer received\n");
+        return NULL;
+    }
+    ctx->decode = to_utf8;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = 0;
+    ctx->feed = 0;
+    ctx->view = 1;
+    ctx->partial_len = 0;
+    /* nothing is written to the buffer in this mode */
+    if(json_parse_run(ctx, (char*)buf, buflen)){
+        return ctx->root;
+    }
+    return NULL;
+}
+
+json_node* json_parse_file(json_ctx* ctx, const char* fname, int to_utf8)
+{
+    json_node* root;
+    if((!ctx)||(!fname)){
+        fprintf(stderr, "json_parse_file() failed: null pointer received\n");
+        if(ctx) ctx->err = ERR_JSON_NULLPTR;
+        return NULL;
+    }
+    json_reset(ctx);
+#ifdef JSON_USE_MMAP
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0){
+        JSON_SHOW_ERROR("file open error");
+        ctx->err = ERR_JSON_FILE;
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0){
+        JSON_SHOW_ERROR("file read error");
+        ctx->err = ERR_JSON_FILE;
+        close(fd);
+        return NULL;
+    }
+    if((uint64_t)st.st_size > SIZE_MAX){
+        JSON_SHOW_ERROR("file is too large");
+        ctx->err = ERR_JSON_FILE;
+        close(fd);
+        return NULL;
+    }
+    if(st.st_size){
+        /* read-only and private - the parser takes views, the pages are never written */
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED){
+            JSON_SHOW_ERROR("file mapping error");
+            ctx->err = ERR_JSON_FILE;
+            close(fd);
+            return NULL;
+        }
+        ctx->file_buf = map;
+        ctx->file_size = st.st_size;
+        /* one pass from the start to the end: aggressive read ahead, large pages if possible */
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_WILLNEED
+        madvise(map, st.st_size, MADV_WILLNEED);
+#endif // MADV_WILLNEED
+#ifdef MADV_HUGEPAGE
+        madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+    }
+    close(fd);
+#else
+    long long length;
+    FILE* fl = fopen(fname, "rb");
+    if(!fl){
+        JSON_SHOW_ERROR("file open error");
+        ctx->err = ERR_JSON_FILE;
+        return NULL;
+    }
+    json_fseek(fl, 0, SEEK_END);
+    length = json_ftell(fl);
+    json_fseek(fl, 0, SEEK_SET);
+    if((length < 0)||((unsigned long long)length > SIZE_MAX)){
+        JSON_SHOW_ERROR("file read error");
+        ctx->err = ERR_JSON_FILE;
+        fclose(fl);
+        return NULL;
+    }
+    if(length){
+        if(!(ctx->file_buf = malloc((size_t)length))){
+            JSON_SHOW_ERROR("memory allocation error");
+            ctx->err = ERR_JSON_MEMALLOC;
+            fclose(fl);
+            return NULL;
+        }
+        ctx->file_size = length;
+        if(fread(ctx->file_buf, 1, (size_t)length, fl) != (size_t)length){
+            JSON_SHOW_ERROR("file read error");
+            ctx->err = ERR_JSON_FILE;
+            fclose(fl);
+            json_close_file(ctx);
+            return NULL;
+        }
+    }
+    fclose(fl);
+#endif // JSON_USE_MMAP
+    root = json_parse_view(ctx, ctx->file_buf ? ctx->file_buf : "", ctx->file_size, to_utf8);
+#ifdef JSON_USE_MMAP
+    /* the tree is read in any order from now on */
+    if(ctx->file_buf) madvise(ctx->file_buf, ctx->file_size, MADV_NORMAL);
+#endif // JSON_USE_MMAP
+    return root;
+}
+
+/** Find where the token kept in ctx->partial ends in the new buffer
+*   Return: # bytes of the buffer which belong to the token or -1 if it goes on
+*/
+static ptrdiff_t json_partial_end(json_ctx* ctx, const char* buf, size_t buflen)
+{
+    size_t i;
+    int esc = 0;
+    if(ctx->partial[0] != '"'){
+        for(i = 0; i < buflen; i++){
+            if(json_is_delim(buf[i])) return (ptrdiff_t)i;
+        }
+        return -1;
+    }
+    /* a string: is the last char kept an escape */
+    for(i = 1; i < ctx->partial_len; i++){
+        esc = esc ? 0 : (ctx->partial[i] == '\\');
+    }
+    for(i = 0; i < buflen; i++){
+        if(esc) esc = 0;
+        else if(buf[i] == '\\') esc = 1;
+        else if(buf[i] == '"') return (ptrdiff_t)i + 1;
+    }
+    return -1;
+}
+
+json_node* json_parse_feed(json_ctx* ctx, char* buf, size_t buflen, int to_utf8)
+{
+    ptrdiff_t end;
+    int rc;
+    if(!ctx){
+        fprintf(stderr, "json_parse_feed() failed: null pointer received\n");
+        return NULL;
+    }
+    if(ctx->state == JSON_ST_DONE) return ctx->root;
+    if((!buf)&&(buflen)){
+        JSON_SHOW_ERROR("null pointer received");
+        ctx->err = ERR_JSON_NULLPTR;
+        return NULL;
+    }
+    ctx->decode = to_utf8;
+    ctx->feed = 1;
+    ctx->view = 0;
+    ctx->pos = 0;
+    ctx->err = ERR_JSON_OK;
+    if(ctx->partial_len){
+        end = json_partial_end(ctx, buf, buflen);
+        if(end < 0){
+            if(buflen){
+                /* the token goes on - keep this buffer too */
+                json_save_partial(ctx, buf, buflen);
+                ctx->pos = buflen;
+                return NULL;
+            }
+            /* end of input */
+            end = 0;
+        }
+        /* put the token together where it may stay as long as the tree does,
+           the trailing space lets a number end before the end of the buffer */
+        size_t kept = ctx->partial_len;
+        size_t toklen = kept + end;
+        char* tok = json_scratch_alloc(ctx, toklen + 1);
+        if(!tok) return NULL;
+        memcpy(tok, ctx->partial, kept);
+        if(end) memcpy(tok + kept, buf, end);
+        tok[toklen] = ' ';
+        ctx->partial_len = 0;
+        ctx->pos = 0;
+        /* end of input: the token is the last one and ends the document as in json_parse()
+           (a cut literal is incomplete, a number needs no trailing space) */
+        if(!buflen) ctx->feed = 0;
+        rc = json_parse_run(ctx, tok, buflen ? toklen + 1 : toklen);
+        ctx->feed = 1;
+        if(rc){
+            ctx->pos = end;
+            return ctx->root;
+        }
+        if((ctx->err != ERR_JSON_INCOMPLETE)||(ctx->partial_len)){
+            if(ctx->err == ERR_JSON_INCOMPLETE){
+                ctx->partial_len = 0;
+                if(buflen){
+                    /* the token ends at a delimiter and is still cut (e.g. "nu}") - it is wrong,
+                       not waiting for more input */
                     JSON_SHOW_ERROR("unexpected char");
                     ctx->err = ERR_JSON_UNEXPECTED;
-                    return 0;
+                    ctx->pos = end;
+                    return NULL;
+                }
+                JSON_SHOW_ERROR("unexpected end of input");
+            }
+            /* the position in this buffer, the bytes kept from the previous ones are not in it */
+            ctx->pos = (ctx->pos > kept) ? ctx->pos - kept : 0;
+            return NULL;
+        }
+        ctx->pos = end;
+        ctx->err = ERR_JSON_OK;
+    }
+    if(!buflen){
+        /* end of input and the document is not complete */
+        JSON_SHOW_ERROR("unexpected end of input");
+        ctx->err = ERR_JSON_INCOMPLETE;
+        return NULL;
+    }
+    if(json_parse_run(ctx, buf, buflen)){
+        return ctx->root;
+    }
+    return NULL;
+}
+
+
+int json_parse_sax(json_ctx* ctx, char* ptr, size_t len, int to_utf8, const json_sax* sax, void* user)
+{
+    int rc;
+    if(!ctx){
+        fprintf(stderr, "json_parse_sax() failed: null pointer received\n");
+        return 0;
+    }
+    if((!ptr)||(!sax)){
+        JSON_SHOW_ERROR("null pointer received");
+        ctx->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    ctx->decode = to_utf8;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = 0;
+    ctx->feed = 0;
+    ctx->view = 0;
+    ctx->err = ERR_JSON_OK;
+    /* the parser of json_parse() without the tree */
+    ctx->sax = sax;
+    ctx->sax_user = user;
+    rc = json_parse_run(ctx, ptr, len);
+    ctx->sax = NULL;
+    ctx->sax_user = NULL;
+    return rc;
+}
+
+/*  Structural index (stage 1 of json_parse_indexed())
+*   See: G. Langdale, D. Lemire "Parsing Gigabytes of JSON per Second"
+*   The buffer is classified 64 bytes at a time into bit masks (bit i - byte i
+*   of the block), the masks are combined with bitwise operations only,
+*   the state of the previous block is carried over as a few bits
+*/
+
+#if !defined(USE_INTRINSICS_AVX) && !defined(USE_INTRINSICS_SSE)
+/*  1 - whitespace, 2 - structural character, 4 - '"', 8 - '\\' */
+static const unsigned char json_cls_map[256] = {
+    0,0,0,0,0,0,0,0,0,1,1,0,0,1,0,0,    // 0-15     TAB, CR, LF
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 16-31
+    1,0,4,0,0,0,0,0,0,0,0,0,2,0,0,0,    // 32-47    Space '"' ','
+    0,0,0,0,0,0,0,0,0,0,2,0,0,0,0,0,    // 48-63    ':'
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 64-79
+    0,0,0,0,0,0,0,0,0,0,0,2,8,2,0,0,    // 80-95    '[' '\\' ']'
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 96-111
+    0,0,0,0,0,0,0,0,0,0,0,2,0,2,0,0     // 112-127  '{' '}'
+};
+#endif // USE_INTRINSICS_AVX
+
+#define EVEN_BITS 0x5555555555555555ULL
+
+/** block's bit masks */
+typedef struct json_block{
+    uint64_t    ws;         /* whitespace */
+    uint64_t    op;         /* structural characters: {}[],: */
+    uint64_t    quote;      /* '"' */
+    uint64_t    bslash;     /* '\\' */
+} json_block;
+
+/** Classify 64 bytes of s */
+static __inline void json_classify(const char* s, json_block* blk)
+{
+#if defined(USE_INTRINSICS_AVX)
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i low = _mm256_set1_epi8(0x20);
+    const __m256i lbrace = _mm256_set1_epi8('{');
+    const __m256i rbrace = _mm256_set1_epi8('}');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i qt = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    uint64_t ws[2], op[2], quote[2], bslash[2];
+    for(int i = 0; i < 2; i++){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(s + 32*i));
+        /* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+        __m256i xl = _mm256_or_si256(x, low);
+        ws[i] = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, sp), _mm256_cmpeq_epi8(x, tab)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, lf), _mm256_cmpeq_epi8(x, cr))));
+        op[i] = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(xl, lbrace), _mm256_cmpeq_epi8(xl, rbrace)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(x, comma), _mm256_cmpeq_epi8(x, colon))));
+        quote[i] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, qt));
+        bslash[i] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, bs));
+    }
+    blk->ws = ws[0] | (ws[1] << 32);
+    blk->op = op[0] | (op[1] << 32);
+    blk->quote = quote[0] | (quote[1] << 32);
+    blk->bslash = bslash[0] | (bslash[1] << 32);
+#elif defined(USE_INTRINSICS_SSE)
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i low = _mm_set1_epi8(0x20);
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i qt = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    blk->ws = blk->op = blk->quote = blk->bslash = 0;
+    for(int i = 0; i < 4; i++){
+        __m128i x = _mm_loadu_si128((const __m128i*)(s + 16*i));
+        /* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+        __m128i xl = _mm_or_si128(x, low);
+        blk->ws |= (uint64_t)_mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, tab)),
+                    _mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)))) << 16*i;
+        blk->op |= (uint64_t)_mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(xl, lbrace), _mm_cmpeq_epi8(xl, rbrace)),
+                    _mm_or_si128(_mm_cmpeq_epi8(x, comma), _mm_cmpeq_epi8(x, colon)))) << 16*i;
+        blk->quote |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, qt)) << 16*i;
+        blk->bslash |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, bs)) << 16*i;
+    }
+#else
+    unsigned char cls;
+    blk->ws = blk->op = blk->quote = blk->bslash = 0;
+    for(int i = 0; i < 64; i++){
+        if((unsigned char)s[i] > 127) continue;
+        cls = json_cls_map[(unsigned char)s[i]];
+        blk->ws |= (uint64_t)(cls & 1) << i;
+        blk->op |= (uint64_t)((cls >> 1) & 1) << i;
+        blk->quote |= (uint64_t)((cls >> 2) & 1) << i;
+        blk->bslash |= (uint64_t)((cls >> 3) & 1) << i;
+    }
+#endif // USE_INTRINSICS_AVX
+}
+
+/** Bit i of the result is xor of bits 0..i of x - all bits between
+*   an opening and a closing quote become set
+*/
+static __inline uint64_t prefix_xor(uint64_t x)
+{
+#if (defined(USE_INTRINSICS_SSE) || defined(USE_INTRINSICS_AVX)) && defined(__PCLMUL__) && defined(USE_64BIT_TARGET)
+    /* carry-less multiplication by all ones */
+    return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_set_epi64x(0, x), _mm_set1_epi8((char)0xff), 0));
+#else
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+#endif // __PCLMUL__
+}
+
+/** Find the strings of a classified block
+*   Output: quote - the quotes which are not escaped
+*   Return: bit mask of the strings - opening quote included, closing quote excluded
+*   Remark: the state of the previous block is carried over in prev_escaped
+*       (the first byte is escaped) and prev_in_string (all ones - the block
+*       starts inside a string)
+*/
+static __inline uint64_t json_block_strings(json_block* blk, uint64_t* prev_escaped, uint64_t* prev_in_string,
+                                            uint64_t* quote)
+{
+    uint64_t escaped, odd_starts, even_starts, in_string;
+    /* escaped characters: odd length backslash sequences escape the next byte */
+    blk->bslash &= ~*prev_escaped;
+    escaped = (blk->bslash << 1) | *prev_escaped;
+    odd_starts = blk->bslash & ~EVEN_BITS & ~escaped;
+    even_starts = odd_starts + blk->bslash;
+    *prev_escaped = (even_starts < odd_starts) ? 1 : 0;
+    escaped &= EVEN_BITS ^ (even_starts << 1);
+    *quote = blk->quote & ~escaped;
+    in_string = prefix_xor(*quote) ^ *prev_in_string;
+    *prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    return in_string;
+}
+
+/** Build the structural index of the buffer in ctx->index
+*   Return: # offsets in the index or -1 on memory allocation error
+*   Remark: the index holds offsets of {}[],: outside strings, of the opening quotes
+*       and of the first bytes of scalar values (numbers, true, false, null)
+*/
+static ptrdiff_t json_build_index(json_ctx* ctx, const char* buf, size_t buflen)
+{
+    uint64_t prev_escaped = 0;      /* the first byte of the block is escaped */
+    uint64_t prev_in_string = 0;    /* all ones if the block starts inside a string */
+    uint64_t prev_scalar = 0;       /* the last byte of the previous block is a scalar byte */
+    uint64_t quote, in_string, scalar, bits;
+    json_block blk;
+    char tail[64];
+    const char* s;
+    size_t n = 0;
+    for(size_t blkpos = 0; blkpos < buflen; blkpos += 64){
+        /* every block adds 64 offsets at most */
+        if(ctx->index_size - n < 64){
+            size_t size = ctx->index_size ? 2 * ctx->index_size : 1024;
+            uint32_t* index = realloc(ctx->index, size * sizeof(uint32_t));
+            if(!index) return -1;
+            ctx->index = index;
+            ctx->index_size = size;
+        }
+        if(buflen - blkpos >= 64){
+            s = buf + blkpos;
+        }
+        else{
+            /* pad the last block with whitespace */
+            memset(tail, ' ', 64);
+            memcpy(tail, buf + blkpos, buflen - blkpos);
+            s = tail;
+        }
+        json_classify(s, &blk);
+        in_string = json_block_strings(&blk, &prev_escaped, &prev_in_string, &quote);
+        /* scalars - runs of anything else outside strings */
+        scalar = ~(blk.op | blk.ws | quote | in_string);
+        bits = (blk.op & ~in_string) | (quote & in_string) | (scalar & ~((scalar << 1) | prev_scalar));
+        prev_scalar = scalar >> 63;
+        while(bits){
+            ctx->index[n++] = (uint32_t)(blkpos + json_ctz64(bits));
+            bits &= bits - 1;
+        }
+    }
+    /* the padding may look like a scalar - drop it */
+    while((n > 0)&&(ctx->index[n - 1] >= buflen)) n--;
+    return (ptrdiff_t)n;
+}
+
+/*  On-demand access (json_ondemand()): the cursor points at a value in the raw
+*   buffer, lookups scan forward and skip the values they do not need without
+*   building anything. The buffer is never modified - a value is materialized
+*   into nodes from a copy in the scratch memory
+*/
+
+static __inline ptrdiff_t json_skip_ws(const char* buf, ptrdiff_t len, ptrdiff_t pos)
+{
+    while((pos < len)&&(json_ch_map[(unsigned char)buf[pos]] == 1)) pos++;
+    return pos;
+}
+
+/** Skip a string, buf[pos] is the opening quote
+*   Return: position after the closing quote or -1 if the buffer ends first
+*/
+static ptrdiff_t json_skip_string(const char* buf, ptrdiff_t len, ptrdiff_t pos)
+{
+    ptrdiff_t n;
+    pos++;
+    while(pos < len){
+        /* runs of plain characters are skipped many bytes at a time */
+        n = find_strspec(buf + pos, len - pos);
+        if(n < 0) return -1;
+        pos += n;
+        if(buf[pos] == '"') return pos + 1;
+        /* a control char is left for the parser to report */
+        pos += (buf[pos] == '\\') ? 2 : 1;
+    }
+    return -1;
+}
+
+/** Skip a value which starts at buf[pos]
+*   Return: position after the value or -1 if the buffer ends first
+*   Remark: a container is skipped 64 bytes at a time: the blocks are classified
+*       as for the structural index and only the braces and brackets outside
+*       of the strings are counted, the content is not validated
+*/
+static ptrdiff_t json_skip_value(const char* buf, ptrdiff_t len, ptrdiff_t pos)
+{
+    uint64_t prev_escaped = 0, prev_in_string = 0, quote, bits;
+    json_block blk;
+    char tail[64];
+    const char* s;
+    ptrdiff_t blkpos;
+    int depth = 0, i;
+    char ch = buf[pos];
+    if(ch == '"') return json_skip_string(buf, len, pos);
+    if((ch != '{')&&(ch != '[')){
+        /* a scalar value */
+        while((pos < len)&&(!json_is_delim(buf[pos]))) pos++;
+        return pos;
+    }
+    for(blkpos = pos; blkpos < len; blkpos += 64){
+        if(len - blkpos >= 64){
+            s = buf + blkpos;
+        }
+        else{
+            /* pad the last block with whitespace */
+            memset(tail, ' ', 64);
+            memcpy(tail, buf + blkpos, len - blkpos);
+            s = tail;
+        }
+        json_classify(s, &blk);
+        bits = blk.op & ~json_block_strings(&blk, &prev_escaped, &prev_in_string, &quote);
+        while(bits){
+            i = json_ctz64(bits);
+            bits &= bits - 1;
+            switch(s[i]){
+                case '{':
+                case '[':
+                    depth++;
+                    break;
+                case '}':
+                case ']':
+                    if(!--depth) return blkpos + i + 1;
+                    break;
+            }
+        }
+    }
+    return -1;
+}
+
+/** Does the raw key buf[pos] .. buf[end - 1] (no quotes) match the key */
+static int json_key_matches(json_ctx* ctx, const char* buf, ptrdiff_t pos, ptrdiff_t end, const char* key)
+{
+    size_t n = (size_t)(end - pos);
+    if(!memchr(buf + pos, '\\', n)){
+        return (!strncmp(buf + pos, key, n))&&(key[n] == '\0');
+    }
+    /* decode a copy of the key with the escapes */
+    char* tmp = json_scratch_alloc(ctx, n + 1);
+    if(!tmp) return 0;
+    memcpy(tmp, buf + pos, n);
+    tmp[n] = '"';
+    size_t saved = ctx->pos;
+    ctx->pos = 0;
+    const char* str = parse_string(ctx, tmp, n + 1, NULL);
+    ctx->pos = saved;
+    return (str)&&(!astrcmp(str, key));
+}
+
+/** Set the cursor to a value which starts at pos
+*   Return: 0 if the buffer ends first
+*/
+static int json_cursor_set(const json_cursor* from, ptrdiff_t pos, json_cursor* out)
+{
+    json_ctx* ctx = from->ctx;
+    if(pos >= (ptrdiff_t)from->len){
+        JSON_SHOW_ERROR("incomplete json string");
+        ctx->err = ERR_JSON_INCOMPLETE;
+        return 0;
+    }
+    out->ctx = from->ctx;
+    out->buf = from->buf;
+    out->len = from->len;
+    out->pos = (size_t)pos;
+    return ~0;
+}
+
+int json_ondemand(json_ctx* ctx, const char* buf, size_t buflen, int to_utf8, json_cursor* cur)
+{
+    if(!ctx){
+        fprintf(stderr, "json_ondemand() failed: null pointer received\n");
+        return 0;
+    }
+    if((!buf)||(!cur)){
+        JSON_SHOW_ERROR("null pointer received");
+        ctx->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    json_reset(ctx);
+    ctx->decode = to_utf8;
+    ctx->err = ERR_JSON_OK;
+    /* the materialized values are kept as the elements of the root array,
+       so json_reset() and json_destroy() release them */
+    if(!json_add_last(ctx, NULL, JSON_ARRAY, NULL)) return 0;
+    cur->ctx = ctx;
+    cur->buf = buf;
+    cur->len = buflen;
+    return json_cursor_set(cur, json_skip_ws(buf, (ptrdiff_t)buflen, 0), cur);
+}
+
+json_type json_cursor_type(const json_cursor* cur)
+{
+    size_t i;
+    switch(cur->buf[cur->pos]){
+        case '{': return JSON_OBJECT;
+        case '[': return JSON_ARRAY;
+        case '"': return JSON_STRING;
+        case 't':
+        case 'f': return JSON_BOOL;
+        case 'n': return JSON_DUMMY;
+        default:
+            for(i = cur->pos; (i < cur->len)&&(!json_is_delim(cur->buf[i])); i++){
+                if((cur->buf[i] == '.')||(cur->buf[i] == 'e')||(cur->buf[i] == 'E')) return JSON_DOUBLE;
+            }
+            return JSON_INTEGER;
+    }
+}
+
+int json_cursor_get(const json_cursor* obj, const char* key, json_cursor* out)
+{
+    json_ctx* ctx;
+    const char* buf;
+    ptrdiff_t pos, end, len;
+    int match;
+    if((!obj)||(!key)||(!out)){
+        fprintf(stderr, "json_cursor_get() failed: null pointer received\n");
+        return 0;
+    }
+    ctx = obj->ctx;
+    buf = obj->buf;
+    len = (ptrdiff_t)obj->len;
+    ctx->err = ERR_JSON_OK;
+    if(buf[obj->pos] != '{'){
+        JSON_SHOW_ERROR("not an object");
+        ctx->err = ERR_JSON_TYPE;
+        return 0;
+    }
+    pos = json_skip_ws(buf, len, (ptrdiff_t)obj->pos + 1);
+    if((pos < len)&&(buf[pos] == '}')) return 0; /* empty object */
+    while(pos < len){
+        if(buf[pos] != '"') goto LB_UNEXPECTED;
+        end = json_skip_string(buf, len, pos);
+        if(end < 0) break;
+        match = json_key_matches(ctx, buf, pos + 1, end - 1, key);
+        pos = json_skip_ws(buf, len, end);
+        if(pos >= len) break;
+        if(buf[pos] != ':') goto LB_UNEXPECTED;
+        pos = json_skip_ws(buf, len, pos + 1);
+        if(match) return json_cursor_set(obj, pos, out);
+        if(pos >= len) break;
+        /* the value is not needed - skip it */
+        pos = json_skip_value(buf, len, pos);
+        if(pos < 0) break;
+        pos = json_skip_ws(buf, len, pos);
+        if(pos >= len) break;
+        if(buf[pos] == '}') return 0; /* not found */
+        if(buf[pos] != ',') goto LB_UNEXPECTED;
+        pos = json_skip_ws(buf, len, pos + 1);
+    }
+    JSON_SHOW_ERROR("incomplete json string");
+    ctx->err = ERR_JSON_INCOMPLETE;
+    return 0;
+LB_UNEXPECTED:
+    JSON_SHOW_ERROR("unexpected char");
+    ctx->err = ERR_JSON_UNEXPECTED;
+    return 0;
+}
+
+int json_cursor_element(const json_cursor* arr, int index, json_cursor* out)
+{
+    json_ctx* ctx;
+    const char* buf;
+    ptrdiff_t pos, len;
+    if((!arr)||(!out)){
+        fprintf(stderr, "json_cursor_element() failed: null pointer received\n");
+        return 0;
+    }
+    ctx = arr->ctx;
+    buf = arr->buf;
+    len = (ptrdiff_t)arr->len;
+    ctx->err = ERR_JSON_OK;
+    if(buf[arr->pos] != '['){
+        JSON_SHOW_ERROR("not an array");
+        ctx->err = ERR_JSON_TYPE;
+        return 0;
+    }
+    if(index < 0) return 0;
+    pos = json_skip_ws(buf, len, (ptrdiff_t)arr->pos + 1);
+    if((pos < len)&&(buf[pos] == ']')) return 0; /* empty array */
+    while(pos < len){
+        if(!index) return json_cursor_set(arr, pos, out);
+        index--;
+        pos = json_skip_value(buf, len, pos);
+        if(pos < 0) break;
+        pos = json_skip_ws(buf, len, pos);
+        if(pos >= len) break;
+        if(buf[pos] == ']') return 0; /* not found */
+        if(buf[pos] != ','){
+            JSON_SHOW_ERROR("unexpected char");
+            ctx->err = ERR_JSON_UNEXPECTED;
+            return 0;
+        }
+        pos = json_skip_ws(buf, len, pos + 1);
+    }
+    JSON_SHOW_ERROR("incomplete json string");
+    ctx->err = ERR_JSON_INCOMPLETE;
+    return 0;
+}
+
+int json_cursor_next(json_cursor* cur)
+{
+    json_ctx* ctx;
+    const char* buf;
+    ptrdiff_t pos, end, len;
+    if(!cur){
+        fprintf(stderr, "json_cursor_next() failed: null pointer received\n");
+        return 0;
+    }
+    ctx = cur->ctx;
+    buf = cur->buf;
+    len = (ptrdiff_t)cur->len;
+    ctx->err = ERR_JSON_OK;
+    pos = json_skip_value(buf, len, (ptrdiff_t)cur->pos);
+    if(pos >= 0) pos = json_skip_ws(buf, len, pos);
+    if((pos < 0)||(pos >= len)){
+        JSON_SHOW_ERROR("incomplete json string");
+        ctx->err = ERR_JSON_INCOMPLETE;
+        return 0;
+    }
+    if((buf[pos] == ']')||(buf[pos] == '}')) return 0; /* the last one */
+    if(buf[pos] != ','){
+        JSON_SHOW_ERROR("unexpected char");
+        ctx->err = ERR_JSON_UNEXPECTED;
+        return 0;
+    }
+    pos = json_skip_ws(buf, len, pos + 1);
+    if((pos < len)&&(buf[pos] == '"')){
+        /* a string followed by ':' is the key of the next member */
+        end = json_skip_string(buf, len, pos);
+        if(end >= 0){
+            end = json_skip_ws(buf, len, end);
+            if((end < len)&&(buf[end] == ':')) pos = json_skip_ws(buf, len, end + 1);
+        }
+    }
+    return json_cursor_set(cur, pos, cur);
+}
+
+json_node* json_cursor_value(const json_cursor* cur)
+{
+    json_ctx* ctx;
+    json_node *holder, *nd;
+    ptrdiff_t end;
+    size_t n;
+    if(!cur){
+        fprintf(stderr, "json_cursor_value() failed: null pointer received\n");
+        return NULL;
+    }
+    ctx = cur->ctx;
+    holder = ctx->root;
+    end = json_skip_value(cur->buf, (ptrdiff_t)cur->len, (ptrdiff_t)cur->pos);
+    if(end < 0){
+        JSON_SHOW_ERROR("incomplete json string");
+        ctx->err = ERR_JSON_INCOMPLETE;
+        return NULL;
+    }
+    /* the parser writes to its input - it gets a copy,
+       the trailing space lets a number end before the end of the buffer */
+    n = (size_t)end - cur->pos;
+    char* tok = json_scratch_alloc(ctx, n + 1);
+    if(!tok) return NULL;
+    memcpy(tok, cur->buf + cur->pos, n);
+    tok[n] = ' ';
+    ctx->root = NULL;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = 0;
+    ctx->feed = 0;
+    ctx->view = 0;
+    ctx->pos = 0;
+    if(!json_parse_run(ctx, tok, n + 1)){
+        /* nodes created before the error are put under the root array too */
+        nd = NULL;
+    }
+    else nd = ctx->root;
+    if(ctx->root){
+        ctx->root->parent = holder;
+        if(holder->last_child) holder->last_child->next = ctx->root;
+        else holder->first_child = ctx->root;
+        holder->last_child = ctx->root;
+    }
+    ctx->root = holder;
+    ctx->pos = (size_t)end;
+    return nd;
+}
+
+/** Check that a scalar value in a container ends where it must
+*   Remark: as json_parse() does the next char is not read after the root value
+*/
+static __inline int json_scalar_end(json_ctx* ctx, const char* ptr, size_t len, const json_node* parent)
+{
+    if((parent)&&(ctx->pos < len)){
+        switch(ptr[ctx->pos]){
+            case ' ': case '\t': case '\n': case '\r':
+            case ',': case ']': case '}':
+                break;
             default:
                 JSON_SHOW_ERROR("unexpected char");
                 ctx->err = ERR_JSON_UNEXPECTED;
                 return 0;
         }
     }
-    JSON_SHOW_ERROR("incomplete json string");
-    ctx->err = ERR_JSON_INCOMPLETE;
-    return 0;
+    return ~0;
+}
+
+/** Stage 2: walk the index building the tree
+*   Remark: no recursion - the current container is the parent of the new nodes,
+*       its own parent is restored when the container is closed
+*/
+static int json_walk_index(json_ctx* ctx, char* ptr, size_t len, size_t ntokens)
+{
+    json_node* parent = NULL;
+    json_node* nd;
+    const char* key = NULL;
+    size_t i = 0;
+    int parsed;
+    int depth = 0;
+    /* a null terminator of a number kept as string may overwrite a token */
+    size_t held_pos = SIZE_MAX;
+    char held_ch = 0;
+    char ch;
+    /* 0 - value expected, 1 - key expected, 2 - value is done */
+    int state = 0;
+    while(i < ntokens){
+        ctx->pos = ctx->index[i++];
+        ch = (ctx->pos == held_pos) ? held_ch : ptr[ctx->pos];
+        if(state == 2){
+            if(ch == ','){
+                state = (parent->type == JSON_OBJECT) ? 1 : 0;
+                continue;
+            }
+            if(ch != ((parent->type == JSON_OBJECT) ? '}' : ']')){
+                JSON_SHOW_ERROR("unexpected char");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return 0;
+            }
+        }
+        else if((parent)&&(!parent->first_child)&&
+                (((state == 1)&&(ch == '}'))||((parent->type == JSON_ARRAY)&&(ch == ']')))){
+            /* empty object or array */
+        }
+        else if(state == 1){
+            if(ch != '"'){
+                JSON_SHOW_ERROR("unexpected char");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return 0;
+            }
+            ctx->pos++;
+            key = parse_string(ctx, ptr, len, NULL);
+            if(!key) return 0;
+            if(i >= ntokens) break;
+            if(ptr[ctx->index[i]] != ':'){
+                ctx->pos = ctx->index[i];
+                JSON_SHOW_ERROR("expected ':' key-value separator");
+                ctx->err = ERR_JSON_UNEXPECTED;
+                return 0;
+            }
+            i++;
+            state = 0;
+            continue;
+        }
+        else{
+            switch(ch){
+                case '{':
+                case '[':
+                    depth++;
+                    if((ctx->max_depth > 0)&&(depth > ctx->max_depth)){
+                        JSON_SHOW_ERROR("maximum indentation level exceeded");
+                        ctx->err = ERR_JSON_DEPTH;
+                        return 0;
+                    }
+                    nd = json_add_last(ctx, parent, (ch == '{') ? JSON_OBJECT : JSON_ARRAY, key);
+                    if(!nd) return 0;
+                    parent = nd;
+                    key = NULL;
+                    state = (ch == '{') ? 1 : 0;
+                    continue;
+                case '"':
+                    ctx->pos++;
+                    nd = json_add_last(ctx, parent, JSON_STRING, key);
+                    if(!nd) return 0;
+                    nd->val.string_value = parse_string(ctx, ptr, len, NULL);
+                    if(!nd->val.string_value) return 0;
+                    break;
+                case 't':
+                case 'f':
+                case 'n':
+                    parsed = (ch == 'f') ? 5 : 4;
+                    if(ctx->pos + parsed > len){
+                        JSON_SHOW_ERROR("incomplete json string");
+                        ctx->err = ERR_JSON_INCOMPLETE;
+                        return 0;
+                    }
+                    if(!memcmpeq_32(ptr + ctx->pos, (ch == 't') ? "true" : (ch == 'f') ? "false" : "null", parsed)){
+                        JSON_SHOW_ERROR("unexpected char");
+                        ctx->err = ERR_JSON_UNEXPECTED;
+                        return 0;
+                    }
+                    nd = json_add_last(ctx, parent, (ch == 'n') ? JSON_DUMMY : JSON_BOOL, key);
+                    if(!nd) return 0;
+                    if(ch == 't') nd->val.bool_value = ~0;
+                    ctx->pos += parsed;
+                    if(!json_scalar_end(ctx, ptr, len, parent)) return 0;
+                    break;
+                default:
+                    if(json_ch_map[(unsigned char)ch] != 2){
+                        JSON_SHOW_ERROR("unexpected char");
+                        ctx->err = ERR_JSON_UNEXPECTED;
+                        return 0;
+                    }
+                    nd = json_add_last(ctx, parent, JSON_DUMMY, key);
+                    if(!nd) return 0;
+                    if(ctx->raw_numbers){
+                        /* a view of the digits, converted on demand */
+                        ptrdiff_t n = json_check_number(ptr + ctx->pos, len - ctx->pos);
+                        if(n < 0){
+                            JSON_SHOW_ERROR("invalid number");
+                            ctx->err = ERR_JSON_NUMBER;
+                            return 0;
+                        }
+                        nd->type = JSON_NUMBER_RAW;
+                        nd->val.string_value = ptr + ctx->pos;
+                        nd->str_len = (size_t)n;
+                        ctx->pos += (size_t)n;
+                        if(!json_scalar_end(ctx, ptr, len, parent)) return 0;
+                        break;
+                    }
+                    parsed = INT_CLAMP(len - ctx->pos);
+                    switch(json_atonum(ptr + ctx->pos, &parsed, &nd->val)){
+                        case 1: /* integer */
+                            nd->type = JSON_INTEGER;
+                            break;
+                        case 2: /* double */
+                            nd->type = JSON_DOUBLE;
+                            break;
+                        case -2: /* overflow - keep it as string value */
+                            if(ctx->pos + parsed >= len){
+                                JSON_SHOW_ERROR("no room for null terminator");
+                                ctx->err = ERR_JSON_INCOMPLETE;
+                                return 0;
+                            }
+                            nd->type = JSON_STRING;
+                            nd->val.string_value = ptr + ctx->pos;
+                            break;
+                        default:
+                            JSON_SHOW_ERROR("invalid number");
+                            ctx->err = ERR_JSON_NUMBER;
+                            return 0;
+                    }
+                    ctx->pos += parsed;
+                    if(!json_scalar_end(ctx, ptr, len, parent)) return 0;
+                    if(nd->type == JSON_STRING){
+                        /* the terminator replaces whitespace or the next token */
+                        held_pos = ctx->pos;
+                        held_ch = ptr[ctx->pos];
+                        ptr[ctx->pos] = '\0';
+                    }
+                    break;
+            }
+            key = NULL;
+            if(!parent) return ~0;
+            state = 2;
+            continue;
+        }
+        /* the container is closed */
+        ctx->pos++;
+        depth--;
+        parent = parent->parent;
+        if(!parent) return ~0;
+        state = 2;
+    }
+    /* the rest is whitespace */
+    ctx->pos = len;
+    JSON_SHOW_ERROR("incomplete json string");
+    ctx->err = ERR_JSON_INCOMPLETE;
+    return 0;
+}
+
+json_node* json_parse_indexed(json_ctx* ctx, char* buf, size_t buflen, int to_utf8)
+{
+    if(!ctx){
+        fprintf(stderr, "json_parse_indexed() failed: null pointer received\n");
+        return NULL;
+    }
+    if(buflen > UINT32_MAX){
+        /* the offsets of the index are 32 bit */
+        JSON_SHOW_ERROR("the document is too large for the structural index");
+        ctx->err = ERR_JSON_OVERFLOW;
+        return NULL;
+    }
+    ctx->decode = to_utf8;
+    ptrdiff_t ntokens = json_build_index(ctx, buf, buflen);
+    if(ntokens < 0){
+        JSON_SHOW_ERROR("memory allocation error");
+        ctx->err = ERR_JSON_MEMALLOC;
+        return NULL;
+    }
+    if(json_walk_index(ctx, buf, buflen, (size_t)ntokens)){
+        return ctx->root;
+    }
+    return NULL;
+}
+
+/* json_validate(): no tree and no events */
+static const json_sax json_no_events;
+
+int json_validate(json_ctx* ctx, const char* buf, size_t buflen)
+{
+    int rc;
+    if(!ctx){
+        fprintf(stderr, "json_validate() failed: null pointer received\n");
+        return 0;
+    }
+    if(!buf){
+        JSON_SHOW_ERROR("null pointer received");
+        ctx->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    /* the parser of json_parse(ctx, buf, buflen, 1) which only reads the buffer */
+    ctx->decode = 1;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = 0;
+    ctx->feed = 0;
+    ctx->view = 0;
+    ctx->pos = 0;
+    ctx->err = ERR_JSON_OK;
+    ctx->sax = &json_no_events;
+    ctx->check = 1;
+    /* nothing is written to the buffer in this mode */
+    rc = json_parse_run(ctx, (char*)buf, buflen);
+    ctx->sax = NULL;
+    ctx->check = 0;
+    return rc;
+}
+
+
+/** Parse one record of a worker's part and check that only whitespace follows its value
+*   Input: rec - the record, its offset is set
+*       len - # bytes of the record including the line feed if any
+*/
+static void json_batch_record(json_worker* w, json_record* rec, size_t len)
+{
+    json_ctx* ctx = w->ctx;
+    char* ptr = w->buf + rec->offset;
+    size_t i;
+    /* the limit is for the record, the context keeps the nodes of all records of the part */
+    ctx->max_nodes = (ctx->nused < INT_MAX - w->max_nodes) ? ctx->nused + w->max_nodes : INT_MAX;
+    ctx->pos = 0;
+    ctx->err = ERR_JSON_OK;
+    rec->root = json_parse(ctx, ptr, len, w->decode);
+    if(rec->root){
+        i = ctx->pos;
+        /* a top-level number kept as string has its null terminator here */
+        if((i < len)&&(!ptr[i])&&(rec->root->type == JSON_STRING)) i++;
+        while((i < len)&&(json_ch_map[(unsigned char)ptr[i]] == 1)) i++;
+        if(i < len){
+            ctx->pos = i;
+            JSON_SHOW_ERROR("unexpected char after the value");
+            ctx->err = ERR_JSON_UNEXPECTED;
+            rec->root = NULL;
+        }
+    }
+    rec->err = ctx->err;
+    rec->pos = ctx->pos;
+}
+
+/** Worker thread of json_parse_batch(): find and parse the records of the part one by one */
+static void* json_batch_run(void* arg)
+{
+    json_worker* w = arg;
+    json_record* records = w->records;
+    size_t n = 0, size = w->size;
+    size_t p = w->beg, eol, len;
+    ptrdiff_t nl;
+    json_reset(w->ctx);
+    w->err = ERR_JSON_OK;
+    while(p < w->end){
+        /* a raw line feed is never a part of a value, so it always ends a record */
+        nl = find_charpos(w->buf + p, '\n', w->end - p);
+        eol = (nl < 0) ? w->end : p + nl;
+        /* skip blank lines and leading whitespace */
+        while((p < eol)&&(json_ch_map[(unsigned char)w->buf[p]] == 1)) p++;
+        if(p < eol){
+            if(n == size){
+                json_record* tmp = realloc(records, (size ? size * 2 : 256) * sizeof(json_record));
+                if(!tmp){
+                    w->err = ERR_JSON_MEMALLOC;
+                    break;
+                }
+                records = tmp;
+                size = size ? size * 2 : 256;
+            }
+            /* the line feed goes with the record: a number kept as string needs a byte for its null terminator */
+            len = eol - p + ((nl < 0) ? 0 : 1);
+            records[n].offset = p;
+            json_batch_record(w, &records[n++], len);
+        }
+        p = eol + 1;
+    }
+    /* the neighbours' fields share cache lines - write once */
+    w->records = records;
+    w->size = size;
+    w->nrecords = n;
+    return NULL;
+}
+
+/** Run the first nworkers workers of the batch - in threads of their own,
+*   the first one (and any a thread can't be created for) in the calling thread
+*/
+static void json_batch_start(json_batch* batch, int nworkers, void* (*run)(void*))
+{
+    int i;
+#ifdef JSON_USE_THREADS
+    pthread_t* threads = batch->threads;
+    int* started = NULL;
+    if(nworkers > 1) started = calloc(nworkers, sizeof(int));
+    for(i = 1; (started)&&(i < nworkers); i++){
+        started[i] = !pthread_create(&threads[i], NULL, run, &batch->workers[i]);
+    }
+    run(&batch->workers[0]);
+    for(i = 1; i < nworkers; i++){
+        if((started)&&(started[i])) pthread_join(threads[i], NULL);
+        else run(&batch->workers[i]);
+    }
+    free(started);
+#else
+    for(i = 0; i < nworkers; i++) run(&batch->workers[i]);
+#endif // JSON_USE_THREADS
+}
+
+json_batch* json_batch_init(int nthreads)
+{
+    json_batch* batch;
+#ifdef JSON_USE_THREADS
+    if(nthreads <= 0){
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu > 0) ? (int)ncpu : 1;
+    }
+#else
+    nthreads = 1;
+#endif // JSON_USE_THREADS
+    if(!(batch = calloc(1, sizeof(json_batch)))){
+        fprintf(stderr, "json_batch_init() failed: memory allocation error\n");
+        return NULL;
+    }
+    batch->max_nodes = JSON_MAX_NODES;
+    batch->max_depth = JSON_DEPTH_LIMIT;
+    batch->workers = calloc(nthreads, sizeof(json_worker));
+#ifdef JSON_USE_THREADS
+    batch->threads = malloc(nthreads * sizeof(pthread_t));
+#else
+    batch->threads = batch->workers;    /* not used */
+#endif // JSON_USE_THREADS
+    if((!batch->workers)||(!batch->threads)){
+        fprintf(stderr, "json_batch_init() failed: memory allocation error\n");
+        json_batch_destroy(batch);
+        return NULL;
+    }
+    for(batch->nthreads = 0; batch->nthreads < nthreads; batch->nthreads++){
+        /* the arena mode: the nodes of a part are dropped at once */
+        json_ctx* ctx = json_init_pool(JSON_SLAB_NODES, JSON_MAX_NODES);
+        if(!ctx){
+            fprintf(stderr, "json_batch_init() failed: memory allocation error\n");
+            json_batch_destroy(batch);
+            return NULL;
+        }
+        batch->workers[batch->nthreads].ctx = ctx;
+    }
+    return batch;
+}
+
+int json_parse_batch(json_batch* batch, char* buf, size_t buflen, int to_utf8)
+{
+    json_worker* w;
+    size_t beg = 0, end, n = 0;
+    ptrdiff_t nl;
+    int i, nworkers;
+    if((!batch)||(!buf)){
+        fprintf(stderr, "json_parse_batch() failed: null pointer received\n");
+        if(batch) batch->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    batch->err = ERR_JSON_OK;
+    batch->nrecords = 0;
+    batch->nfailed = 0;
+    /* a small batch is not worth a thread */
+    nworkers = batch->nthreads;
+    if((size_t)nworkers > buflen / JSON_BATCH_MIN_PART + 1){
+        nworkers = (int)(buflen / JSON_BATCH_MIN_PART + 1);
+    }
+    for(i = 0; i < batch->nthreads; i++){
+        w = &batch->workers[i];
+        /* every part but the last one ends after a line feed */
+        end = (i < nworkers - 1) ? buflen / nworkers * (i + 1) : buflen;
+        if(end < beg) end = beg;
+        if(end < buflen){
+            nl = find_charpos(buf + end, '\n', buflen - end);
+            end = (nl < 0) ? buflen : end + nl + 1;
+        }
+        w->buf = buf;
+        w->beg = beg;
+        w->end = end;
+        w->decode = to_utf8;
+        w->max_nodes = (batch->max_nodes > 0) ? batch->max_nodes : JSON_MAX_NODES;
+        w->ctx->max_depth = batch->max_depth;
+        w->ctx->raw_numbers = batch->raw_numbers;
+        beg = end;
+    }
+    json_batch_start(batch, nworkers, json_batch_run);
+    /* the rest of the workers keep nothing from the previous batch */
+    for(i = nworkers; i < batch->nthreads; i++){
+        json_batch_run(&batch->workers[i]);
+    }
+    for(i = 0; i < batch->nthreads; i++){
+        if(batch->workers[i].err != ERR_JSON_OK){
+            fprintf(stderr, "json_parse_batch() failed: memory allocation error\n");
+            batch->err = batch->workers[i].err;
+            return 0;
+        }
+        n += batch->workers[i].nrecords;
+    }
+    if(n > batch->size){
+        json_record* tmp = realloc(batch->records, n * sizeof(json_record));
+        if(!tmp){
+            fprintf(stderr, "json_parse_batch() failed: memory allocation error\n");
+            batch->err = ERR_JSON_MEMALLOC;
+            return 0;
+        }
+        batch->records = tmp;
+        batch->size = n;
+    }
+    /* the parts follow each other - so do their records */
+    for(i = 0; i < batch->nthreads; i++){
+        w = &batch->workers[i];
+        if(!w->nrecords) continue;
+        memcpy(batch->records + batch->nrecords, w->records, w->nrecords * sizeof(json_record));
+        for(size_t k = 0; k < w->nrecords; k++){
+            if(!w->records[k].root) batch->nfailed++;
+        }
+        batch->nrecords += w->nrecords;
+    }
+    return ~0;
+}
+
+/** Find the array to split in the structural index: the one with the most bytes outside
+*   its largest element (the bytes which may be spread between the workers), and split its
+*   elements into parts of about the same size at the commas between them
+*   (batch->workers[].beg and .end are set)
+*   Input: nparts - maximum # parts
+*       max_nodes - the nodes limit: a document with more values is not split
+*   Return: # parts, 0 - nothing to split. *depth - the nesting depth of the array
+*   Remark: every value is a node, so the values are counted on the way. The workers can't
+*       tell where json_parse() would stop at the limit (the nodes before their parts are not
+*       known yet), so such a document is left to json_parse() which reports it
+*/
+static int json_split_array(json_batch* batch, const char* buf, size_t ntokens, int nparts, int max_nodes, int* depth)
+{
+    struct{
+        size_t  tok;        /* the opening bracket */
+        size_t  last;       /* the opening bracket or the last comma */
+        size_t  max;        /* # bytes of the largest element so far */
+    } st[JSON_SPLIT_DEPTH];
+    const uint32_t* index = batch->workers[0].ctx->index;
+    size_t i, first = 0, last = 0, best = 0, target, beg, span;
+    /* the containers, the strings and the other scalars less the keys */
+    size_t nvalues = 0;
+    char ch;
+    int d = 0, k = 0;
+    if((buf[index[0]] != '{')&&(buf[index[0]] != '[')) return 0;
+    for(i = 0; i < ntokens; i++){
+        ch = buf[index[i]];
+        if(ch == ':') nvalues--;
+        else if((ch != ',')&&(ch != '}')&&(ch != ']')) nvalues++;
+        if((ch == '{')||(ch == '[')){
+            if(++d <= JSON_SPLIT_DEPTH){
+                st[d - 1].tok = st[d - 1].last = i;
+                st[d - 1].max = 0;
+            }
+        }
+        else if((ch == ',')||(ch == '}')||(ch == ']')){
+            if((d > 0)&&(d <= JSON_SPLIT_DEPTH)&&(buf[index[st[d - 1].tok]] == '[')){
+                span = index[i] - index[st[d - 1].last];
+                if(span > st[d - 1].max) st[d - 1].max = span;
+                st[d - 1].last = i;
+                if(ch == ']'){
+                    span = index[i] - index[st[d - 1].tok];
+                    if(span - st[d - 1].max > best){
+                        best = span - st[d - 1].max;
+                        first = st[d - 1].tok;
+                        last = i;
+                        *depth = d;
+                    }
+                }
+            }
+            if((ch != ',')&&(--d == 0)) break;
+        }
+    }
+    /* the root is not closed - the parser will tell why */
+    if((i == ntokens)||(best < JSON_BATCH_MIN_PART)) return 0;
+    if(nvalues > (size_t)max_nodes) return 0;
+    span = index[last] - index[first];
+    if((size_t)nparts > span / JSON_BATCH_MIN_PART) nparts = (int)(span / JSON_BATCH_MIN_PART);
+    if(nparts < 2) return 0;
+    beg = index[first] + 1;
+    target = index[first] + span / nparts;
+    for(i = first + 1, d = 0; (i < last)&&(k < nparts - 1); i++){
+        ch = buf[index[i]];
+        if((ch == '{')||(ch == '[')) d++;
+        else if((ch == '}')||(ch == ']')) d--;
+        else if((ch == ',')&&(!d)&&(index[i] >= target)){
+            /* the part ends after the comma */
+            batch->workers[k].beg = beg;
+            batch->workers[k++].end = beg = index[i] + 1;
+            /* what is left is split between the rest of the parts */
+            target = index[i] + (index[last] - index[i]) / (nparts - k);
+        }
+    }
+    /* the last part ends after the closing bracket */
+    batch->workers[k].beg = beg;
+    batch->workers[k++].end = index[last] + 1;
+    return (k < 2) ? 0 : k;
+}
+
+/** Worker thread of json_parse_parallel(): parse the elements of the part as children
+*   of a holder array - the parser sees the inside of the array it is split from
+*/
+static void* json_parallel_run(void* arg)
+{
+    json_worker* w = arg;
+    json_ctx* ctx = w->ctx;
+    json_node* nd;
+    /* the last part closes the holder - the parser may put a null terminator on the bracket */
+    int last = (w->buf[w->end - 1] == ']');
+    int rc;
+    w->err = ERR_JSON_OK;
+    if(!(w->holder = json_add_last(ctx, NULL, JSON_ARRAY, NULL))){
+        w->err = ctx->err;
+        return NULL;
+    }
+    ctx->decode = w->decode;
+    ctx->cur = w->holder;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = w->depth;
+    /* the part ends in the middle of the array: no message, the end is checked below */
+    ctx->feed = 1;
+    ctx->view = 0;
+    ctx->partial_len = 0;
+    ctx->pos = w->beg;
+    ctx->err = ERR_JSON_OK;
+    rc = json_parse_run(ctx, w->buf, w->end);
+    ctx->feed = 0;
+    if(last){
+        if(!rc) w->err = ctx->err;
+    }
+    else if((rc)||(ctx->err != ERR_JSON_INCOMPLETE)||(ctx->cur != w->holder)||(ctx->state != JSON_ST_VALUE)||
+            (ctx->pos != w->end)){
+        w->err = (rc) ? ERR_JSON_UNEXPECTED : ctx->err;
+    }
+    if(w->err != ERR_JSON_OK) return NULL;
+    for(nd = w->holder->first_child; nd; nd = nd->next){
+        nd->parent = w->array;
+    }
+    return NULL;
+}
+
+json_node* json_parse_parallel(json_batch* batch, char* buf, size_t buflen, int to_utf8)
+{
+    json_ctx* ctx;
+    json_worker* w;
+    json_node *root, *array;
+    json_error spine_err;
+    size_t spine_pos;
+    ptrdiff_t ntokens = -1;
+    int i, nworkers = 0, depth = 0, nused = 0, max_nodes;
+    if((!batch)||(!buf)){
+        fprintf(stderr, "json_parse_parallel() failed: null pointer received\n");
+        if(batch) batch->err = ERR_JSON_NULLPTR;
+        return NULL;
+    }
+    batch->err = ERR_JSON_OK;
+    batch->nrecords = 0;
+    batch->nfailed = 0;
+    max_nodes = (batch->max_nodes > 0) ? batch->max_nodes : JSON_MAX_NODES;
+    for(i = 0; i < batch->nthreads; i++){
+        w = &batch->workers[i];
+        json_reset(w->ctx);
+        w->nrecords = 0;
+        /* and the holder */
+        w->ctx->max_nodes = (max_nodes < INT_MAX) ? max_nodes + 1 : INT_MAX;
+        w->ctx->max_depth = batch->max_depth;
+        w->ctx->raw_numbers = batch->raw_numbers;
+    }
+    ctx = batch->workers[0].ctx;
+    /* the parts are JSON_BATCH_MIN_PART bytes at least, the index offsets are 32 bit */
+    if((batch->nthreads > 1)&&(buflen >= 2 * JSON_BATCH_MIN_PART)&&(buflen <= UINT32_MAX)){
+        ntokens = json_build_index(ctx, buf, buflen);
+    }
+    if(ntokens > 0) nworkers = json_split_array(batch, buf, (size_t)ntokens, batch->nthreads, max_nodes, &depth);
+    if((!nworkers)||((batch->max_depth > 0)&&(batch->max_depth <= depth))){
+        /* nothing to split */
+        ctx->max_nodes = max_nodes;
+        root = json_parse(ctx, buf, buflen, to_utf8);
+        batch->err = ctx->err;
+        batch->pos = ctx->pos;
+        return root;
+    }
+    /* the spine: everything but the elements of the array, its nodes go to the first worker's context */
+    ctx->decode = to_utf8;
+    ctx->cur = NULL;
+    ctx->key = NULL;
+    ctx->key_len = 0;
+    ctx->state = JSON_ST_VALUE;
+    ctx->ndepth = 0;
+    ctx->feed = 1;
+    ctx->view = 0;
+    ctx->partial_len = 0;
+    /* up to the opening bracket */
+    if((json_parse_run(ctx, buf, batch->workers[0].beg))||(ctx->err != ERR_JSON_INCOMPLETE)||
+       (ctx->pos != batch->workers[0].beg)||(!ctx->cur)||(ctx->cur->type != JSON_ARRAY)){
+        batch->err = (ctx->err != ERR_JSON_OK) ? ctx->err : ERR_JSON_UNEXPECTED;
+        batch->pos = ctx->pos;
+        return NULL;
+    }
+    root = ctx->root;
+    array = ctx->cur;
+    /* from the closing bracket on - before the workers may put a null terminator on it */
+    ctx->feed = 0;
+    ctx->err = ERR_JSON_OK;
+    ctx->pos = batch->workers[nworkers - 1].end - 1;
+    json_parse_run(ctx, buf, buflen);
+    spine_err = ctx->err;
+    spine_pos = ctx->pos;
+    for(i = 0; i < nworkers; i++){
+        w = &batch->workers[i];
+        w->buf = buf;
+        w->decode = to_utf8;
+        w->array = array;
+        w->depth = depth;
+    }
+    json_batch_start(batch, nworkers, json_parallel_run);
+    ctx->root = root;
+    /* the first error in the document is reported as json_parse() would */
+    for(i = 0; i < nworkers; i++){
+        w = &batch->workers[i];
+        if(w->err != ERR_JSON_OK){
+            batch->err = w->err;
+            batch->pos = w->ctx->pos;
+            return NULL;
+        }
+        /* the holders are not counted */
+        nused += w->ctx->nused - 1;
+        if(nused > max_nodes){
+            /* should never be here - the values are counted by json_split_array() */
+            JSON_SHOW_ERROR("maximum # nodes reached");
+            batch->err = ERR_JSON_NODES;
+            batch->pos = w->ctx->pos;
+            return NULL;
+        }
+    }
+    if(spine_err != ERR_JSON_OK){
+        batch->err = spine_err;
+        batch->pos = spine_pos;
+        return NULL;
+    }
+    /* link the parts */
+    for(i = 0; i < nworkers; i++){
+        json_node* holder = batch->workers[i].holder;
+        if(!holder->first_child) continue;
+        if(array->last_child) array->last_child->next = holder->first_child;
+        else array->first_child = holder->first_child;
+        array->last_child = holder->last_child;
+    }
+    batch->pos = spine_pos;
+    return root;
 }
 
-json_node* json_parse(json_ctx* parser, char* buf, int buflen, int to_utf8)
+void json_batch_destroy(json_batch* batch)
 {
-    if(!parser){
-        fprintf(stderr, "json_parse() failed: null pointer received\n");
-        return NULL;
+    if(!batch) return;
+    for(int i = 0; i < batch->nthreads; i++){
+        json_destroy(batch->workers[i].ctx);
+        free(batch->workers[i].records);
     }
-    parser->decode = to_utf8;
-    if(get_value(parser, NULL, buf, buflen, NULL)){
-        return parser->root;
+#ifdef JSON_USE_THREADS
+    free(batch->threads);
+#endif // JSON_USE_THREADS
+    free(batch->workers);
+    free(batch->records);
+    free(batch);
+}
+
+/* Default # bytes of the staging buffer of json_writer_file() and json_writer_fd() */
+#define JSON_WRITER_STAGE   (64*1024)
+/* the smallest staging buffer - a number or a literal always fits into it */
+#define JSON_WRITER_MIN     64
+/* # bytes a number may take, see itoa_aux() and dtoa_aux() */
+#define JSON_NUM_MAX        32
+/* # bytes of the table of a line break and its indentation, see print_newline() */
+#define JSON_INDENT_BUF     256
+
+#ifdef JSON_ON_DEBUG
+#define JSON_WRITER_ERROR(TXT) \
+do{ \
+    fprintf(stderr, "%s failed in line %d: %s\n", __func__, __LINE__, TXT); \
+    fprintf(stderr, "# bytes written %llu\n", (unsigned long long)(w->total + w->pos)); \
+} while(0)
+#else
+#define JSON_WRITER_ERROR(TXT)
+#endif // JSON_ON_DEBUG
+
+/** Pass the staging buffer to the sink
+*   Return: ~0 - success, 0 - the sink failed (w->err is set)
+*/
+static int wr_flush(json_writer* w)
+{
+    if(!w->pos) return ~0;
+    if(!w->flush(w->user, w->buf, w->pos)){
+        JSON_WRITER_ERROR("the output can't be written");
+        w->err = ERR_JSON_FILE;
+        return 0;
     }
-    return NULL;
+    w->total += w->pos;
+    w->pos = 0;
+    return ~0;
+}
+
+/** Make room for n more bytes: the staging buffer is flushed, the growable one is reallocated
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*   Remark: n must not exceed JSON_WRITER_MIN if there is a sink
+*/
+static int wr_grow(json_writer* w, size_t n)
+{
+    if(w->err) return 0;
+    if(w->flush) return wr_flush(w);
+    if(!w->owned){
+        /* a preallocated buffer, see json_to_string() */
+        JSON_WRITER_ERROR("output buffer max length exceeded");
+        w->err = ERR_JSON_OVERFLOW;
+        return 0;
+    }
+    size_t size = w->size + 1;
+    while(size - 1 - w->pos < n) size *= 2;
+    char* buf = realloc(w->buf, size);
+    if(!buf){
+        JSON_WRITER_ERROR("memory allocation error");
+        w->err = ERR_JSON_MEMALLOC;
+        return 0;
+    }
+    w->buf = buf;
+    w->size = size - 1;     /* room for the null terminator */
+    return ~0;
+}
+
+/** Get the pointer to n free bytes of the buffer, NULL on error */
+static __inline char* wr_room(json_writer* w, size_t n)
+{
+    if((w->size - w->pos < n)&&(!wr_grow(w, n))) return NULL;
+    return w->buf + w->pos;
+}
+
+static __inline int wr_char(json_writer* w, char ch)
+{
+    if((w->pos == w->size)&&(!wr_grow(w, 1))) return 0;
+    w->buf[w->pos++] = ch;
+    return ~0;
+}
+
+/** Write len bytes, a piece larger than the staging buffer goes to the sink as is */
+static int wr_put(json_writer* w, const char* data, size_t len)
+{
+    if(w->size - w->pos < len){
+        if(!w->flush){
+            if(!wr_grow(w, len)) return 0;
+        }
+        else{
+            size_t n = w->size - w->pos;
+            memcpy(w->buf + w->pos, data, n);
+            w->pos += n;
+            data += n;
+            len -= n;
+            if(!wr_flush(w)) return 0;
+            if(len >= w->size){
+                if(!w->flush(w->user, data, len)){
+                    JSON_WRITER_ERROR("the output can't be written");
+                    w->err = ERR_JSON_FILE;
+                    return 0;
+                }
+                w->total += len;
+                return ~0;
+            }
+        }
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+    return ~0;
 }
 
+/* The escape of a byte in a string: the character after the backslash,
+*   'u' - \u00XX, 0 - the byte is written as is. '/' is escaped unless
+*   json_writer.no_escape_slash is set */
+static const char json_escape[256] = {
+    'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',   // 0-15
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',   // 16-31
+    0,0,'"',0,0,0,0,0,0,0,0,0,0,0,0,'/',     // 32-47    '"', '/'
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,'\\',0,0,0,    // 80-95    '\\'
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,    // 128-255
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
 
 /** Convert a string to valid json string using escapes where appropriate
-*   Return - # bytes written or -1 on error (overflow)
-*   Remark: UTF-8 encoding only allowed for input strings
+*   Input: inlen - # bytes of the string (json_node.str_len\key_len), 0 - it is null terminated:
+*       empty or not, its length is not known
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*   Remark: UTF-8 encoding only allowed for input strings. The runs of bytes
+*       without escapes are found by find_escape() (SSE2\AVX2 if available)
+*       and copied at once
 */
-static int print_str(const char* in, char* out, int maxlen)
-{
-    int j = 0, rlen;
-    if((!in)||(!out)) return -1;
-    int len = astrlen(in);
-    rlen = maxlen - len - 2;
-    if (rlen < 0) return -1;
-    out[j++] = '"';
-    for (int i = 0; i < len; i++){
-        char ch = in[i];
-        switch (ch) {
-            case '\\':
-            case '"':
-            case '/':
-            case '\b':
-            case '\t':
-            case '\n':
-            case '\f':
-            case '\r':
-                if(--rlen < 0) return -1;
-                out[j++] = '\\';
-                out[j++] = ch;
-                break;
-            default:
-                if((ch >= 0)&&(ch <= 0x1f)){
-                    rlen -= 5;
-                    if(rlen < 0) return -1;
-                    out[j++] = '\\';
-                    out[j++] = 'u';
-                    out[j++] = '0';
-                    out[j++] = '0';
-                    out[j++] = hex_val[(ch>>4)&0xf];
-                    out[j++] = hex_val[ch&0xf];
-                }
-                else{
-                    out[j++] = ch;;
-                }
-                break;
+static int print_str(json_writer* w, const char* in, size_t inlen)
+{
+    size_t len;
+    int slash = !w->no_escape_slash;
+    if(!in){
+        JSON_WRITER_ERROR("string is missing");
+        w->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    /* strlen() stops at the terminator: astrlen() reads whole words and may pass the end
+    of the buffer (a string parsed in place, a literal) */
+    len = inlen ? inlen : strlen(in);
+    if(!wr_char(w, '"')) return 0;
+    while(len){
+        ptrdiff_t run = find_escape(in, len, slash);
+        size_t n = (run < 0) ? len : (size_t)run;
+        if((n)&&(!wr_put(w, in, n))) return 0;
+        if(run < 0) break;
+        unsigned char ch = (unsigned char)in[n];
+        char esc = json_escape[ch];
+        char* out;
+        if(esc == 'u'){
+            if(!(out = wr_room(w, 6))) return 0;
+            *out++ = '\\';
+            *out++ = 'u';
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex_val[(ch>>4)&0xf];
+            *out = hex_val[ch&0xf];
+            w->pos += 6;
+        }
+        else{
+            if(!(out = wr_room(w, 2))) return 0;
+            *out++ = '\\';
+            *out = esc;
+            w->pos += 2;
         }
+        in += n + 1;
+        len -= n + 1;
     }
-    out[j++] = '"';
-    return j;
+    return wr_char(w, '"');
 }
 
-/** Output JSON value into preallocated buffer - not formatted
-*   Return: # bytes written
+/** Output a value which is not a container
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
 */
-static int print_value(json_ctx* ctx, json_node* nd, char* buf, int rlen)
+static int print_scalar(json_writer* w, json_node* nd)
 {
-    int rc, len = rlen;
+    char tmp[JSON_NUM_MAX];
+    char* out;
+    int rc;
     switch(nd->type){
         case JSON_DUMMY:
-            if(len < 4) goto ERR_OVFL1;
-            *buf++ = 'n';
-            *buf++ = 'u';
-            *buf++ = 'l';
-            *buf = 'l';
-            len -= 4;
-            break;
+            return wr_put(w, "null", 4);
         case JSON_STRING:
-            rc = print_str(nd->val.string_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-            break;
+            return print_str(w, nd->val.string_value, nd->str_len);
         case JSON_INTEGER:
-            rc = itoa_aux(nd->val.integer_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-            break;
         case JSON_DOUBLE:
-            rc = dtoa_aux(nd->val.double_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-            break;
-        case JSON_BOOL:
-            if(nd->val.bool_value){
-                if(len < 4) goto ERR_OVFL1;
-                *buf++ = 't';
-                *buf++ = 'r';
-                *buf++ = 'u';
-                *buf = 'e';
-                len -= 4;
-            }
-            else{
-                if(len < 5) goto ERR_OVFL1;
-                *buf++ = 'f';
-                *buf++ = 'a';
-                *buf++ = 'l';
-                *buf++ = 's';
-                *buf = 'e';
-                len -= 5;
-            }
-            break;
-        case JSON_ARRAY:
-            if(len < 2) goto ERR_OVFL1;
-            *buf++ = '[';
-            len--;
-            nd = nd->first_child;
-            if(!nd){
-                if(len < 1) goto ERR_OVFL1;
-                *buf = ']';
-                len--;
-                break;
-            }
-            rc = print_value(ctx, nd, buf, len);
-            len -= rc;
-            if((len < 1)||(rc < 0)) goto ERR_OVFL1;
-            buf += rc;
-            nd = nd->next;
-            while(nd){
-                *buf++ = ',';
-                len--;
-                rc = print_value(ctx, nd, buf, len);
-                len -= rc;
-                if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-                buf += rc;
-                nd = nd->next;
-            }
-            *buf = ']';
-            len--;
-            break;
-        case JSON_OBJECT:
-            if(len < 2) goto ERR_OVFL1;
-            *buf++ = '{';
-            len--;
-            nd = nd->first_child;
-            if(!nd){
-                if(len < 1) goto ERR_OVFL1;
-                *buf = '}';
-                len--;
-                break;
-            }
-            if(!nd->key){
-                /* there must be a key in non empty object */
-                JSON_SHOW_ERROR("string is missing in non empty JSON object type");
-                ctx->err = ERR_JSON_NOSTRING;
-                return -1;
-            }
-            rc = print_str(nd->key, buf, len);
-            len -= (rc + 1);
-            if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-            buf += rc;
-            *buf++ = ':';
-            rc = print_value(ctx, nd, buf, len);
-            len -= rc;
-            if(len < 1) goto ERR_OVFL1;
-            buf += rc;
-            nd = nd->next;
-            while(nd){
-                *buf++ = ',';
-                len--;
-                rc = print_str(nd->key, buf, len);
-                len -= (rc + 1);
-                if((len < 0)||(rc < 0)) goto ERR_OVFL1;
-                buf += rc;
-                *buf++ = ':';
-                rc = print_value(ctx, nd, buf, len);
-                len -= rc;
-                if((len < 1)||(rc < 0)) goto ERR_OVFL1;
-                buf += rc;
-                nd = nd->next;
+            /* straight into the buffer if there's room, the number is copied otherwise */
+            out = (w->size - w->pos >= JSON_NUM_MAX) ? w->buf + w->pos : tmp;
+            if(nd->type == JSON_INTEGER)
+                rc = itoa_aux(nd->val.integer_value, out, JSON_NUM_MAX);
+            else
+                rc = dtoa_aux(nd->val.double_value, out, JSON_NUM_MAX);
+            if(rc < 0){
+                JSON_WRITER_ERROR("the number can't be serialized (Inf or NaN)");
+                w->err = ERR_JSON_NUMBER;
+                return 0;
             }
-            *buf = '}';
-            len--;
-            break;
+            if(out == tmp) return wr_put(w, tmp, rc);
+            w->pos += rc;
+            return ~0;
+        case JSON_NUMBER_RAW:
+            /* the digits as they were parsed */
+            return wr_put(w, nd->val.string_value, nd->str_len);
+        case JSON_BOOL:
+            if(nd->val.bool_value) return wr_put(w, "true", 4);
+            return wr_put(w, "false", 5);
         default:
-            JSON_SHOW_ERROR("unexpected value type");
-            ctx->err = ERR_JSON_TYPE;
-            return -1;
+            JSON_WRITER_ERROR("unexpected value type");
+            w->err = ERR_JSON_TYPE;
+            return 0;
     }
-    return rlen - len;
-ERR_OVFL1:
-    JSON_SHOW_ERROR("output buffer max length exceeded");
-    ctx->err = ERR_JSON_OVERFLOW;
-    return -1;
 }
 
+/* Serializer state, one per call - nothing is kept in the tree or in a context,
+*   so trees (even the same one) may be serialized by many threads at once */
+typedef struct json_printer{
+    json_writer*    w;          /* the output */
+    json_node*      top;        /* the node serialized */
+    int             compact;    /* not 0 - not formatted */
+    int             depth;      /* formatted: # containers open on their own lines, the indentation depth */
+    int             expand;     /* not 0 - the arrays break the lines as the objects do */
+    size_t          nl_len;     /* # bytes of the line break */
+    size_t          unit;       /* # bytes of the indentation per level */
+    char            indent[JSON_INDENT_BUF];    /* the line break and the indentation after it */
+} json_printer;
+
+static const json_format json_format_default = {0, 0, 0};
+
+/** Set up the printer: the table of the line break and the indentation is filled once */
+static void print_init(json_printer* p, json_writer* w, json_node* top, int compact, const json_format* fmt)
+{
+    p->w = w;
+    p->top = top;
+    p->compact = compact;
+    p->depth = 0;
+    if(compact) return;
+    if(!fmt) fmt = &json_format_default;
+    p->expand = fmt->expand_arrays;
+    p->nl_len = fmt->lf ? 1 : 2;
+    p->unit = (fmt->indent > 0) ? (size_t)fmt->indent : 1;
+    if(fmt->lf){
+        p->indent[0] = _LF_;
+    }
+    else{
+        p->indent[0] = _CR_;
+        p->indent[1] = _LF_;
+    }
+    memset(p->indent + p->nl_len, (fmt->indent > 0) ? ' ' : _TAB_, JSON_INDENT_BUF - p->nl_len);
+}
+
+/** Write a line break and depth levels of indentation
+*   Remark: a single copy from the table unless the indentation is deeper than it
+*/
+static int print_newline(json_printer* p, int depth)
+{
+    json_writer* w = p->w;
+    size_t n = p->nl_len + (size_t)depth * p->unit;
+    size_t len;
+    if((n <= JSON_INDENT_BUF)&&(w->size - w->pos >= n)){
+        char* out = w->buf + w->pos;
+        /* short lines: two copies of a fixed size (a move each) which overlap in the middle,
+        *   nothing is written past n - the output may overwrite the parsed buffer in place */
+        if(n > 16){
+            memcpy(out, p->indent, n);
+        }
+        else if(n >= 8){
+            memcpy(out, p->indent, 8);
+            memcpy(out + n - 8, p->indent + n - 8, 8);
+        }
+        else if(n >= 4){
+            memcpy(out, p->indent, 4);
+            memcpy(out + n - 4, p->indent + n - 4, 4);
+        }
+        else{
+            for(size_t i = 0; i < n; i++) out[i] = p->indent[i];
+        }
+        w->pos += n;
+        return ~0;
+    }
+    len = (n < JSON_INDENT_BUF) ? n : JSON_INDENT_BUF;
+    if(!wr_put(w, p->indent, len)) return 0;
+    /* the rest of the indentation, the table holds nothing else after 2 bytes */
+    for(n -= len; n; n -= len){
+        len = (n < JSON_INDENT_BUF - 2) ? n : JSON_INDENT_BUF - 2;
+        if(!wr_put(w, p->indent + 2, len)) return 0;
+    }
+    return ~0;
+}
+
+/* formatted: a container which puts its values on their own lines */
+#define PRINT_BREAKS(p, nd) ((!(p)->compact)&&(((nd)->type == JSON_OBJECT)||((p)->expand)))
+
+/** Output the separator and the key which precede a value (nothing for the top one)
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*/
+static int print_member(json_printer* p, json_node* nd)
+{
+    json_writer* w = p->w;
+    char* out;
+    if(nd == p->top) return ~0;
+    if(nd != nd->parent->first_child){
+        if(!wr_char(w, ',')) return 0;
+        if((PRINT_BREAKS(p, nd->parent))&&(!print_newline(p, p->depth - 1))) return 0;
+    }
+    if(nd->parent->type != JSON_OBJECT) return ~0;
+    if(!nd->key){
+        /* there must be a key in non empty object */
+        JSON_WRITER_ERROR("string is missing in non empty JSON object type");
+        w->err = ERR_JSON_NOSTRING;
+        return 0;
+    }
+    if(!print_str(w, nd->key, nd->key_len)) return 0;
+    if(p->compact) return wr_char(w, ':');
+    if(!(out = wr_room(w, 2))) return 0;
+    *out++ = ':';
+    *out = ' ';
+    w->pos += 2;
+    return ~0;
+}
+
+/** Output the opening bracket of a container
+*   Remark: formatted - an object breaks the lines, an array is kept on the line
+*       unless json_format.expand_arrays is set
+*/
+static int print_open(json_printer* p, json_node* nd)
+{
+    char bracket = (nd->type == JSON_ARRAY) ? '[' : '{';
+    if(!PRINT_BREAKS(p, nd)) return wr_char(p->w, bracket);
+    /* a value of an array kept on a line starts on a new line */
+    if((p->depth > 0)&&(!PRINT_BREAKS(p, nd->parent))&&(!print_newline(p, p->depth))) return 0;
+    if((!wr_char(p->w, bracket))||(!print_newline(p, p->depth))) return 0;
+    p->depth++;
+    return ~0;
+}
+
+/** Output the closing bracket of a container */
+static int print_close(json_printer* p, json_node* nd)
+{
+    char bracket = (nd->type == JSON_ARRAY) ? ']' : '}';
+    if(PRINT_BREAKS(p, nd)){
+        p->depth--;
+        if((nd->first_child)&&(!print_newline(p, p->depth))) return 0;
+    }
+    return wr_char(p->w, bracket);
+}
+
+/** Output JSON value, formatted (as fmt tells, NULL - the default format) or not
+*   Return: ~0 - success, 0 - an error occurred (w->err is set)
+*   Remark: no recursion - the tree keeps the path back up (the parent links),
+*       so the depth of the tree is not limited by the stack
+*/
+static int print_tree(json_writer* w, json_node* top, int compact, const json_format* fmt)
+{
+    json_printer p;
+    json_node* nd = top;
+    print_init(&p, w, top, compact, fmt);
+    for(;;){
+        if(!print_member(&p, nd)) return 0;
+        if((nd->type == JSON_ARRAY)||(nd->type == JSON_OBJECT)){
+            if(!print_open(&p, nd)) return 0;
+            if(nd->first_child){
+                nd = nd->first_child;
+                continue;
+            }
+            if(!print_close(&p, nd)) return 0;
+        }
+        else if(!print_scalar(w, nd)) return 0;
+        /* the containers whose last value is written are closed on the way up */
+        while((nd != top)&&(!nd->next)){
+            nd = nd->parent;
+            if(!print_close(&p, nd)) return 0;
+        }
+        if(nd == top) return ~0;
+        nd = nd->next;
+    }
+}
+
+/** # bytes print_str() writes for a string (the quotes included)
+*   Input: slash - not 0 if '/' is escaped
+*   Remark: the runs without escapes are skipped by find_escape() as print_str() does
+*/
+static size_t size_str(const char* in, size_t inlen, int slash)
+{
+    size_t len = inlen ? inlen : strlen(in);
+    size_t size = len + 2;
+    ptrdiff_t run;
+    while((len)&&((run = find_escape(in, len, slash)) >= 0)){
+        /* \u00XX or a backslash and a character */
+        size += (json_escape[(unsigned char)in[run]] == 'u') ? 5 : 1;
+        in += run + 1;
+        len -= run + 1;
+    }
+    return size;
+}
+
+/** # decimal digits of an integer itoa_aux() writes (the sign included) */
+static __inline int size_integer(long long n)
+{
+    unsigned long long u = (unsigned long long)n;
+    int size = 1;
+    if(n < 0){
+        u = 0ULL - u;
+        size++;
+    }
+    for(unsigned long long p = 10; u >= p; p *= 10){
+        size++;
+        /* 10^19 is the last power of 10 below 2^64 */
+        if(p == 10000000000000000000ULL) break;
+    }
+    return size;
+}
 
-/** Output JSON container (array or object) to the preallocated buffer - formatted */
-static int print_value_fmt(json_ctx* ctx, json_node* nd, char* buf, int rlen)
+/** # bytes print_scalar() writes for a value which is not a container, -1 if it can't be written
+*   Input: slash - not 0 if '/' is escaped
+*/
+static ptrdiff_t size_scalar(json_node* nd, int slash)
 {
-    int len = rlen;
-    int rc, i;
+    char tmp[JSON_NUM_MAX];
     switch(nd->type){
         case JSON_DUMMY:
-            if(len < 4) goto ERR_OVFL;
-            *buf++ = 'n';
-            *buf++ = 'u';
-            *buf++ = 'l';
-            *buf = 'l';
-            len -= 4;
-            break;
+            return 4;
         case JSON_STRING:
-            rc = print_str(nd->val.string_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            break;
+            if(!nd->val.string_value) return -1;
+            return (ptrdiff_t)size_str(nd->val.string_value, nd->str_len, slash);
         case JSON_INTEGER:
-            rc = itoa_aux(nd->val.integer_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            break;
+            return size_integer(nd->val.integer_value);
         case JSON_DOUBLE:
-            rc = dtoa_aux(nd->val.double_value, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            break;
+            /* the shortest form is found by the conversion itself */
+            return dtoa_aux(nd->val.double_value, tmp, JSON_NUM_MAX);
+        case JSON_NUMBER_RAW:
+            return (ptrdiff_t)nd->str_len;
         case JSON_BOOL:
-            if(nd->val.bool_value){
-                if(len < 4) goto ERR_OVFL;
-                *buf++ = 't';
-                *buf++ = 'r';
-                *buf++ = 'u';
-                *buf = 'e';
-                len -= 4;
-            }
-            else{
-                if(len < 5) goto ERR_OVFL;
-                *buf++ = 'f';
-                *buf++ = 'a';
-                *buf++ = 'l';
-                *buf++ = 's';
-                *buf = 'e';
-                len -= 5;
-            }
-            break;
-        case JSON_ARRAY:
-            if(len < 2) goto ERR_OVFL;
-            *buf++ = '[';
-            len--;
-            nd = nd->first_child;
-            if(!nd){
-                if(len < 1) goto ERR_OVFL;
-                *buf = ']';
-                len--;
-                break;
-            }
-            rc = print_value_fmt(ctx, nd, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            buf += rc;
-            nd = nd->next;
-            while(nd){
-                len--;
-                if(len < 1) goto ERR_OVFL;
-                *buf++ = ',';
-                rc = print_value_fmt(ctx, nd, buf, len);
-                len -= rc;
-                if((len < 0)||(rc < 0)) goto ERR_OVFL;
-                buf += rc;
-                nd = nd->next;
-            }
-            *buf = ']';
-            len--;
-            break;
-        case JSON_OBJECT:
-            if(ctx->ndepth <= 0){
-                len -= 3;
-                if(len < 1) goto ERR_OVFL;
-                *buf++ = '{';
-                *buf++ = _CR_;
-                *buf++ = _LF_;
-            }
-            else if(*(buf - 1) == _SP_){
-                len -= 3 + ctx->ndepth;
-                if(len < 1) goto ERR_OVFL;
-                *buf++ = '{';
-                *buf++ = _CR_;
-                *buf++ = _LF_;
-                for(i = 0; i < ctx->ndepth; i++)
-                    *buf++ = _TAB_;
-            }
-            else{
-                len -= (5 + (ctx->ndepth)*2);
-                if(len < 1) goto ERR_OVFL;
-                *buf++ = _CR_;
-                *buf++ = _LF_;
-                for(i = 0; i < ctx->ndepth; i++)
-                    *buf++ = _TAB_;
-                *buf++ = '{';
-                *buf++ = _CR_;
-                *buf++ = _LF_;
-                for(i = 0; i < ctx->ndepth; i++)
-                    *buf++ = _TAB_;
-            }
-            ctx->ndepth++;
-            nd = nd->first_child;
-            if(!nd){
-                *buf = '}';
-                ctx->ndepth--;
-                len--;
-                break;
+            return nd->val.bool_value ? 4 : 5;
+        default:
+            return -1;
+    }
+}
+
+/** # bytes print_tree() writes for a value, -1 on error
+*   Input: slash - not 0 if '/' is escaped (see json_writer.no_escape_slash)
+*   Remark: the same walk as print_tree(), the brackets are counted when a container is opened
+*/
+static ptrdiff_t size_tree(json_node* top, int compact, const json_format* fmt, int slash)
+{
+    json_printer p;
+    json_node* nd = top;
+    ptrdiff_t rc, size = 0;
+    /* only the layout of the printer is used, nothing is written */
+    print_init(&p, NULL, top, compact, fmt);
+    for(;;){
+        /* see print_member() */
+        if(nd != top){
+            if(nd != nd->parent->first_child)
+                size += PRINT_BREAKS(&p, nd->parent) ? 1 + p.nl_len + (p.depth - 1) * p.unit : 1;
+            if(nd->parent->type == JSON_OBJECT){
+                if(!nd->key) return -1;
+                size += (ptrdiff_t)size_str(nd->key, nd->key_len, slash) + (compact ? 1 : 2);
             }
-            if(!nd->key){
-                /* there must be a key in non empty object */
-                JSON_SHOW_ERROR("string is missing in non empty JSON object type");
-                ctx->err = ERR_JSON_NOSTRING;
-                return -1;
+        }
+        if((nd->type == JSON_ARRAY)||(nd->type == JSON_OBJECT)){
+            size += 2;
+            if(PRINT_BREAKS(&p, nd)){
+                /* see print_open() and print_close(): the line breaks */
+                if((p.depth > 0)&&(!PRINT_BREAKS(&p, nd->parent))) size += p.nl_len + p.depth * p.unit;
+                size += p.nl_len + p.depth * p.unit;
+                if(nd->first_child) size += p.nl_len + p.depth * p.unit;
+                p.depth++;
             }
-            /* print the key */
-            rc = print_str(nd->key, buf, len);
-            len -= (rc + 2);
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            buf += rc;
-            *buf++ = ':';
-            *buf++ = _SP_;
-            rc = print_value_fmt(ctx, nd, buf, len);
-            len -= rc;
-            if((len < 0)||(rc < 0)) goto ERR_OVFL;
-            buf += rc;
-            nd = nd->next;
-            while(nd){
-                len -= (3 + (ctx->ndepth - 1));
-                if(len < 1) goto ERR_OVFL;
-                *buf++ = ',';
-                *buf++ = _CR_;
-                *buf++ = _LF_;
-                for(i = 0; i < (ctx->ndepth - 1); i++)
-                    *buf++ = _TAB_;
-                rc = print_str(nd->key, buf, len);
-                len -= (rc + 2);
-                if((len < 0)||(rc < 0)) goto ERR_OVFL;
-                buf += rc;
-                *buf++ = ':';
-                *buf++ = _SP_;
-                rc = print_value_fmt(ctx, nd, buf, len);
-                len -= rc;
-                if((len < 0)||(rc < 0)) goto ERR_OVFL;
-                buf += rc;
-                nd = nd->next;
+            if(nd->first_child){
+                nd = nd->first_child;
+                continue;
             }
-            ctx->ndepth--;
-            len -= (3 + ctx->ndepth);
-            if(len < 1) goto ERR_OVFL;
-            *buf++ = _CR_;
-            *buf++ = _LF_;
-            for(i = 0; i < ctx->ndepth; i++)
-                *buf++ = _TAB_;
-            *buf++ = '}';
-            break;
-        default:
-            JSON_SHOW_ERROR("unexpected value type");
-            ctx->err = ERR_JSON_TYPE;
-            return -1;
+            if(PRINT_BREAKS(&p, nd)) p.depth--;
+        }
+        else{
+            if((rc = size_scalar(nd, slash)) < 0) return -1;
+            size += rc;
+        }
+        while((nd != top)&&(!nd->next)){
+            nd = nd->parent;
+            if(PRINT_BREAKS(&p, nd)) p.depth--;
+        }
+        if(nd == top) return size;
+        nd = nd->next;
     }
-    return rlen - len;
-ERR_OVFL:
-    JSON_SHOW_ERROR("output buffer max length exceeded");
-    ctx->err = ERR_JSON_OVERFLOW;
-    return -1;
 }
 
+ptrdiff_t json_serialized_size(json_node* nd, int compact)
+{
+    if(!nd){
+        fprintf(stderr, "Nothing to serialize\n");
+        return -1;
+    }
+    ptrdiff_t size = size_tree(nd, compact, NULL, ~0);
+#ifdef JSON_ON_DEBUG
+    if(size < 0) fprintf(stderr, "json_serialized_size() failed: a node can't be serialized\n");
+#endif // JSON_ON_DEBUG
+    return size;
+}
+
+ptrdiff_t json_serialized_size_fmt(json_node* nd, const json_format* fmt)
+{
+    if(!nd){
+        fprintf(stderr, "Nothing to serialize\n");
+        return -1;
+    }
+    ptrdiff_t size = size_tree(nd, 0, fmt, ~0);
+#ifdef JSON_ON_DEBUG
+    if(size < 0) fprintf(stderr, "json_serialized_size_fmt() failed: a node can't be serialized\n");
+#endif // JSON_ON_DEBUG
+    return size;
+}
+
+ptrdiff_t json_write_size(const json_writer* w, json_node* nd, int compact)
+{
+    if((!w)||(!nd)){
+        fprintf(stderr, "Nothing to serialize\n");
+        return -1;
+    }
+    ptrdiff_t size = size_tree(nd, compact, w->format, !w->no_escape_slash);
+#ifdef JSON_ON_DEBUG
+    if(size < 0) fprintf(stderr, "json_write_size() failed: a node can't be serialized\n");
+#endif // JSON_ON_DEBUG
+    return size;
+}
 
-int json_to_string(json_node* nd, char* buf, int outlen, int compact)
+/** json_to_string() and json_to_string_fmt() */
+static ptrdiff_t json_to_buffer(json_node* nd, char* buf, size_t outlen, int compact, const json_format* fmt)
 {
-    int rc = 0;
-    json_node* root = nd;
+    json_writer w;
+    int rc;
 	if(!nd){
         fprintf(stderr, "Nothing to serialize\n");
         return -1;
 	}
-    /* get json_ctx pointer */
-	while(root->parent) root = root->parent;
-    json_ctx* ctx = (json_ctx*)root;
+    if((!buf)||(!outlen)){
+        fprintf(stderr, "json_to_string() failed: no room in the output buffer\n");
+        return -1;
+    }
+    if(outlen > PTRDIFF_MAX) outlen = PTRDIFF_MAX;
+    /* the buffer can't grow, the last byte is kept for the null terminator */
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.size = outlen - 1;
     if(compact){
-        rc = print_value(ctx, nd, buf, outlen);
+        rc = print_tree(&w, nd, ~0, NULL);
     }
     else{
         /* output formatted string */
-        ctx->ndepth = 0;
-        rc = print_value_fmt(ctx, nd, buf, outlen);
+        rc = print_tree(&w, nd, 0, fmt);
     }
-    if((rc < 0)||((outlen - rc) < 1)){
-        JSON_SHOW_ERROR("output buffer max length exceeded");
-        ctx->err = ERR_JSON_OVERFLOW;
+    buf[w.pos] = '\0';
+    if(!rc) return -1;
+    return (ptrdiff_t)w.pos;
+}
+
+ptrdiff_t json_to_string(json_node* nd, char* buf, size_t outlen, int compact)
+{
+    return json_to_buffer(nd, buf, outlen, compact, NULL);
+}
+
+ptrdiff_t json_to_string_fmt(json_node* nd, char* buf, size_t outlen, const json_format* fmt)
+{
+    return json_to_buffer(nd, buf, outlen, 0, fmt);
+}
+
+static int json_flush_file(void* user, const char* data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE*)user) == len;
+}
+
+static int json_flush_fd(void* user, const char* data, size_t len)
+{
+#ifdef JSON_USE_FD
+    int fd = (int)(intptr_t)user;
+    while(len){
+        /* the pipes and the sockets may take less */
+#ifdef _WIN32
+        int rc = _write(fd, data, (len > INT_MAX) ? INT_MAX : (unsigned)len);
+#else
+        ssize_t rc = write(fd, data, (len > SSIZE_MAX) ? SSIZE_MAX : len);
+        if((rc < 0)&&(errno == EINTR)) continue;
+#endif // _WIN32
+        if(rc <= 0) return 0;
+        data += rc;
+        len -= (size_t)rc;
+    }
+    return ~0;
+#else
+    (void)user; (void)data; (void)len;
+    return 0;
+#endif // JSON_USE_FD
+}
+
+/** Allocate the buffer of a writer */
+static int json_writer_alloc(json_writer* w, size_t size)
+{
+    if(!(w->buf = malloc(size))){
+        fprintf(stderr, "json_writer() failed: memory allocation error\n");
+        w->err = ERR_JSON_MEMALLOC;
+        return 0;
+    }
+    w->size = size;
+    w->owned = ~0;
+    return ~0;
+}
+
+int json_writer_buffer(json_writer* w, size_t size)
+{
+    if(!w) return 0;
+    memset(w, 0, sizeof(json_writer));
+    if(size < JSON_WRITER_MIN) size = JSON_WRITER_MIN;
+    if(!json_writer_alloc(w, size)) return 0;
+    /* room for the null terminator */
+    w->size--;
+    w->buf[0] = '\0';
+    return ~0;
+}
+
+int json_writer_file(json_writer* w, FILE* fp)
+{
+    if(!w) return 0;
+    memset(w, 0, sizeof(json_writer));
+    if(!fp){
+        w->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    w->flush = json_flush_file;
+    w->user = fp;
+    return json_writer_alloc(w, JSON_WRITER_STAGE);
+}
+
+int json_writer_fd(json_writer* w, int fd)
+{
+    if(!w) return 0;
+    memset(w, 0, sizeof(json_writer));
+#ifdef JSON_USE_FD
+    if(fd < 0){
+        w->err = ERR_JSON_FILE;
+        return 0;
+    }
+    w->flush = json_flush_fd;
+    w->user = (void*)(intptr_t)fd;
+    return json_writer_alloc(w, JSON_WRITER_STAGE);
+#else
+    (void)fd;
+    w->err = ERR_JSON_FILE;
+    return 0;
+#endif // JSON_USE_FD
+}
+
+int json_writer_callback(json_writer* w, int (*flush)(void* user, const char* data, size_t len),
+                         void* user, char* stage, size_t size)
+{
+    if(!w) return 0;
+    memset(w, 0, sizeof(json_writer));
+    if(!flush){
+        w->err = ERR_JSON_NULLPTR;
+        return 0;
+    }
+    w->flush = flush;
+    w->user = user;
+    if(!stage) return json_writer_alloc(w, (size < JSON_WRITER_MIN) ? JSON_WRITER_STAGE : size);
+    if(size < JSON_WRITER_MIN){
+        fprintf(stderr, "json_writer_callback() failed: the staging buffer is too small\n");
+        w->err = ERR_JSON_OVERFLOW;
+        return 0;
+    }
+    w->buf = stage;
+    w->size = size;
+    return ~0;
+}
+
+ptrdiff_t json_write(json_writer* w, json_node* nd, int compact)
+{
+    size_t start;
+    int rc;
+    if((!w)||(!w->buf)||(w->err)) return -1;
+    if(!nd){
+        w->err = ERR_JSON_NULLPTR;
         return -1;
     }
-    buf[rc] = '\0';
-    return rc;
+    start = w->total + w->pos;
+    rc = print_tree(w, nd, compact, w->format);
+    if(!w->flush) w->buf[w->pos] = '\0';
+    if(!rc) return -1;
+    return (ptrdiff_t)(w->total + w->pos - start);
+}
+
+int json_writer_put(json_writer* w, const char* data, size_t len)
+{
+    if((!w)||(!w->buf)||(w->err)) return 0;
+    if(!wr_put(w, data, len)) return 0;
+    if(!w->flush) w->buf[w->pos] = '\0';
+    return ~0;
+}
+
+int json_writer_flush(json_writer* w)
+{
+    if((!w)||(!w->buf)||(w->err)) return 0;
+    if(!w->flush) return ~0;
+    if(!wr_flush(w)) return 0;
+    if(w->flush == json_flush_file) return !fflush((FILE*)w->user);
+    return ~0;
 }
 
+int json_writer_close(json_writer* w)
+{
+    int rc;
+    if(!w) return 0;
+    rc = (w->err) ? 0 : json_writer_flush(w);
+    if(w->owned) free(w->buf);
+    w->buf = NULL;
+    w->pos = w->size = 0;
+    w->owned = 0;
+    return rc;
+}
@@ -0,0 +1,950 @@
+#include "json_clib.h"
+#include <string.h>
+
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif // _WIN32
+
+/** monotonic clock in microseconds - used for running time comparative testing */
+static double bench_usec(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (double)cnt.QuadPart * 1.0e6 / (double)freq.QuadPart;
+#else
+    struct timespec tspec;
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * 1.0e6 + tspec.tv_nsec / 1.0e3;
+#endif // _WIN32
+}
+
+/** Build a flat array of nelem numbers: [0,1,2,...] */
+static int make_wide_array(char* buf, int buflen, int nelem)
+{
+    int pos = 0, rc;
+    buf[pos++] = '[';
+    for(int i = 0; i < nelem; i++){
+        if(i) buf[pos++] = ',';
+        rc = itoa_aux(i, buf + pos, buflen - pos - 2);
+        if(rc < 0) return -1;
+        pos += rc;
+    }
+    buf[pos++] = ']';
+    return pos;
+}
+
+/** Parse time must grow linearly with the width of an array:
+*   time per element should stay flat as the number of elements doubles
+*/
+static void bench_wide_array(void)
+{
+    const int maxelem = 512000;
+    const int buflen = maxelem * 8 + 16;
+    char* src = malloc(buflen);
+    char* buf = malloc(buflen);
+    if((!src)||(!buf)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("...Parsing wide arrays - json_add_last() append cost\n");
+    printf("%10s %12s %14s\n", "elements", "parse, ms", "ns/element");
+    for(int nelem = 16000; nelem <= maxelem; nelem *= 2){
+        int len = make_wide_array(src, buflen, nelem);
+        int nruns = 0;
+        double start, total = 0.0;
+        if(len < 0){
+            printf("make_wide_array() failed\n");
+            exit(1);
+        }
+        while((total < 200000.0)||(nruns < 3)){
+            memcpy(buf, src, len);
+            json_ctx* ctx = json_init();
+            if(!ctx){
+                printf("json_init() failed\n");
+                exit(1);
+            }
+            start = bench_usec();
+            if(!json_parse(ctx, buf, len, 0)){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            total += bench_usec() - start;
+            nruns++;
+            json_destroy(ctx);
+        }
+        total /= nruns;
+        printf("%10d %12.3f %14.2f\n", nelem, total / 1.0e3, total * 1.0e3 / nelem);
+    }
+    free(src);
+    free(buf);
+}
+
+/** String heavy payload: log records with URLs and user agents,
+*   every 4th record has escapes in its message
+*   Return: # bytes written to buf
+*/
+static int make_log_records(char* buf, int nrec)
+{
+    int len = 0;
+    buf[len++] = '[';
+    for(int i = 0; i < nrec; i++){
+        len += sprintf(buf + len, "%s{\"url\":\"https://www.example.com/catalog/item/%d?ref=home&utm_source=news\","
+                       "\"agent\":\"Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0\","
+                       "\"msg\":\"%s\"}", i ? "," : "", i,
+                       (i % 4) ? "request served from the cache" : "path \\\"/tmp/x\\\" not found\\n\\tretrying");
+    }
+    buf[len++] = ']';
+    return len;
+}
+
+/** Parse time of the string heavy payload */
+static void bench_strings(void)
+{
+    const int nrec = 20000;
+    const int buflen = nrec * 320 + 16;
+    const int nruns = 20;
+    char* src = malloc(buflen);
+    char* buf = malloc(buflen);
+    int len;
+    if((!src)||(!buf)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    len = make_log_records(src, nrec);
+    json_ctx* ctx = json_init_arena(0);
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(1);
+    }
+    double start, total = 0.0;
+    for(int i = 0; i < nruns; i++){
+        memcpy(buf, src, len);
+        json_reset(ctx);
+        start = bench_usec();
+        if(!json_parse(ctx, buf, len, 0)){
+            printf("json_parse() failed, error code: %d\n", ctx->err);
+            exit(1);
+        }
+        total += bench_usec() - start;
+    }
+    json_destroy(ctx);
+    total /= nruns;
+    printf("\n...Parsing string heavy payload (%d bytes) - %.3f ms, %.1f MB/s\n", len, total / 1.0e3, len / total);
+    free(src);
+    free(buf);
+}
+
+/** Number heavy payload: coordinates with 17 significant digits,
+*   short prices and every 8th number longer than 19 digits
+*   Return: # bytes written to buf
+*/
+static int make_numbers(char* buf, int nelem)
+{
+    unsigned x = 12345;
+    int len = 0;
+    buf[len++] = '[';
+    for(int i = 0; i < nelem; i++){
+        x = x * 1103515245 + 12345;
+        if(i % 8 == 7)
+            len += sprintf(buf + len, "%s0.%u%u%u", i ? "," : "", x, x >> 3, x >> 7);
+        else if(i % 2)
+            len += sprintf(buf + len, "%s%u.%02u", i ? "," : "", x % 1000, x % 100);
+        else
+            len += sprintf(buf + len, "%s%.17g", i ? "," : "", (double)x / 7.0e7 - 30.0);
+    }
+    buf[len++] = ']';
+    return len;
+}
+
+/** Parse and serialize time of the number heavy payload, numbers converted vs raw */
+static void bench_numbers(void)
+{
+    const int nelem = 200000;
+    const int buflen = nelem * 40 + 16;
+    const int nruns = 20;
+    char* src = malloc(buflen);
+    char* buf = malloc(buflen);
+    char* out = malloc(buflen);
+    int len;
+    if((!src)||(!buf)||(!out)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    len = make_numbers(src, nelem);
+    printf("\n...Parsing and serializing number heavy payload (%d bytes) %d times\n", len, nruns);
+    printf("  numbers    parse, ms    print, ms\n");
+    for(int raw = 0; raw < 2; raw++){
+        json_ctx* ctx = json_init_arena(0);
+        if(!ctx){
+            printf("json_init() failed\n");
+            exit(1);
+        }
+        ctx->raw_numbers = raw;
+        double start, tparse = 0.0, tprint = 0.0;
+        for(int i = 0; i < nruns; i++){
+            memcpy(buf, src, len);
+            json_reset(ctx);
+            start = bench_usec();
+            json_node* root = json_parse(ctx, buf, len, 0);
+            if(!root){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            tparse += bench_usec() - start;
+            start = bench_usec();
+            if(json_to_string(root, out, buflen, 1) < 0){
+                printf("json_to_string() failed\n");
+                exit(1);
+            }
+            tprint += bench_usec() - start;
+        }
+        json_destroy(ctx);
+        printf("%9s %12.3f %12.3f\n", raw ? "raw" : "converted", tparse / nruns / 1.0e3, tprint / nruns / 1.0e3);
+    }
+    free(src);
+    free(buf);
+    free(out);
+}
+
+/** Load the whole file into a heap buffer
+*   Return: # bytes read, the buffer is returned in *buf
+*/
+static int load_file(const char* fname, char** buf)
+{
+    int length;
+    FILE* fl = fopen(fname, "rb");
+    if(!fl){
+        printf("File open error: %s\n", fname);
+        exit(1);
+    }
+    fseek(fl, 0, SEEK_END);
+    length = ftell(fl);
+    fseek(fl, 0, SEEK_SET);
+    *buf = malloc(length);
+    if(!*buf){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    if((int)fread(*buf, 1, length, fl) != length){
+        printf("Reading from file failed!\n");
+        exit(1);
+    }
+    fclose(fl);
+    return length;
+}
+
+/** Parse the same document with a context using calloc() per node
+*   and with a context in arena mode
+*/
+static void bench_arena(const char* fname)
+{
+    const int nruns = 20;
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    if(!buf){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("\n...Parsing %s (%d bytes) %d times - calloc() per node vs arena\n", fname, length, nruns);
+    printf("%8s %14s %12s %12s\n", "mode", "allocs/parse", "parse, ms", "destroy, ms");
+    for(int arena = 0; arena < 2; arena++){
+        double start, tparse = 0.0, tdestroy = 0.0;
+        int nallocs = 0;
+        for(int i = 0; i < nruns; i++){
+            memcpy(buf, src, length);
+            start = bench_usec();
+            json_ctx* ctx = arena ? json_init_arena(0) : json_init();
+            if(!ctx){
+                printf("json_init() failed\n");
+                exit(1);
+            }
+            if(!json_parse(ctx, buf, length, 0)){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            tparse += bench_usec() - start;
+            /* the context itself and then either every node or every slab */
+            nallocs = 1;
+            if(ctx->slab_size){
+                for(json_slab* slab = ctx->slabs; slab; slab = slab->next) nallocs++;
+            }
+            else nallocs += ctx->nused;
+            start = bench_usec();
+            json_destroy(ctx);
+            tdestroy += bench_usec() - start;
+        }
+        printf("%8s %14d %12.3f %12.3f\n", arena ? "arena" : "calloc", nallocs,
+               tparse / nruns / 1.0e3, tdestroy / nruns / 1.0e3);
+    }
+    /* one context for all documents - after the first parse no memory is allocated */
+    json_ctx* ctx = json_init_arena(0);
+    double start, tparse = 0.0;
+    int nslabs = 0, nallocs = 0;
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(1);
+    }
+    for(int i = 0; i <= nruns; i++){
+        memcpy(buf, src, length);
+        start = bench_usec();
+        json_reset(ctx);
+        if(!json_parse(ctx, buf, length, 0)){
+            printf("json_parse() failed, error code: %d\n", ctx->err);
+            exit(1);
+        }
+        /* the first (cold) run fills the arena */
+        if(i) tparse += bench_usec() - start;
+        /* count the slabs the warm runs have added */
+        int n = 0;
+        for(json_slab* slab = ctx->slabs; slab; slab = slab->next) n++;
+        for(json_slab* slab = ctx->spare_slabs; slab; slab = slab->next) n++;
+        if(i) nallocs += n - nslabs;
+        nslabs = n;
+    }
+    json_destroy(ctx);
+    printf("%8s %14d %12.3f %12s\n", "reset", nallocs / nruns, tparse / nruns / 1.0e3, "-");
+    free(src);
+    free(buf);
+}
+
+/** json_parse() vs json_parse_indexed() on the same document */
+static void bench_indexed(const char* fname)
+{
+    const int nruns = 20;
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("\n...Parsing %s (%d bytes) %d times - one stage vs two stages\n", fname, length, nruns);
+    printf("%8s %12s %12s\n", "parser", "parse, ms", "MB/s");
+    for(int indexed = 0; indexed < 2; indexed++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            memcpy(buf, src, length);
+            json_reset(ctx);
+            start = bench_usec();
+            json_node* root = indexed ? json_parse_indexed(ctx, buf, length, 0) : json_parse(ctx, buf, length, 0);
+            if(!root){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            /* the first run warms up the arena and the index */
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%8s %12.3f %12.1f\n", indexed ? "indexed" : "parse", total / 1.0e3, length / total);
+    }
+    json_destroy(ctx);
+    free(src);
+    free(buf);
+}
+
+/** json_parse() of the whole document vs json_parse_feed() of 4 KB pieces */
+static void bench_feed(const char* fname)
+{
+    const int nruns = 20;
+    const int step = 4096;
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("\n...Parsing %s (%d bytes) %d times - whole vs %d bytes pieces\n", fname, length, nruns, step);
+    printf("%8s %12s %12s\n", "parser", "parse, ms", "MB/s");
+    for(int feed = 0; feed < 2; feed++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            json_node* root = NULL;
+            memcpy(buf, src, length);
+            json_reset(ctx);
+            start = bench_usec();
+            if(feed){
+                for(int pos = 0; (pos < length)&&(!root); pos += step){
+                    root = json_parse_feed(ctx, buf + pos, (length - pos < step) ? length - pos : step, 0);
+                    if((!root)&&(ctx->err != ERR_JSON_INCOMPLETE)) break;
+                }
+            }
+            else root = json_parse(ctx, buf, length, 0);
+            if(!root){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%8s %12.3f %12.1f\n", feed ? "feed" : "parse", total / 1.0e3, length / total);
+    }
+    json_destroy(ctx);
+    free(src);
+    free(buf);
+}
+
+/** Count the values - the cheapest json_parse_sax() consumer */
+static int count_value(void* user)
+{
+    (*(int*)user)++;
+    return 1;
+}
+
+static int count_string(void* user, const char* str)
+{
+    (void)str;
+    return count_value(user);
+}
+
+static int count_integer(void* user, long long val)
+{
+    (void)val;
+    return count_value(user);
+}
+
+static int count_dbl(void* user, double val)
+{
+    (void)val;
+    return count_value(user);
+}
+
+static int count_boolean(void* user, int val)
+{
+    (void)val;
+    return count_value(user);
+}
+
+/** json_parse() vs json_parse_sax() on the same document */
+static void bench_sax(const char* fname)
+{
+    const int nruns = 20;
+    const json_sax counter = {count_value, NULL, count_value, NULL, NULL,
+                              count_string, count_integer, count_dbl, count_boolean, count_value};
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("\n...Parsing %s (%d bytes) %d times - tree vs callbacks\n", fname, length, nruns);
+    printf("%8s %12s %12s %10s\n", "parser", "parse, ms", "MB/s", "values");
+    for(int sax = 0; sax < 2; sax++){
+        double start, total = 0.0;
+        int nvalues = 0;
+        for(int i = 0; i <= nruns; i++){
+            int ok;
+            memcpy(buf, src, length);
+            json_reset(ctx);
+            nvalues = 0;
+            start = bench_usec();
+            if(sax) ok = json_parse_sax(ctx, buf, length, 0, &counter, &nvalues);
+            else{
+                ok = (json_parse(ctx, buf, length, 0) != NULL);
+                nvalues = ctx->nused;
+            }
+            if(!ok){
+                printf("json_parse() failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%8s %12.3f %12.1f %10d\n", sax ? "sax" : "parse", total / 1.0e3, length / total, nvalues);
+    }
+    json_destroy(ctx);
+    free(src);
+    free(buf);
+}
+
+/** json_parse() of the whole document vs json_ondemand() reading the name of the last feature */
+static void bench_ondemand(const char* fname)
+{
+    const int nruns = 20;
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    printf("\n...Reading one field of %s (%d bytes) %d times - tree vs cursor\n", fname, length, nruns);
+    printf("%8s %12s %12s\n", "parser", "read, ms", "MB/s");
+    for(int ondemand = 0; ondemand < 2; ondemand++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            json_node* name = NULL;
+            memcpy(buf, src, length);
+            json_reset(ctx);
+            start = bench_usec();
+            if(ondemand){
+                json_cursor root, cur, el;
+                if(json_ondemand(ctx, buf, length, 0, &root)&&json_cursor_get(&root, "features", &cur)){
+                    int found = json_cursor_element(&cur, 0, &el);
+                    /* walk to the last element */
+                    while((found)&&(json_cursor_next(&el)));
+                    if((found)&&(ctx->err == ERR_JSON_OK)&&json_cursor_get(&el, "properties", &el)&&
+                       json_cursor_get(&el, "name", &el)){
+                        name = json_cursor_value(&el);
+                    }
+                }
+            }
+            else if(json_parse(ctx, buf, length, 0)){
+                json_node* features = json_get_node(ctx->root, "features");
+                if(features) name = json_get_node(json_get_node(features->last_child, "properties"), "name");
+            }
+            if(!name){
+                printf("reading failed, error code: %d\n", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%8s %12.3f %12.1f\n", ondemand ? "cursor" : "parse", total / 1.0e3, length / total);
+    }
+    json_destroy(ctx);
+    free(src);
+    free(buf);
+}
+
+/** json_validate() throughput vs json_parse() on the same document */
+static void bench_validate(const char* name, const char* src, int length)
+{
+    const int nruns = 20;
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    ctx->max_depth = 0;
+    printf("\n...Checking %s (%d bytes) %d times - parse vs validate\n", name, length, nruns);
+    printf("%8s %12s %12s\n", "mode", "time, ms", "GB/s");
+    for(int validate = 0; validate < 2; validate++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            int ok;
+            /* json_validate() doesn't modify the buffer, the copy is made for json_parse() only */
+            if(!validate) memcpy(buf, src, length);
+            json_reset(ctx);
+            start = bench_usec();
+            ok = validate ? json_validate(ctx, src, length) : (json_parse(ctx, buf, length, 0) != NULL);
+            if(!ok){
+                printf("%s failed, error code: %d\n", validate ? "json_validate()" : "json_parse()", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%8s %12.3f %12.2f\n", validate ? "validate" : "parse", total / 1.0e3, length / total / 1.0e3);
+    }
+    json_destroy(ctx);
+    free(buf);
+}
+
+/** json_validate() on a sample file and on the string heavy payload */
+static void bench_validate_all(void)
+{
+    const int nrec = 20000;
+    char* src;
+    int length = load_file("./test/sample/example_6big.json", &src);
+    bench_validate("./test/sample/example_6big.json", src, length);
+    free(src);
+    src = malloc(nrec * 320 + 16);
+    if(!src){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    length = make_log_records(src, nrec);
+    bench_validate("string heavy payload", src, length);
+    free(src);
+}
+
+/** A read-only source: json_parse() needs a copy, json_parse_view() doesn't */
+static void bench_view(const char* fname)
+{
+    const int nruns = 20;
+    char* src;
+    int length = load_file(fname, &src);
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    ctx->max_depth = 0;
+    printf("\n...Checking %s (%d bytes) %d times - copy + parse vs view\n", fname, length, nruns);
+    printf("%12s %12s %12s\n", "mode", "time, ms", "MB/s");
+    for(int view = 0; view < 2; view++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            json_node* root;
+            json_reset(ctx);
+            start = bench_usec();
+            if(view) root = json_parse_view(ctx, src, length, 0);
+            else{
+                memcpy(buf, src, length);
+                root = json_parse(ctx, buf, length, 0);
+            }
+            if(!root){
+                printf("%s failed, error code: %d\n", view ? "json_parse_view()" : "json_parse()", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%12s %12.3f %12.1f\n", view ? "view" : "copy + parse", total / 1.0e3, length / total);
+    }
+    json_destroy(ctx);
+    free(buf);
+    free(src);
+}
+
+/** load_file() + json_parse() vs json_parse_file() on a file made of ncopies
+*   of the sample (an array of them if ncopies > 1)
+*/
+static void bench_file(const char* fname, int ncopies, int nruns)
+{
+    const char* tmpname = "./json_bench.tmp";
+    char* src;
+    int length = load_file(fname, &src);
+    if(ncopies > 1){
+        FILE* fl = fopen(tmpname, "wb");
+        if(!fl){
+            printf("File open error: %s\n", tmpname);
+            exit(1);
+        }
+        fputc('[', fl);
+        for(int i = 0; i < ncopies; i++){
+            if(i) fputc(',', fl);
+            fwrite(src, 1, length, fl);
+        }
+        fputc(']', fl);
+        fclose(fl);
+        length = ncopies * (length + 1) + 1;
+        fname = tmpname;
+    }
+    free(src);
+    json_ctx* ctx = json_init_pool(0, 1 << 30);
+    if(!ctx){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    ctx->max_depth = 0;
+    printf("\n...Checking %s (%d bytes) %d times - fread + parse vs json_parse_file()\n", fname, length, nruns);
+    printf("%14s %12s %12s\n", "mode", "time, ms", "MB/s");
+    for(int mapped = 0; mapped < 2; mapped++){
+        double start, total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            json_node* root;
+            char* buf = NULL;
+            json_reset(ctx);
+            start = bench_usec();
+            if(mapped) root = json_parse_file(ctx, fname, 0);
+            else{
+                load_file(fname, &buf);
+                root = json_parse(ctx, buf, length, 0);
+            }
+            if(!root){
+                printf("%s failed, error code: %d\n", mapped ? "json_parse_file()" : "json_parse()", ctx->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+            free(buf);
+        }
+        total /= nruns;
+        printf("%14s %12.3f %12.1f\n", mapped ? "file" : "fread + parse", total / 1.0e3, length / total);
+    }
+    json_destroy(ctx);
+    if(ncopies > 1) remove(tmpname);
+}
+
+/** NDJSON: a json_parse() per line with a context per record vs json_parse_batch()
+*   with 1, 4 and # online CPUs threads
+*/
+static void bench_batch(void)
+{
+    const int nrec = 200000;
+    const int nruns = 5;
+    const int nthreads[] = {1, 4, 0};
+    char* src = malloc(nrec * 256);
+    char* buf = malloc(nrec * 256);
+    int i, len = 0;
+    if((!src)||(!buf)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    for(i = 0; i < nrec; i++){
+        len += sprintf(src + len, "{\"url\":\"https://www.example.com/catalog/item/%d?ref=home\",\"status\":%d,"
+                       "\"time\":%d.%03d,\"cached\":%s,\"msg\":\"%s\"}\n", i, (i % 10) ? 200 : 404, i % 100, i % 1000,
+                       (i % 3) ? "true" : "false", (i % 4) ? "request served from the cache" : "path \\\"/tmp/x\\\" not found");
+    }
+    printf("\n...Parsing NDJSON (%d records, %d bytes) %d times\n", nrec, len, nruns);
+    printf("%22s %12s %12s\n", "mode", "time, ms", "MB/s");
+    double start, total = 0.0;
+    for(int run = 0; run <= nruns; run++){
+        memcpy(buf, src, len);
+        start = bench_usec();
+        for(char* p = buf; p < buf + len; ){
+            char* eol = memchr(p, '\n', buf + len - p);
+            json_ctx* ctx = json_init();
+            if((!ctx)||(!json_parse(ctx, p, eol - p + 1, 0))){
+                printf("json_parse() failed\n");
+                exit(1);
+            }
+            json_destroy(ctx);
+            p = eol + 1;
+        }
+        if(run) total += bench_usec() - start;
+    }
+    total /= nruns;
+    printf("%22s %12.3f %12.1f\n", "json_parse() per line", total / 1.0e3, len / total);
+    for(i = 0; i < (int)(sizeof(nthreads)/sizeof(nthreads[0])); i++){
+        json_batch* batch = json_batch_init(nthreads[i]);
+        char mode[32];
+        if(!batch){
+            printf("json_batch_init() failed\n");
+            exit(1);
+        }
+        total = 0.0;
+        for(int run = 0; run <= nruns; run++){
+            memcpy(buf, src, len);
+            start = bench_usec();
+            if((!json_parse_batch(batch, buf, len, 0))||(batch->nrecords != (size_t)nrec)||(batch->nfailed)){
+                printf("json_parse_batch() failed\n");
+                exit(1);
+            }
+            if(run) total += bench_usec() - start;
+        }
+        total /= nruns;
+        sprintf(mode, "batch, %d thread(s)", batch->nthreads);
+        printf("%22s %12.3f %12.1f\n", mode, total / 1.0e3, len / total);
+        json_batch_destroy(batch);
+    }
+    free(src);
+    free(buf);
+}
+
+/** json_parse() vs json_parse_parallel() with 4 and # online CPUs threads
+*   on ncopies of the sample (an array of them if ncopies > 1)
+*/
+static void bench_parallel(const char* fname, int ncopies, int nruns)
+{
+    const int nthreads[] = {4, 0};
+    char* src;
+    int length = load_file(fname, &src);
+    if(ncopies > 1){
+        char* arr = malloc(ncopies * (length + 1) + 1);
+        if(!arr){
+            printf("Memory allocation error\n");
+            exit(1);
+        }
+        arr[0] = '[';
+        for(int i = 0; i < ncopies; i++){
+            memcpy(arr + 1 + i * (length + 1), src, length);
+            arr[(i + 1) * (length + 1)] = (i < ncopies - 1) ? ',' : ']';
+        }
+        free(src);
+        src = arr;
+        length = ncopies * (length + 1) + 1;
+    }
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_pool(0, 1 << 30);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    ctx->max_depth = 0;
+    printf("\n...Parsing %s x %d (%d bytes) %d times - json_parse() vs json_parse_parallel()\n", fname, ncopies, length, nruns);
+    printf("%14s %12s %12s\n", "mode", "time, ms", "MB/s");
+    double start, total = 0.0;
+    for(int i = 0; i <= nruns; i++){
+        memcpy(buf, src, length);
+        json_reset(ctx);
+        start = bench_usec();
+        if(!json_parse(ctx, buf, length, 0)){
+            printf("json_parse() failed, error code: %d\n", ctx->err);
+            exit(1);
+        }
+        if(i) total += bench_usec() - start;
+    }
+    total /= nruns;
+    printf("%14s %12.3f %12.1f\n", "json_parse()", total / 1.0e3, length / total);
+    for(int t = 0; t < (int)(sizeof(nthreads)/sizeof(nthreads[0])); t++){
+        json_batch* batch = json_batch_init(nthreads[t]);
+        char mode[32];
+        if(!batch){
+            printf("json_batch_init() failed\n");
+            exit(1);
+        }
+        batch->max_nodes = 1 << 30;
+        batch->max_depth = 0;
+        total = 0.0;
+        for(int i = 0; i <= nruns; i++){
+            memcpy(buf, src, length);
+            start = bench_usec();
+            if(!json_parse_parallel(batch, buf, length, 0)){
+                printf("json_parse_parallel() failed, error code: %d\n", batch->err);
+                exit(1);
+            }
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        sprintf(mode, "%d thread(s)", batch->nthreads);
+        printf("%14s %12.3f %12.1f\n", mode, total / 1.0e3, length / total);
+        json_batch_destroy(batch);
+    }
+    json_destroy(ctx);
+    free(buf);
+    free(src);
+}
+
+/** Creating a context must be cheap whatever the maximum # nodes is */
+static void bench_init(void)
+{
+    const int nruns = 1000;
+    double start = bench_usec();
+    for(int i = 0; i < nruns; i++){
+        json_ctx* ctx = json_init();
+        if(!ctx){
+            printf("json_init() failed\n");
+            exit(1);
+        }
+        json_destroy(ctx);
+    }
+    printf("\n...json_init() + json_destroy(): %.3f us, context size %d bytes, initial pool %d nodes\n",
+           (bench_usec() - start) / nruns, (int)sizeof(json_ctx), JSON_SLAB_NODES);
+}
+
+/** Serializing a tree of unknown output size: json_to_string() with a buffer doubled
+*   until the output fits vs json_write() into a growable buffer and into a file
+*   vs json_serialized_size() and json_to_string() into a buffer of that size
+*/
+static void bench_writer(const char* name, const char* src, int length, int nruns)
+{
+    const char* tmpname = "./json_bench.tmp";
+    const char* modes[] = {"retry x2", "growable buffer", "file", "size only", "size + exact", "'/' not escaped",
+                           "formatted", "LF, 2 spaces"};
+    const json_format lf2 = {2, 1, 0};
+    char* buf = malloc(length);
+    json_ctx* ctx = json_init_arena(0);
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    memcpy(buf, src, length);
+    ctx->max_depth = 0;
+    json_node* root = json_parse(ctx, buf, length, 0);
+    if(!root){
+        printf("json_parse() failed, error code: %d\n", ctx->err);
+        exit(1);
+    }
+    printf("\n...Serializing %s (%d bytes) %d times - json_to_string() vs json_write()\n", name, length, nruns);
+    printf("%16s %12s %12s\n", "mode", "time, ms", "MB/s");
+    for(int mode = 0; mode < 8; mode++){
+        double start, total = 0.0;
+        ptrdiff_t rc = -1;
+        for(int i = 0; i <= nruns; i++){
+            json_writer w;
+            FILE* fl = NULL;
+            if((mode == 2)&&(!(fl = fopen(tmpname, "wb")))){
+                printf("File open error: %s\n", tmpname);
+                exit(1);
+            }
+            start = bench_usec();
+            if(mode == 0){
+                /* a guess, the size is doubled and the tree is serialized again until it fits */
+                size_t size = 4096;
+                char* out = NULL;
+                do{
+                    free(out);
+                    size *= 2;
+                    if(!(out = malloc(size))){
+                        printf("Memory allocation error\n");
+                        exit(1);
+                    }
+                } while((rc = json_to_string(root, out, size, 1)) < 0);
+                free(out);
+            }
+            else if((mode == 3)||(mode == 4)){
+                /* the exact size, a single allocation and serialization */
+                rc = json_serialized_size(root, 1);
+                if((mode == 4)&&(rc >= 0)){
+                    char* out = malloc(rc + 1);
+                    if((!out)||(json_to_string(root, out, rc + 1, 1) != rc)) rc = -1;
+                    free(out);
+                }
+            }
+            else{
+                if(mode == 2) json_writer_file(&w, fl);
+                else json_writer_buffer(&w, 4096);
+                w.no_escape_slash = (mode == 5);
+                w.format = (mode == 7) ? &lf2 : NULL;
+                rc = json_write(&w, root, mode < 6);
+                if(!json_writer_close(&w)) rc = -1;
+            }
+            if(rc < 0){
+                printf("%s failed\n", modes[mode]);
+                exit(1);
+            }
+            if(fl) fclose(fl);
+            if(i) total += bench_usec() - start;
+        }
+        total /= nruns;
+        printf("%16s %12.3f %12.1f\n", modes[mode], total / 1.0e3, rc / total);
+    }
+    json_destroy(ctx);
+    free(buf);
+    remove(tmpname);
+}
+
+/** Serialization of the number heavy and the string heavy payloads */
+static void bench_writer_all(void)
+{
+    const int nrec = 20000;
+    char* src;
+    int length = load_file("./test/sample/example_6big.json", &src);
+    bench_writer("./test/sample/example_6big.json", src, length, 20);
+    free(src);
+    src = malloc(nrec * 320 + 16);
+    if(!src){
+        printf("Memory allocation error\n");
+        exit(1);
+    }
+    length = make_log_records(src, nrec);
+    bench_writer("string heavy payload", src, length, 20);
+    free(src);
+}
+
+int main(void)
+{
+    bench_init();
+    bench_wide_array();
+    bench_arena("./test/sample/example_6big.json");
+    bench_strings();
+    bench_numbers();
+    bench_indexed("./test/sample/example_6big.json");
+    bench_indexed("./test/sample/example_2.json");
+    bench_feed("./test/sample/example_6big.json");
+    bench_sax("./test/sample/example_6big.json");
+    bench_ondemand("./test/sample/example_6big.json");
+    bench_validate_all();
+    bench_view("./test/sample/example_6big.json");
+    bench_file("./test/sample/example_6big.json", 1, 20);
+    bench_file("./test/sample/example_6big.json", 32, 3);
+    bench_batch();
+    bench_parallel("./test/sample/example_6big.json", 1, 20);
+    bench_parallel("./test/sample/example_6big.json", 32, 3);
+    bench_writer_all();
+    return 0;
+}
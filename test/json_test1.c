@@ -172,6 +172,67 @@ long long res[] ={0,0,0,0,0,0};
         printf("%s\n", str[j]);
 }
 
+void json_test_digits()
+{
+    TIMESTAMP start;
+    TIMESTAMP stop;
+
+/* long integers (IDs, timestamps) and coordinates, followed by more JSON as in an array */
+char str[][64] = {
+    "1700000000123,",
+    "9007199254740993,",
+    "1234567890123456789]",
+    "-65.613616999999977,",
+    "40.712775826286739]",
+    "0.000123456789012345,"
+};
+
+    union{
+        double d;
+        long long l;
+        char* s;
+    } res;
+    double sum = 0.0;
+    int len;
+    int j;
+    int ntests = 1000000;
+
+    for(int i = 0; i < 6; i++){
+        len = strlen(str[i]);
+        json_atonum(str[i], &len, &res);
+        if((i < 3) ? (res.l != strtoll(str[i], NULL, 10)) : (res.d != strtod(str[i], NULL))){
+            printf("json_atonum() and strtoll()\\strtod() disagree!\n");
+            printf("here: %s\n", str[i]);
+            exit(1);
+        }
+    }
+
+    printf("\ntesting json_atonum() with long digit runs, # tests = %d\n", ntests);
+    get_timestamp(&start);
+    for(j = 0; j < ntests; j++)
+    for(int i = 0; i < 6; i++){
+        len = strlen(str[i]);
+        if(json_atonum(str[i], &len, &res) < 0){
+            printf("json_atonum() error!\n");
+            printf("here: %s\n", str[i]);
+            exit(1);
+        }
+        sum += (i < 3) ? (double)res.l : res.d;
+    }
+    get_timestamp(&stop);
+    printf("Time elapsed for json_atonum %s\n\n", diff_time(&start, &stop));
+
+    printf("testing strtoll()\\strtod(), # tests = %d\n", ntests);
+    get_timestamp(&start);
+    for(j = 0; j < ntests; j++)
+    for(int i = 0; i < 6; i++){
+        if(i < 3) sum += (double)strtoll(str[i], NULL, 10);
+        else sum += strtod(str[i], NULL);
+    }
+    get_timestamp(&stop);
+    printf("Time elapsed for strtoll()\\strtod() %s (%g)\n\n", diff_time(&start, &stop), sum);
+}
+
 void json_test_numbers()
 {
     union result{
@@ -405,7 +466,7 @@ printf("file name: %s\n", fname);
         exit(-1);
     }
 //    printf("depth: %d\n", ctx->ndepth);
-    printf("Parsed bytes (cursor position): %d\n", ctx->pos);
+    printf("Parsed bytes (cursor position): %zu\n", ctx->pos);
     printf("Used nodes: %d\n", ctx->nused);
     printf("Used memory: %d bytes\n", (int)(ctx->nused * sizeof(json_node) + sizeof(json_ctx)));
     if(!ctx->err){
@@ -458,7 +519,7 @@ printf("file name: %s\n", fname);
         exit(-1);
     }
 
-    printf("\nParsed bytes (cursor position): %d\n", ctx->pos);
+    printf("\nParsed bytes (cursor position): %zu\n", ctx->pos);
     printf("Used nodes: %d\n", ctx->nused);
     printf("Used memory: %d bytes\n", (int)(ctx->nused * sizeof(json_node) + sizeof(json_ctx)));
     if(!ctx->err){
@@ -513,6 +574,8 @@ rc = json_test_file("./test/sample/example_4.json");
 
     json_test_itoa();
 
+    json_test_digits();
+
     json_test_floats();
 
     return 0;
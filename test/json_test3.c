@@ -0,0 +1,1799 @@
+#include "json_clib.h"
+
+#include <string.h>
+#include <limits.h>
+
+#define MY_BUF_SIZE 1024
+
+/* number of failed checks */
+static int nfailed = 0;
+
+#define CHECK(COND, TXT) \
+do{ \
+    if(COND) printf("OK:     %s\n", TXT); \
+    else{ printf("FAILED: %s (line %d)\n", TXT, __LINE__); nfailed++; } \
+} while(0)
+
+/** Parse a copy of the literal and serialize it back in compact form
+*   Return: # bytes written to out or -1 on error
+*/
+static int parse_print(json_ctx* ctx, const char* sample, char* in, char* out)
+{
+    int length = strlen(sample);
+    memcpy(in, sample, length + 1);
+    json_node* root = json_parse(ctx, in, length, 1);
+    if(!root){
+        printf("json_parse() failed, error code: %d\n", ctx->err);
+        return -1;
+    }
+    return json_to_string(root, out, MY_BUF_SIZE, 1);
+}
+
+/** null values must survive node allocations which follow them */
+static void test_nulls(json_ctx* ctx)
+{
+    char in[MY_BUF_SIZE];
+    char out[MY_BUF_SIZE];
+    const char* sample = "[null,1,{\"a\":null,\"b\":[null,null]},\"x\",null]";
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(-1);
+    }
+    CHECK(parse_print(ctx, sample, in, out) > 0, "parse and print nulls");
+    CHECK(!strcmp(out, sample), "nulls are kept in place");
+    /* release the object and reuse its nodes */
+    json_node* nd = json_get_element(ctx->root, 2);
+    int nused = ctx->nused;
+    json_remove_node(ctx, nd);
+    CHECK(ctx->nused == nused - 5, "removed node releases its descendants");
+    nd = json_add_last(ctx, ctx->root, JSON_INTEGER, NULL);
+    CHECK(nd != NULL, "add a node after remove");
+    if(nd) nd->val.integer_value = 7;
+    nd = json_add_first(ctx, ctx->root, JSON_DUMMY, NULL);
+    CHECK(nd != NULL, "add a null node first");
+    CHECK(json_to_string(ctx->root, out, MY_BUF_SIZE, 1) > 0, "print after reuse");
+    CHECK(!strcmp(out, "[null,null,1,\"x\",null,7]"), out);
+    json_destroy(ctx);
+}
+
+/** A context parses many documents - the memory must be reused */
+static void test_reset(json_ctx* ctx)
+{
+    char in[MY_BUF_SIZE];
+    char out[MY_BUF_SIZE];
+    const char* sample[] = {
+        "{\"id\":1,\"tags\":[\"a\",\"b\",\"c\"],\"ok\":true}",
+        "[1,2,3,4,5,6,7,8,9,10,11,12]",
+        "{\"id\":2,\"tags\":[],\"ok\":false}"
+    };
+    int nslabs = -1;
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(-1);
+    }
+    for(int i = 0; i < 30; i++){
+        const char* src = sample[i % 3];
+        json_reset(ctx);
+        if((parse_print(ctx, src, in, out) < 0)||(strcmp(out, src))){
+            CHECK(0, src);
+            break;
+        }
+        int n = 0;
+        for(json_slab* slab = ctx->slabs; slab; slab = slab->next) n++;
+        for(json_slab* slab = ctx->spare_slabs; slab; slab = slab->next) n++;
+        if((i >= 3)&&(n != nslabs)){
+            CHECK(0, "no slabs are allocated in steady state");
+            break;
+        }
+        nslabs = n;
+    }
+    CHECK(ctx->err == ERR_JSON_OK, "30 documents parsed in one context");
+    json_reset(ctx);
+    CHECK((ctx->root == NULL)&&(ctx->nused == 0)&&(ctx->pos == 0), "json_reset() clears the state");
+    json_destroy(ctx);
+}
+
+/** The pool grows by slabs up to the maximum # nodes */
+static void test_pool_limits(void)
+{
+    char in[MY_BUF_SIZE];
+    char out[MY_BUF_SIZE];
+    const char* sample = "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19]";
+    json_ctx* ctx = json_init_pool(2, 20);
+    if(!ctx){
+        printf("json_init_pool() failed\n");
+        exit(-1);
+    }
+    CHECK((ctx->pool_size == 2)&&(ctx->slabs)&&(!ctx->slabs->next), "initial footprint is one slab");
+    CHECK(parse_print(ctx, sample, in, out) > 0, "20 nodes fit");
+    CHECK(ctx->pool_size == 20, "pool has grown up to the maximum");
+    json_reset(ctx);
+    memcpy(in, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19]", 52);
+    CHECK(!json_parse(ctx, in, 52, 0), "21 nodes do not fit");
+    CHECK(ctx->err == ERR_JSON_NODES, "ERR_JSON_NODES is reported");
+    json_destroy(ctx);
+}
+
+/** find_strspec() variants must agree with a byte by byte scan */
+static void test_strspec(void)
+{
+    char buf[96];
+    /* bytes which must not stop the scan */
+    const char plain[] = {'a', ' ', 0x7f, (char)0x80, (char)0xff, '!', '#', ']'};
+    const char spec[] = {'"', '\\', '\n', '\0', 0x1f};
+    int i, j, ok = 1;
+    for(i = 0; i < (int)sizeof(buf); i++) buf[i] = plain[i % sizeof(plain)];
+    for(i = 0; (i < (int)sizeof(buf))&&(ok); i++){
+        for(j = 0; (j < (int)sizeof(spec))&&(ok); j++){
+            char save = buf[i];
+            buf[i] = spec[j];
+            ok = (find_strspec_32(buf, sizeof(buf)) == i)&&
+                 (find_strspec_64(buf, sizeof(buf)) == i)&&
+#ifdef USE_INTRINSICS_SSE
+                 (find_strspec_sse(buf, sizeof(buf)) == i)&&
+#endif // USE_INTRINSICS_SSE
+#ifdef USE_INTRINSICS_AVX
+                 (find_strspec_avx(buf, sizeof(buf)) == i)&&
+#endif // USE_INTRINSICS_AVX
+                 (find_strspec(buf, i) == -1);
+            for(int slash = 0; (slash < 2)&&(ok); slash++){
+                ok = (find_escape_32(buf, sizeof(buf), slash) == i)&&
+                     (find_escape_64(buf, sizeof(buf), slash) == i)&&
+#ifdef USE_INTRINSICS_SSE
+                     (find_escape_sse(buf, sizeof(buf), slash) == i)&&
+#endif // USE_INTRINSICS_SSE
+#ifdef USE_INTRINSICS_AVX
+                     (find_escape_avx(buf, sizeof(buf), slash) == i)&&
+#endif // USE_INTRINSICS_AVX
+                     (find_escape(buf, i, slash) == -1);
+            }
+            buf[i] = save;
+        }
+        /* '/' is found only if it is escaped */
+        for(j = 0; (j < (int)sizeof(buf) - i)&&(ok); j++){
+            char save = buf[i];
+            buf[i] = '/';
+            ok = (find_escape(buf, i + j + 1, ~0) == i)&&(find_escape(buf, i + j + 1, 0) == -1);
+            buf[i] = save;
+        }
+    }
+    CHECK(ok, "find_strspec() finds '\"', '\\' and control characters at any offset, find_escape() - '/' too");
+}
+
+/** Escapes at any offset of long strings, unicode decoding and invalid strings */
+static void test_strings(void)
+{
+    char in[MY_BUF_SIZE];
+    char exp[MY_BUF_SIZE];
+    int i, ok = 1;
+    json_ctx* ctx = json_init();
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(-1);
+    }
+    /* a quote escape moves across the 8/16/32 byte blocks of the scanner */
+    for(i = 0; (i < 70)&&(ok); i++){
+        int n = sprintf(in, "[\"%.*s\\\"%.*s\",\"x\"]", i, "0123456789012345678901234567890123456789012345678901234567890123456789",
+                        70 - i, "abcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghij");
+        sprintf(exp, "%.*s\"%.*s", i, "0123456789012345678901234567890123456789012345678901234567890123456789",
+                70 - i, "abcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghij");
+        json_reset(ctx);
+        json_node* root = json_parse(ctx, in, n, 0);
+        ok = (root)&&(!strcmp(json_get_element(root, 0)->val.string_value, exp))&&
+             (!strcmp(json_get_element(root, 1)->val.string_value, "x"));
+    }
+    CHECK(ok, "escaped quote at every offset of a 71 bytes string");
+    json_reset(ctx);
+    strcpy(in, "[\"a\\tb\\\\c\\/d\\n\",\"\\u00e9\\u20ac\\ud83d\\ude00\"]");
+    json_node* root = json_parse(ctx, in, strlen(in), 1);
+    CHECK((root)&&(!strcmp(json_get_element(root, 0)->val.string_value, "a\tb\\c/d\n")), "simple escapes");
+    CHECK((root)&&(!strcmp(json_get_element(root, 1)->val.string_value, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80")),
+          "u-escapes and a surrogate pair are decoded to utf-8");
+    json_reset(ctx);
+    strcpy(in, "[\"\\u00e9\"]");
+    root = json_parse(ctx, in, strlen(in), 0);
+    CHECK((root)&&(!strcmp(json_get_element(root, 0)->val.string_value, "\\u00e9")), "u-escapes are kept if not decoded");
+    json_reset(ctx);
+    strcpy(in, "[\"a\tb\"]");
+    CHECK((!json_parse(ctx, in, strlen(in), 0))&&(ctx->err == ERR_JSON_UNEXPECTED), "raw control character is rejected");
+    json_reset(ctx);
+    strcpy(in, "[\"\\ude00\\ud83d\"]");
+    CHECK((!json_parse(ctx, in, strlen(in), 1))&&(ctx->err == ERR_JSON_UNEXPECTED), "swapped surrogates are rejected");
+    json_reset(ctx);
+    strcpy(in, "[\"\\u00\"]");
+    CHECK(!json_parse(ctx, in, strlen(in), 1), "short u-escape is rejected");
+    json_reset(ctx);
+    strcpy(in, "[\"abc");
+    CHECK(!json_parse(ctx, in, strlen(in), 1), "unterminated string is rejected");
+#ifdef JSON_LIMIT_CHECK
+    json_reset(ctx);
+    in[0] = '"';
+    memset(in + 1, 'a', JSON_MAX_STRING_SIZE);
+    in[JSON_MAX_STRING_SIZE + 1] = '"';
+    CHECK(json_parse(ctx, in, JSON_MAX_STRING_SIZE + 2, 0) != NULL, "string of JSON_MAX_STRING_SIZE bytes");
+    json_reset(ctx);
+    in[0] = '"';
+    memset(in + 1, 'a', JSON_MAX_STRING_SIZE + 1);
+    in[JSON_MAX_STRING_SIZE + 2] = '"';
+    CHECK((!json_parse(ctx, in, JSON_MAX_STRING_SIZE + 3, 0))&&(ctx->err == ERR_JSON_STRING),
+          "JSON_MAX_STRING_SIZE exceeded");
+#endif // JSON_LIMIT_CHECK
+    json_destroy(ctx);
+}
+
+/** A string escaped by the serializer must be decoded by the parser to the same bytes */
+static void test_escape_output(void)
+{
+    static char str[200], in[MY_BUF_SIZE], out[MY_BUF_SIZE];
+    /* 0x7f is not a control character for JSON */
+    const char* exp = "[\"\\\"\\\\\\b\\f\\n\\r\\t\\/\\u0001\\u001fa\x7f\"]";
+    json_writer w;
+    int i, n, slash, ok = 1;
+    json_ctx* ctx = json_init();
+    json_node* root = json_add_last(ctx, NULL, JSON_ARRAY, NULL);
+    json_node* nd = json_add_last(ctx, root, JSON_STRING, NULL);
+    nd->val.string_value = "\"\\\b\f\n\r\t/\x01\x1f" "a\x7f";
+    CHECK((json_to_string(root, out, MY_BUF_SIZE, 1) > 0)&&(!strcmp(out, exp)), "the short escapes and \\u00XX");
+    nd->val.string_value = "http://example.com/a/b";
+    ok = json_writer_buffer(&w, 0);
+    w.no_escape_slash = ~0;
+    ok = (ok)&&(json_write(&w, root, 1) == 26)&&(!strcmp(w.buf, "[\"http://example.com/a/b\"]"));
+    json_writer_close(&w);
+    CHECK(ok, "'/' is not escaped if asked so");
+    /* random strings: an escape at any offset of the 16/32 byte blocks */
+    srand(7);
+    for(i = 0; (i < 2000)&&(ok); i++){
+        int len = rand() % 100;
+        for(n = 0; n < len; n++){
+            int r = rand() % 16;
+            str[n] = (r == 0) ? (char)(1 + rand() % 0x1f) : (r == 1) ? '"' : (r == 2) ? '\\' : (r == 3) ? '/' :
+                     (r == 4) ? (char)(0x80 + rand() % 0x40) : (char)('a' + r);
+        }
+        str[len] = '\0';
+        nd->val.string_value = str;
+        for(slash = 0; (slash < 2)&&(ok); slash++){
+            json_writer_buffer(&w, 0);
+            w.no_escape_slash = slash;
+            ok = (json_write(&w, root, 1) > 0)&&(w.pos < sizeof(in));
+            if(ok) memcpy(in, w.buf, w.pos + 1);
+            n = (int)w.pos;
+            json_writer_close(&w);
+            json_ctx* ctx2 = json_init();
+            json_node* root2 = (ok) ? json_parse(ctx2, in, n, 1) : NULL;
+            ok = (root2)&&(!strcmp(json_get_element(root2, 0)->val.string_value, str))&&
+                 ((slash)||(json_serialized_size(root, 1) == n));
+            json_destroy(ctx2);
+        }
+    }
+    CHECK(ok, "random strings read back the same");
+    json_destroy(ctx);
+}
+
+/* a document and what json_parse(ctx, buf, len, 1) reports for it */
+typedef struct{
+    const char* src;
+    json_error err;
+    size_t pos;
+} test_doc;
+
+/* every parser entry point is run against these (see docs_compare()) */
+static const test_doc test_docs[] = {
+    /* valid documents */
+    {"{}", ERR_JSON_OK, 2}, {"[]", ERR_JSON_OK, 2}, {"[[]]", ERR_JSON_OK, 4}, {"{\"a\":{}}", ERR_JSON_OK, 8},
+    {"\"top\"", ERR_JSON_OK, 5}, {"17", ERR_JSON_OK, 2}, {"12345", ERR_JSON_OK, 5}, {"-0.5", ERR_JSON_OK, 4},
+    {"true", ERR_JSON_OK, 4}, {"[\"\"]", ERR_JSON_OK, 4}, {"{\"\":\"\"}", ERR_JSON_OK, 7},
+    {" [ 1 , -2.5e3 , true , false , null , \"s\" ] ", ERR_JSON_OK, 43},
+    {"  [ \"x\" , 0 , {\"k\" : \"v\"} ]  ", ERR_JSON_OK, 27},
+    {"{\"k\" : \"v\" , \"n\" :\t-0.125\r\n}", ERR_JSON_OK, 28},
+    {"{\"a\":[1,{\"b\":\"\\\\\"},\"c\\\"d\"],\"e\":\"\"}", ERR_JSON_OK, 34},
+    {"[\"\\u00e9\\/\\ud83d\\ude00\\n\"]", ERR_JSON_OK, 26},
+    {"{\"k\\tey\":{\"\\\"\":[\"\\b\\f\\r\"]}}", ERR_JSON_OK, 27},
+    {"{\"name\":\"a\\\"b\\\\c\\u00e9\\ud83d\\ude00\",\"n\":[1,-2.5e-3,12345678901234567890123,true,false,null],"
+     "\"e\":{},\"a\":[]}", ERR_JSON_OK, 106},
+    {"[0.12345678901234567890123,1]", ERR_JSON_OK, 29}, {"[12345678901234567890123456789,1]", ERR_JSON_OK, 33},
+    {"[12345678901234567890123]", ERR_JSON_OK, 25}, {"[1e400]", ERR_JSON_OK, 7},
+    /* json_parse() stops after the root value */
+    {"{\"a\":1} [2]", ERR_JSON_OK, 7}, {"12x", ERR_JSON_OK, 2}, {"true{", ERR_JSON_OK, 4},
+    {"null]", ERR_JSON_OK, 4}, {"\"s\"x", ERR_JSON_OK, 3}, {"-0 1", ERR_JSON_OK, 2},
+    {"12345678901234567890123x", ERR_JSON_OK, 23},
+    /* missing or misplaced separators and brackets */
+    {"[1,]", ERR_JSON_UNEXPECTED, 3}, {"[,1]", ERR_JSON_UNEXPECTED, 1}, {"{\"a\":1,}", ERR_JSON_UNEXPECTED, 7},
+    {"{\"a\"}", ERR_JSON_UNEXPECTED, 4}, {"{\"a\":}", ERR_JSON_UNEXPECTED, 5},
+    {"{1:2}", ERR_JSON_UNEXPECTED, 1}, {"[1 2]", ERR_JSON_UNEXPECTED, 3}, {"[1:2]", ERR_JSON_UNEXPECTED, 2},
+    {"[\"a\":1]", ERR_JSON_UNEXPECTED, 4}, {"{]", ERR_JSON_UNEXPECTED, 1}, {"[}", ERR_JSON_UNEXPECTED, 1},
+    {"}", ERR_JSON_UNEXPECTED, 0}, {"x", ERR_JSON_UNEXPECTED, 0}, {"{\"a\":1]", ERR_JSON_UNEXPECTED, 6},
+    {"[1}", ERR_JSON_UNEXPECTED, 2}, {"[\"a\"\"b\"]", ERR_JSON_UNEXPECTED, 4},
+    {"[\"ab\" \"cd\"]", ERR_JSON_UNEXPECTED, 6}, {"{\"a\":1 \"b\":2}", ERR_JSON_UNEXPECTED, 7},
+    /* literals */
+    {"[truex]", ERR_JSON_UNEXPECTED, 5}, {"[true1]", ERR_JSON_UNEXPECTED, 5}, {"[nul]", ERR_JSON_UNEXPECTED, 1},
+    {"[nulll]", ERR_JSON_UNEXPECTED, 5}, {"[tru]", ERR_JSON_UNEXPECTED, 1},
+    {"{\"k\":nul}", ERR_JSON_UNEXPECTED, 5}, {"{\"a\":tr ue}", ERR_JSON_UNEXPECTED, 5},
+    {"[[nu}l,510971]]", ERR_JSON_UNEXPECTED, 2}, {"[fal[se, 1]", ERR_JSON_UNEXPECTED, 1},
+    {"[[ n,ll,[851898,2]]]", ERR_JSON_UNEXPECTED, 3},
+    /* numbers */
+    {"[1.5.3]", ERR_JSON_UNEXPECTED, 4}, {"[-]", ERR_JSON_NUMBER, 1}, {"[01]", ERR_JSON_NUMBER, 1},
+    {"[1.]", ERR_JSON_NUMBER, 1}, {"[1e]", ERR_JSON_NUMBER, 1}, {"[1.,2]", ERR_JSON_NUMBER, 1},
+    {"[12a,3]", ERR_JSON_UNEXPECTED, 3},
+    /* strings */
+    {"[\"\\u12\"]", ERR_JSON_UNEXPECTED, 4}, {"[\"\\ud83d\"]", ERR_JSON_UNEXPECTED, 8},
+    {"[\"\\ude00\"]", ERR_JSON_UNEXPECTED, 8}, {"[\"ab\\ud800\\u0041\"]", ERR_JSON_UNEXPECTED, 10},
+    {"{\"key\":\"\\ud83dAxyz\"}", ERR_JSON_UNEXPECTED, 14}, {"[\"a\tb\"]", ERR_JSON_UNEXPECTED, 3},
+    /* cut by the end of the buffer */
+    {"", ERR_JSON_INCOMPLETE, 0}, {"   ", ERR_JSON_INCOMPLETE, 3}, {"[", ERR_JSON_INCOMPLETE, 1},
+    {"[1", ERR_JSON_INCOMPLETE, 2}, {"[1 ", ERR_JSON_INCOMPLETE, 3}, {"{\"a\":1", ERR_JSON_INCOMPLETE, 6},
+    {"[\"abc]", ERR_JSON_INCOMPLETE, 6}, {"[\"a\\", ERR_JSON_INCOMPLETE, 4}, {"\"ab\\", ERR_JSON_INCOMPLETE, 4},
+    {"[\"\\u12", ERR_JSON_UNEXPECTED, 4}, {"[\"\\ud800\\\"]", ERR_JSON_UNEXPECTED, 8},
+    {"nu", ERR_JSON_INCOMPLETE, 0}, {"nul", ERR_JSON_INCOMPLETE, 0}, {"t", ERR_JSON_INCOMPLETE, 0},
+    {"fale", ERR_JSON_INCOMPLETE, 0}, {"-", ERR_JSON_NUMBER, 0}, {"[nu", ERR_JSON_INCOMPLETE, 1},
+    {"[nul", ERR_JSON_INCOMPLETE, 1}, {"[tr", ERR_JSON_INCOMPLETE, 1}, {"[fals", ERR_JSON_INCOMPLETE, 1},
+    {"{\"a\":fals", ERR_JSON_INCOMPLETE, 5}, {"[1.5", ERR_JSON_INCOMPLETE, 4},
+    /* keys at the end of the buffer */
+    {"{\"a\"", ERR_JSON_INCOMPLETE, 4}, {"{\"a\"  ", ERR_JSON_INCOMPLETE, 6},
+    {"{\"a\" 1}", ERR_JSON_UNEXPECTED, 5}, {"{\"a\":1,\"b\"", ERR_JSON_INCOMPLETE, 10},
+    {"{\"a\":[1,{\"b\"", ERR_JSON_INCOMPLETE, 12}
+};
+
+/* numbers at the end of the buffer with no room for the null terminator */
+static const test_doc test_docs_no_room[] = {
+    {"12345678901234567890123", ERR_JSON_INCOMPLETE, 0}, {"123456789012345678901234567890", ERR_JSON_INCOMPLETE, 0},
+    {"[12345678901234567890123", ERR_JSON_INCOMPLETE, 1}, {"1e400", ERR_JSON_INCOMPLETE, 0},
+    {"[1e400", ERR_JSON_INCOMPLETE, 1}, {"[1e999999", ERR_JSON_INCOMPLETE, 1}
+};
+
+/* one run of a parser entry point on a copy of a document */
+typedef struct{
+    json_ctx* ctx;      /* a new context, json_parse() gets its limits */
+    const char* src;    /* the document, may be read-only */
+    char* buf;          /* a copy of it */
+    size_t len;
+    int decode;
+    size_t step;        /* json_parse_feed(): # bytes per call */
+    void* user;
+    int readonly;       /* set by the entry point which must not write to buf */
+    json_node* root;    /* the result: the tree if one is built, the error and the position */
+    json_error err;
+    size_t pos;
+} test_run;
+
+/** Return: 0 on error */
+typedef int (*test_parser)(test_run* run);
+
+/** Run an entry point on a copy of src and json_parse() on another one, compare
+*   the trees, the error codes and the positions
+*   Input: step - passed to the entry point, if not 0 the positions are not compared
+*           (json_parse_feed() reports the one in the last buffer)
+*       exp - what json_parse() must report or NULL
+*   Return: 0 - the results differ
+*/
+static int run_compare(test_parser parse, void* user, const char* src, size_t len, int decode, size_t step,
+                       const test_doc* exp)
+{
+    static char out1[1 << 23], out2[1 << 23];
+    test_run run = {0};
+    json_ctx* ctx;
+    int ok, rc;
+    run.ctx = json_init_arena(0);
+    run.src = src;
+    run.buf = malloc(len + 1);
+    run.len = len;
+    run.decode = decode;
+    run.step = step;
+    run.user = user;
+    char* buf = malloc(len + 1);
+    if((!run.ctx)||(!run.buf)||(!buf)){
+        printf("run_compare() failed\n");
+        exit(-1);
+    }
+    memcpy(run.buf, src, len);
+    memcpy(buf, src, len);
+    rc = parse(&run);
+    ctx = json_init_pool(0, run.ctx->max_nodes);
+    if(!ctx){
+        printf("run_compare() failed\n");
+        exit(-1);
+    }
+    ctx->max_depth = run.ctx->max_depth;
+    json_node* root = json_parse(ctx, buf, len, decode);
+    ok = ((!rc) == (!root))&&(run.err == ctx->err)&&((run.pos == ctx->pos)||(step))&&
+         ((!run.readonly)||(!memcmp(run.buf, src, len)));
+    if((ok)&&(run.root)){
+        /* the nodes are counted if they are in run.ctx */
+        ok = (json_to_string(root, out1, sizeof(out1), 1) > 0)&&
+             (json_to_string(run.root, out2, sizeof(out2), 1) > 0)&&(!strcmp(out1, out2))&&
+             ((!run.ctx->nused)||(run.ctx->nused == ctx->nused));
+    }
+    if(exp) ok = (ok)&&(ctx->err == exp->err)&&(ctx->pos == exp->pos);
+    json_destroy(ctx);
+    json_destroy(run.ctx);
+    free(run.buf);
+    free(buf);
+    return ok;
+}
+
+#define DOCS_UTF8_ONLY  1   /* to_utf8 = 1 only */
+#define DOCS_SPLIT      2   /* in pieces of every size */
+#define DOCS_NO_ROOM    4   /* the entry point needs no terminators, skip test_docs_no_room[] */
+
+/** Run an entry point against a table of documents and compare the results with the ones of json_parse()
+*   Return: 0 - the results differ
+*/
+static int table_compare(const test_doc* docs, size_t ndocs, test_parser parse, void* user, int flags)
+{
+    size_t i, len, step;
+    int decode, ok = 1;
+    for(i = 0; (i < ndocs)&&(ok); i++){
+        len = strlen(docs[i].src);
+        for(decode = 1; (decode >= ((flags & DOCS_UTF8_ONLY) ? 1 : 0))&&(ok); decode--){
+            for(step = (flags & DOCS_SPLIT) ? 1 : 0; ok; step++){
+                ok = run_compare(parse, user, docs[i].src, len, decode, step, decode ? &docs[i] : NULL);
+                if(!ok) printf("%s to_utf8 %d step %zu\n", docs[i].src, decode, step);
+                if((!(flags & DOCS_SPLIT))||(step >= len)) break;
+            }
+        }
+    }
+    return ok;
+}
+
+/** Run an entry point against test_docs[] and test_docs_no_room[]
+*   Return: 0 - the results differ
+*/
+static int docs_compare(test_parser parse, void* user, int flags)
+{
+    return table_compare(test_docs, sizeof(test_docs)/sizeof(test_docs[0]), parse, user, flags)&&
+           ((flags & DOCS_NO_ROOM)||
+            table_compare(test_docs_no_room, sizeof(test_docs_no_room)/sizeof(test_docs_no_room[0]), parse, user, flags));
+}
+
+static int run_indexed(test_run* run)
+{
+    run->root = json_parse_indexed(run->ctx, run->buf, run->len, run->decode);
+    run->err = run->ctx->err;
+    run->pos = run->ctx->pos;
+    return run->root != NULL;
+}
+
+/** json_parse_indexed() must build the same tree json_parse() does */
+static void test_indexed(void)
+{
+    char buf[256];
+    const char* files[] = {
+        "./test/sample/example_1.json", "./test/sample/example_2.json", "./test/sample/example_3.json",
+        "./test/sample/example_4.json", "./test/sample/example_6big.json"
+    };
+    int i, j, ok;
+    CHECK(docs_compare(run_indexed, NULL, 0), "the documents of test_docs[] - the trees and the errors of json_parse()");
+    /* backslash sequences of any length across the 64 bytes blocks boundaries */
+    for(i = 50, ok = 1; (i < 70)&&(ok); i++){
+        for(j = 1; (j < 12)&&(ok); j++){
+            int len = sprintf(buf, "[\"%.*s%.*s\\\"\",{\"k\":[\"%.*s\"]}]", i, "..........................................................................",
+                              2*j, "\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\", j, "}}}}}}}}}}}}");
+            ok = run_compare(run_indexed, NULL, buf, len, 0, 0, NULL);
+            if(!ok) printf("%s\n", buf);
+        }
+    }
+    CHECK(ok, "escaped backslashes and quotes at the block boundaries");
+    for(i = 0, ok = 1; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        FILE* fl = fopen(files[i], "rb");
+        if(!fl){
+            printf("File open error: %s\n", files[i]);
+            exit(-1);
+        }
+        fseek(fl, 0, SEEK_END);
+        int len = ftell(fl);
+        fseek(fl, 0, SEEK_SET);
+        char* src = malloc(len);
+        if((!src)||((int)fread(src, 1, len, fl) != len)){
+            printf("Reading from file failed!\n");
+            exit(-1);
+        }
+        fclose(fl);
+        ok = run_compare(run_indexed, NULL, src, len, 0, 0, NULL)&&run_compare(run_indexed, NULL, src, len, 1, 0, NULL);
+        if(!ok) printf("%s\n", files[i]);
+        free(src);
+    }
+    CHECK(ok, "sample files");
+}
+
+/** Nesting depth is a runtime limit, deep documents must not exhaust the stack */
+static void test_depth(void)
+{
+    const int deep = 1000000;
+    char* buf = malloc(2 * deep + 8);
+    char in[MY_BUF_SIZE];
+    int i, len;
+    json_ctx* ctx = json_init();
+    if((!buf)||(!ctx)){
+        printf("Memory allocation error\n");
+        exit(-1);
+    }
+    /* 60 levels: {"a":[{"a":[...]}]} */
+    for(len = 0, i = 0; i < 30; i++) len += sprintf(in + len, "{\"a\":[");
+    for(i = 0; i < 30; i++) len += sprintf(in + len, "]}");
+#ifdef JSON_LIMIT_CHECK
+    /* JSON_MAX_DEPTH is the default only with the limits checked, 0 - unlimited otherwise */
+    memcpy(buf, in, len);
+    CHECK((!json_parse(ctx, buf, len, 0))&&(ctx->err == ERR_JSON_DEPTH), "default depth limit");
+    json_reset(ctx);
+#endif // JSON_LIMIT_CHECK
+    ctx->max_depth = 60;
+    memcpy(buf, in, len);
+    CHECK(json_parse(ctx, buf, len, 0) != NULL, "60 levels with ctx->max_depth = 60");
+    json_reset(ctx);
+    memcpy(buf, in, len);
+    CHECK(json_parse_indexed(ctx, buf, len, 0) != NULL, "60 levels with ctx->max_depth = 60 - indexed");
+    json_reset(ctx);
+    ctx->max_depth = 59;
+    memcpy(buf, in, len);
+    CHECK((!json_parse(ctx, buf, len, 0))&&(ctx->err == ERR_JSON_DEPTH), "60 levels with ctx->max_depth = 59");
+    json_reset(ctx);
+    memcpy(buf, in, len);
+    CHECK((!json_parse_indexed(ctx, buf, len, 0))&&(ctx->err == ERR_JSON_DEPTH),
+          "60 levels with ctx->max_depth = 59 - indexed");
+    /* unlimited */
+    json_reset(ctx);
+    ctx->max_depth = 0;
+    memset(buf, '[', deep);
+    memset(buf + deep, ']', deep);
+    CHECK(json_parse(ctx, buf, 2 * deep, 0) != NULL, "1000000 levels with unlimited depth");
+    CHECK(ctx->nused == deep, "1000000 nested arrays");
+    json_reset(ctx);
+    CHECK(json_parse_indexed(ctx, buf, 2 * deep, 0) != NULL, "1000000 levels with unlimited depth - indexed");
+    json_destroy(ctx);
+    free(buf);
+}
+
+/** Both parsers accept exactly the same */
+static void test_strict(void)
+{
+    char buf[MY_BUF_SIZE];
+    char out[MY_BUF_SIZE];
+    const char* invalid[] = {
+        "[1,]", "{\"a\":1,}", "[,1]", "{,}", "[1 2]", "{\"a\" 1}", "[tru", "[nulL]", "{\"a\":1]"
+    };
+    int i, len, ok = 1;
+    for(i = 0; (i < (int)(sizeof(invalid)/sizeof(invalid[0])))&&(ok); i++){
+        json_ctx* ctx = json_init();
+        len = strlen(invalid[i]);
+        memcpy(buf, invalid[i], len);
+        ok = (json_parse(ctx, buf, len, 0) == NULL);
+        if(!ok) printf("%s\n", invalid[i]);
+        json_destroy(ctx);
+    }
+    CHECK(ok, "trailing commas and missing separators are rejected");
+    json_ctx* ctx = json_init();
+    CHECK((parse_print(ctx, "[123456789012345678901234567890,1]", buf, out) > 0)&&
+          (!strcmp(out, "[\"123456789012345678901234567890\",1]")), "long number kept as string before ','");
+    json_destroy(ctx);
+    ctx = json_init();
+    CHECK((parse_print(ctx, "[0.12345678901234567890123,1]", buf, out) == 23)&&
+          (!memcmp(out, "[0.12345678901234568,1]", 23)), "long decimal rounded before ','");
+    json_destroy(ctx);
+    /* two documents in one buffer */
+    ctx = json_init();
+    strcpy(buf, "{\"a\":1} [2]");
+    len = strlen(buf);
+    CHECK((json_parse(ctx, buf, len, 0) != NULL)&&(ctx->pos == 7), "parsing stops after the root value");
+    /* the first tree is released, the position is kept */
+    size_t pos = ctx->pos;
+    json_reset(ctx);
+    ctx->pos = pos;
+    CHECK((json_parse(ctx, buf, len, 0) != NULL)&&(ctx->root->type == JSON_ARRAY), "next document from ctx->pos");
+    json_destroy(ctx);
+}
+
+/** json_parse_feed() in pieces of run->step bytes (all at once if 0), then the end of input */
+static int run_feed(test_run* run)
+{
+    json_ctx* ctx = run->ctx;
+    size_t step = run->step ? run->step : run->len;
+    size_t pos = 0, n;
+    run->root = NULL;
+    while(pos < run->len){
+        n = (run->len - pos < step) ? run->len - pos : step;
+        run->root = json_parse_feed(ctx, run->buf + pos, n, run->decode);
+        if((run->root)||(ctx->err != ERR_JSON_INCOMPLETE)) break;
+        pos += n;
+    }
+    if(pos == run->len){
+        /* end of input */
+        run->root = json_parse_feed(ctx, NULL, 0, run->decode);
+    }
+    run->err = ctx->err;
+    run->pos = ctx->pos;
+    return run->root != NULL;
+}
+
+/** Documents split at any byte must give the same tree */
+static void test_feed(void)
+{
+    const char* files[] = {
+        "./test/sample/example_2.json", "./test/sample/example_3.json", "./test/sample/example_4.json",
+        "./test/sample/example_6big.json"
+    };
+    int i, step, ok;
+    CHECK(docs_compare(run_feed, NULL, DOCS_SPLIT), "the documents of test_docs[] split in pieces of any size");
+    for(i = 0, ok = 1; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        char* src;
+        FILE* fl = fopen(files[i], "rb");
+        if(!fl){
+            printf("File open error: %s\n", files[i]);
+            exit(-1);
+        }
+        fseek(fl, 0, SEEK_END);
+        int len = ftell(fl);
+        fseek(fl, 0, SEEK_SET);
+        src = malloc(len);
+        if((!src)||((int)fread(src, 1, len, fl) != len)){
+            printf("Reading from file failed!\n");
+            exit(-1);
+        }
+        fclose(fl);
+        for(step = (len > 4096) ? 4093 : 1; (step < len)&&(ok); step = step * 3 + 1){
+            ok = run_compare(run_feed, NULL, src, len, 1, step, NULL);
+            if(!ok) printf("%s step %d\n", files[i], step);
+        }
+        free(src);
+    }
+    CHECK(ok, "sample files split in pieces");
+    /* the pieces of a string are put together in the scratch memory */
+    json_ctx* ctx = json_init();
+    char p1[] = "[\"ab";
+    char p2[] = "cd\",\"e\\";
+    char p3[] = "nf\"]";
+    CHECK((!json_parse_feed(ctx, p1, strlen(p1), 0))&&(ctx->err == ERR_JSON_INCOMPLETE), "first piece");
+    CHECK((!json_parse_feed(ctx, p2, strlen(p2), 0))&&(ctx->err == ERR_JSON_INCOMPLETE), "second piece");
+    json_node* root = json_parse_feed(ctx, p3, strlen(p3), 0);
+    CHECK((root)&&(ctx->pos == strlen(p3)), "last piece completes the document");
+    CHECK((root)&&(!strcmp(json_get_element(root, 0)->val.string_value, "abcd"))&&
+          (!strcmp(json_get_element(root, 1)->val.string_value, "e\nf")), "strings split between the pieces");
+    json_reset(ctx);
+    CHECK((!json_parse_feed(ctx, p1, strlen(p1), 0))&&(!json_parse_feed(ctx, NULL, 0, 0))&&
+          (ctx->err == ERR_JSON_INCOMPLETE), "unexpected end of input");
+    json_reset(ctx);
+    char p4[] = "[[nu";
+    char p5[] = " }l,5]]";
+    CHECK((!json_parse_feed(ctx, p4, strlen(p4), 0))&&(!json_parse_feed(ctx, p5, strlen(p5), 0))&&
+          (ctx->err == ERR_JSON_UNEXPECTED)&&(ctx->pos == 0), "a cut literal completed by a delimiter");
+    json_reset(ctx);
+    char p6[] = "[\"a\\";
+    char p7[] = "qb\"]";
+    root = json_parse_feed(ctx, p6, strlen(p6), 1);
+    if(!root) root = json_parse_feed(ctx, p7, strlen(p7), 1);
+    CHECK((root)&&(!strcmp(json_get_element(root, 0)->val.string_value, "a\\qb")), "an unknown escape is copied as it is");
+    json_destroy(ctx);
+}
+
+/* json_parse_sax() events written back as compact JSON */
+typedef struct sax_out{
+    char    buf[MY_BUF_SIZE];
+    int     pos;
+    int     comma;      /* a ',' goes before the next value */
+    int     nevents;
+    int     stop_at;    /* # event to return 0 at, 0 - never */
+} sax_out;
+
+static int sax_put(sax_out* so, const char* txt, int value)
+{
+    if((value)&&(so->comma)) so->pos += sprintf(so->buf + so->pos, ",");
+    so->pos += sprintf(so->buf + so->pos, "%s", txt);
+    so->nevents++;
+    return so->nevents != so->stop_at;
+}
+
+static int sax_start_object(void* user)
+{
+    int rc = sax_put(user, "{", 1);
+    ((sax_out*)user)->comma = 0;
+    return rc;
+}
+
+static int sax_start_array(void* user)
+{
+    int rc = sax_put(user, "[", 1);
+    ((sax_out*)user)->comma = 0;
+    return rc;
+}
+
+static int sax_end_object(void* user)
+{
+    ((sax_out*)user)->comma = 1;
+    return sax_put(user, "}", 0);
+}
+
+static int sax_end_array(void* user)
+{
+    ((sax_out*)user)->comma = 1;
+    return sax_put(user, "]", 0);
+}
+
+static int sax_key(void* user, const char* key)
+{
+    sax_out* so = user;
+    char txt[MY_BUF_SIZE];
+    sprintf(txt, "\"%s\":", key);
+    int rc = sax_put(so, txt, 1);
+    so->comma = 0;
+    return rc;
+}
+
+static int sax_string(void* user, const char* str)
+{
+    char txt[MY_BUF_SIZE];
+    sprintf(txt, "\"%s\"", str);
+    int rc = sax_put(user, txt, 1);
+    ((sax_out*)user)->comma = 1;
+    return rc;
+}
+
+static int sax_integer(void* user, long long val)
+{
+    char txt[32];
+    sprintf(txt, "%lld", val);
+    int rc = sax_put(user, txt, 1);
+    ((sax_out*)user)->comma = 1;
+    return rc;
+}
+
+static int sax_dbl(void* user, double val)
+{
+    char txt[32];
+    sprintf(txt, "%g", val);
+    int rc = sax_put(user, txt, 1);
+    ((sax_out*)user)->comma = 1;
+    return rc;
+}
+
+static int sax_boolean(void* user, int val)
+{
+    int rc = sax_put(user, val ? "true" : "false", 1);
+    ((sax_out*)user)->comma = 1;
+    return rc;
+}
+
+static int sax_null(void* user)
+{
+    int rc = sax_put(user, "null", 1);
+    ((sax_out*)user)->comma = 1;
+    return rc;
+}
+
+static const json_sax sax_writer = {
+    sax_start_object, sax_end_object, sax_start_array, sax_end_array, sax_key,
+    sax_string, sax_integer, sax_dbl, sax_boolean, sax_null
+};
+
+static int run_sax(test_run* run)
+{
+    static const json_sax no_events;
+    int rc = json_parse_sax(run->ctx, run->buf, run->len, run->decode, &no_events, NULL);
+    run->err = run->ctx->err;
+    run->pos = run->ctx->pos;
+    return rc;
+}
+
+static void test_sax(void)
+{
+    char buf[MY_BUF_SIZE];
+    char src[MY_BUF_SIZE];
+    sax_out so;
+    const char* sample = "{\"a\":[1,-2,{\"b\":null,\"c\":true}],\"d\":\"x\\\"y\",\"e\":false,\"f\":{},\"g\":[[]],"
+                         "\"h\":0.5,\"i\":1e3,\"j\":12345678901234567890123}";
+    const json_sax no_events = {0};
+    json_ctx* ctx = json_init();
+    int i, len = strlen(sample);
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(-1);
+    }
+    memset(&so, 0, sizeof(so));
+    memcpy(buf, sample, len);
+    CHECK(json_parse_sax(ctx, buf, len, 1, &sax_writer, &so), "parse with callbacks");
+    CHECK(!strcmp(so.buf, "{\"a\":[1,-2,{\"b\":null,\"c\":true}],\"d\":\"x\"y\",\"e\":false,\"f\":{},\"g\":[[]],"
+                          "\"h\":0.5,\"i\":1000,\"j\":\"12345678901234567890123\"}"), so.buf);
+    CHECK(ctx->pos == (size_t)len, "the whole document is consumed");
+    CHECK((ctx->nused == 0)&&(ctx->root == NULL), "no nodes are created");
+    /* scalar documents and no callbacks at all */
+    ctx->pos = 0;
+    memcpy(buf, " \"abc\" ", 7);
+    CHECK(json_parse_sax(ctx, buf, 7, 0, &no_events, NULL), "no callbacks set");
+    /* a callback stops the parser */
+    memset(&so, 0, sizeof(so));
+    so.stop_at = 3;
+    ctx->pos = 0;
+    memcpy(buf, sample, len);
+    CHECK((!json_parse_sax(ctx, buf, len, 1, &sax_writer, &so))&&(ctx->err == ERR_JSON_CANCELED)&&
+          (so.nevents == 3), "a callback cancels parsing");
+    CHECK(docs_compare(run_sax, NULL, 0), "the documents of test_docs[] - the errors of json_parse()");
+    /* nesting deeper than the 64 bits of one word of the nesting stack */
+    len = 0;
+    for(i = 0; i < 200; i++){
+        src[len++] = (i & 1) ? '[' : '{';
+        if(!(i & 1)) len += sprintf(src + len, "\"k\":");
+    }
+    for(i = 199; i >= 0; i--) src[len++] = (i & 1) ? ']' : '}';
+    memcpy(buf, src, len);
+    ctx->pos = 0;
+    ctx->max_depth = 200;
+    memset(&so, 0, sizeof(so));
+    CHECK(json_parse_sax(ctx, buf, len, 0, &sax_writer, &so)&&(so.pos == len)&&(!memcmp(so.buf, src, len)),
+          "200 levels of nesting");
+    memcpy(buf, src, len);
+    ctx->pos = 0;
+    ctx->max_depth = 199;
+    CHECK((!json_parse_sax(ctx, buf, len, 0, &no_events, NULL))&&(ctx->err == ERR_JSON_DEPTH), "ERR_JSON_DEPTH is reported");
+    json_destroy(ctx);
+}
+
+/** Materialize the value at the cursor and serialize it in compact form
+*   Return: # bytes written to out or -1 on error
+*/
+static int json_cursor_to_string(const json_cursor* cur, char* out)
+{
+    json_node* nd = json_cursor_value(cur);
+    if(!nd){
+        printf("json_cursor_value() failed, error code: %d\n", cur->ctx->err);
+        return -1;
+    }
+    return json_to_string(nd, out, MY_BUF_SIZE, 1);
+}
+
+/** The values a cursor finds must be the same json_parse() gives */
+static void test_ondemand(json_ctx* ctx)
+{
+    char src[MY_BUF_SIZE];
+    char buf[MY_BUF_SIZE];
+    char out[MY_BUF_SIZE];
+    const char* sample = " {\"skip\":{\"s\":\"}]\\\"[{\",\"a\":[[],{}]},\"arr\":[1,\"x]\",[2,{\"y\":\"}\"}],-3.5e1,null],"
+                         "\"k\\u0065y\":true,\"obj\":{\"n\":12345678901234567890123,\"m\":\"v\"}} ";
+    json_cursor root, cur, el;
+    int n, len = strlen(sample);
+    if(!ctx){
+        printf("json_init() failed\n");
+        exit(-1);
+    }
+    memcpy(src, sample, len);
+    memcpy(buf, sample, len);
+    CHECK(json_ondemand(ctx, buf, len, 1, &root), "json_ondemand()");
+    CHECK(json_cursor_type(&root) == JSON_OBJECT, "root is an object");
+    CHECK(json_cursor_get(&root, "arr", &cur)&&(json_cursor_type(&cur) == JSON_ARRAY), "member found");
+    CHECK(json_cursor_element(&cur, 2, &el)&&(json_cursor_to_string(&el, out) > 0)&&
+          (!strcmp(out, "[2,{\"y\":\"}\"}]")), "element past a string with a bracket");
+    CHECK(json_cursor_element(&cur, 3, &el)&&(json_cursor_type(&el) == JSON_DOUBLE)&&
+          (json_cursor_value(&el)->val.double_value == -35.0), "double element");
+    CHECK(json_cursor_element(&cur, 4, &el)&&(json_cursor_type(&el) == JSON_DUMMY), "null element");
+    CHECK((!json_cursor_element(&cur, 5, &el))&&(ctx->err == ERR_JSON_OK), "no such element");
+    for(n = 1, json_cursor_element(&cur, 0, &el); json_cursor_next(&el); n++);
+    CHECK((n == 5)&&(ctx->err == ERR_JSON_OK)&&(json_cursor_type(&el) == JSON_DUMMY), "walk the elements");
+    for(n = 1, json_cursor_get(&root, "skip", &el); json_cursor_next(&el); n++);
+    CHECK((n == 4)&&(ctx->err == ERR_JSON_OK)&&(json_cursor_type(&el) == JSON_OBJECT), "walk the members");
+    CHECK(json_cursor_get(&root, "key", &cur)&&(json_cursor_value(&cur)->val.bool_value), "key with an escape");
+    CHECK(json_cursor_get(&root, "obj", &cur)&&json_cursor_get(&cur, "m", &el)&&
+          (!strcmp(json_cursor_value(&el)->val.string_value, "v")), "nested member");
+    CHECK(json_cursor_get(&cur, "n", &el)&&(json_cursor_to_string(&el, out) > 0)&&
+          (!strcmp(out, "\"12345678901234567890123\"")), "long number at the end of an object");
+    CHECK((!json_cursor_get(&root, "s", &cur))&&(ctx->err == ERR_JSON_OK), "no such member");
+    CHECK((!json_cursor_element(&root, 0, &cur))&&(ctx->err == ERR_JSON_TYPE), "an object is not an array");
+    CHECK(!memcmp(buf, src, len), "the buffer is not modified");
+    CHECK(json_to_string(ctx->root, out, MY_BUF_SIZE, 1) > 0, "the materialized values live in the context");
+    /* the whole document */
+    json_ctx* tree = json_init();
+    CHECK((json_cursor_to_string(&root, out) > 0)&&(parse_print(tree, sample, buf, src) > 0)&&
+          (!strcmp(out, src)), "materialized root is the same as json_parse() gives");
+    json_destroy(tree);
+    /* skipped strings with escaped quotes and brackets across the 64 bytes blocks */
+    for(n = 0; n < 80; n++){
+        len = sprintf(src, "{\"skip\":[\"%.*s\\\\\\\"]}\\\\\",{}],\"v\":7}", n,
+                      "[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}[x]{y}");
+        memcpy(buf, src, len);
+        if((!json_ondemand(ctx, buf, len, 0, &root))||(!json_cursor_get(&root, "v", &cur))||
+           (json_cursor_value(&cur)->val.integer_value != 7)) break;
+    }
+    CHECK(n == 80, src);
+    /* a cut document */
+    json_reset(ctx);
+    memcpy(buf, "{\"a\":[1,2", 9);
+    CHECK(json_ondemand(ctx, buf, 9, 0, &root)&&json_cursor_get(&root, "a", &cur)&&json_cursor_element(&cur, 1, &el)&&
+          (!json_cursor_element(&cur, 2, &el))&&(ctx->err == ERR_JSON_INCOMPLETE), "incomplete document");
+    json_destroy(ctx);
+}
+
+static int run_validate(test_run* run)
+{
+    int rc = json_validate(run->ctx, run->buf, run->len);
+    run->err = run->ctx->err;
+    run->pos = run->ctx->pos;
+    run->readonly = 1;
+    return rc;
+}
+
+static void test_validate(void)
+{
+    const char* files[] = {
+        "./test/sample/example_1.json", "./test/sample/example_2.json", "./test/sample/example_3.json",
+        "./test/sample/example_4.json", "./test/sample/example_6big.json"
+    };
+    char buf[MY_BUF_SIZE];
+    int i, ok;
+    CHECK(docs_compare(run_validate, NULL, DOCS_UTF8_ONLY), "the documents of test_docs[] - the errors of json_parse()");
+    /* escapes and control characters across the 64 bytes blocks boundaries, long strings */
+    for(i = 50, ok = 1; (i < 80)&&(ok); i++){
+        static const char* tails[] = {"\\\\\"]", "\\\"\"]", "\\ud83d\\ude00\"]", "\n\"]", "\\u00e9\"]"};
+        for(int j = 0; (j < (int)(sizeof(tails)/sizeof(tails[0])))&&(ok); j++){
+            int len = sprintf(buf, "[\"%*s%s", i, "", tails[j]);
+            ok = run_compare(run_validate, NULL, buf, len, 1, 0, NULL);
+            if(!ok) printf("%s\n", buf);
+        }
+    }
+    CHECK(ok, "escapes across the blocks");
+    for(i = 500, ok = 1; (i < 530)&&(ok); i++){
+        int len = sprintf(buf, "[\"%*s\\\"\"]", i, "");
+        ok = run_compare(run_validate, NULL, buf, len, 1, 0, NULL)&&run_compare(run_validate, NULL, buf, len - 2, 1, 0, NULL);
+        if(!ok) printf("%d\n", i);
+    }
+    CHECK(ok, "long strings");
+    /* stricter than json_parse() */
+    json_ctx* ctx = json_init();
+    strcpy(buf, "[\"\\x\"]");
+    CHECK((!json_validate(ctx, buf, 6))&&(ctx->err == ERR_JSON_UNEXPECTED)&&(ctx->pos == 3), "unknown escape is rejected");
+    /* the limits */
+    ctx->max_depth = 3;
+    strcpy(buf, "[[[[]]]]");
+    CHECK((!json_validate(ctx, buf, 8))&&(ctx->err == ERR_JSON_DEPTH), "ERR_JSON_DEPTH is reported");
+    ctx->max_depth = 4;
+    CHECK(json_validate(ctx, buf, 8), "4 levels are fine");
+    CHECK((ctx->nused == 0)&&(ctx->root == NULL), "no nodes are created");
+    json_destroy(ctx);
+    for(i = 0, ok = 1; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        FILE* fl = fopen(files[i], "rb");
+        if(!fl){
+            printf("File open error: %s\n", files[i]);
+            exit(-1);
+        }
+        fseek(fl, 0, SEEK_END);
+        int len = ftell(fl);
+        fseek(fl, 0, SEEK_SET);
+        char* src = malloc(len);
+        if((!src)||((int)fread(src, 1, len, fl) != len)){
+            printf("Reading from file failed!\n");
+            exit(-1);
+        }
+        fclose(fl);
+        ctx = json_init();
+        ok = json_validate(ctx, src, len)&&run_compare(run_validate, NULL, src, len, 1, 0, NULL);
+        if(!ok) printf("%s\n", files[i]);
+        json_destroy(ctx);
+        free(src);
+    }
+    CHECK(ok, "sample files are valid");
+}
+
+/** Parse a copy of the document with raw numbers and serialize it in compact form
+*   mode: 0 - json_parse(), 1 - json_parse_view(), 2 - json_parse_indexed(), 3 and more - json_parse_feed()
+*       in two pieces, the first one is mode - 3 bytes long
+*   Return: # bytes written to out or -1 on error
+*/
+static int raw_print(const char* src, int mode, char* out)
+{
+    char in[MY_BUF_SIZE];
+    int len = strlen(src);
+    int rc = -1;
+    json_node* root;
+    json_ctx* ctx = json_init();
+    ctx->raw_numbers = 1;
+    memcpy(in, src, len + 1);
+    if(mode == 0) root = json_parse(ctx, in, len, 1);
+    else if(mode == 1) root = json_parse_view(ctx, src, len, 1);
+    else if(mode == 2) root = json_parse_indexed(ctx, in, len, 1);
+    else{
+        root = json_parse_feed(ctx, in, mode - 3, 1);
+        if((!root)&&(ctx->err == ERR_JSON_INCOMPLETE)) root = json_parse_feed(ctx, in + mode - 3, len - mode + 3, 1);
+        if((!root)&&(ctx->err == ERR_JSON_INCOMPLETE)) root = json_parse_feed(ctx, NULL, 0, 1);
+    }
+    if(root) rc = json_to_string(root, out, MY_BUF_SIZE, 1);
+    json_destroy(ctx);
+    return rc;
+}
+
+/** Raw numbers are copied to the output as they are and converted on demand */
+static void test_raw_numbers(void)
+{
+    const char* doc = "{\"a\":[1.50,-0.0,1E5,0,-7,123456789012345678901234567890,0.12345678901234567890123],\"b\":2e-3}";
+    const char* invalid[] = {"[01]", "[1.]", "[-]", "[1e]", "[1e+]", "[.5]", "[1.5.]", "[--1]"};
+    char out[MY_BUF_SIZE];
+    int i, len = strlen(doc), ok = 1;
+    for(i = 0; (i < len + 3)&&(ok); i++){
+        ok = (raw_print(doc, i, out) == len)&&(!memcmp(out, doc, len));
+        if(!ok) printf("mode %d\n", i);
+    }
+    CHECK(ok, "the digits are written as they were parsed");
+    ok = (raw_print("-12.5e+7", 0, out) == 8)&&(!memcmp(out, "-12.5e+7", 8))&&
+         (raw_print("-12.5e+7", 2, out) == 8)&&(raw_print("-12.5e+7", 7, out) == 8);
+    CHECK(ok, "a raw number at the top level");
+    for(i = 0, ok = 1; (i < (int)(sizeof(invalid)/sizeof(invalid[0])))&&(ok); i++){
+        ok = (raw_print(invalid[i], 0, out) < 0)&&(raw_print(invalid[i], 2, out) < 0);
+        if(!ok) printf("%s\n", invalid[i]);
+    }
+    CHECK(ok, "invalid numbers are rejected");
+    /* the accessors */
+    char in[MY_BUF_SIZE];
+    json_ctx* ctx = json_init();
+    ctx->raw_numbers = 1;
+    memcpy(in, doc, len + 1);
+    json_node* root = json_parse(ctx, in, len, 1);
+    json_node* arr = json_get_node(root, "a");
+    long long ival = 0;
+    double dval = 0.0;
+    json_node* nd = json_get_element(arr, 4);
+    CHECK(nd&&(nd->type == JSON_NUMBER_RAW)&&(nd->str_len == 2)&&(!memcmp(nd->val.string_value, "-7", 2)),
+          "a number node is a view of its digits");
+    CHECK(json_get_integer(nd, &ival)&&(ival == -7)&&(nd->type == JSON_INTEGER)&&
+          json_get_integer(nd, &ival)&&(ival == -7)&&json_get_double(nd, &dval)&&(dval == -7.0),
+          "the first access converts the node");
+    nd = json_get_element(arr, 0);
+    CHECK((!json_get_integer(nd, &ival))&&(nd->type == JSON_DOUBLE)&&json_get_double(nd, &dval)&&(dval == 1.5),
+          "a double is not an integer");
+    nd = json_get_element(arr, 5);
+    CHECK((!json_get_integer(nd, &ival))&&(!json_get_double(nd, &dval))&&(nd->type == JSON_NUMBER_RAW),
+          "a number too long to be converted stays raw");
+    nd = json_get_node(root, "b");
+    CHECK(json_get_double(nd, &dval)&&(dval == 2e-3)&&(!json_get_double(json_get_node(root, "a"), &dval)),
+          "json_get_double()");
+    len = json_to_string(root, out, MY_BUF_SIZE, 1);
+    CHECK((len > 0)&&(!memcmp(out, "{\"a\":[1.5,-0.0,1E5,0,-7,123456789012345678901234567890,0.12345678901234567890123],\"b\":0.002}", len)),
+          "the converted nodes are written from their values");
+    json_destroy(ctx);
+}
+
+/** decimal to double must be correctly rounded, double to decimal must read back bit-exact */
+static void test_numbers(void)
+{
+    /* the compiler rounds the literals correctly */
+    const struct{ const char* str; double val; } hard[] = {
+        {"0.1", 0.1}, {"1e23", 1e23}, {"-1.5", -1.5}, {"5e-324", 5e-324}, {"2.4703282292062328e-324", 5e-324},
+        {"2.2250738585072011e-308", 2.2250738585072011e-308}, {"2.2250738585072012e-308", 2.2250738585072012e-308},
+        {"1.7976931348623157e308", 1.7976931348623157e308}, {"9007199254740993.0", 9007199254740992.0},
+        {"9007199254740993.0000000000000000000001", 9007199254740994.0}, {"7.038531e-26", 7.038531e-26},
+        {"1.00000000000000011102230246251565404236316680908203125", 1.0}, /* a tie */
+        {"1.00000000000000011102230246251565404236316680908203126", 1.0000000000000002},
+        {"123456789012345678901234567890.5", 123456789012345678901234567890.5},
+        {"0.000000000000000000000000000000000000001e39", 1.0}, {"1e-400", 0.0}, {"-0.0", -0.0}
+    };
+    union{ long long i; double d; char* s; } r;
+    char buf[64];
+    int i, len, rc, ok = 1;
+    for(i = 0; i < (int)(sizeof(hard)/sizeof(hard[0])); i++){
+        len = strlen(hard[i].str);
+        rc = json_atonum((char*)hard[i].str, &len, &r);
+        if((rc != 2)||(len != (int)strlen(hard[i].str))||memcmp(&r.d, &hard[i].val, sizeof(double))){
+            printf("%s\n", hard[i].str);
+            ok = 0;
+        }
+    }
+    CHECK(ok, "hard cases are rounded correctly");
+    /* runs of every length, the 8-digit blocks and the digits after them */
+    for(i = 1, ok = 1; i <= 24; i++){
+        int k, n;
+        n = sprintf(buf, "%.*s,", i, "987654321098765432109876");
+        len = n;
+        rc = json_atonum(buf, &len, &r);
+        if(i <= 18) ok &= (rc == 1)&&(len == i)&&(r.i == strtoll(buf, NULL, 10));
+        else ok &= (rc == -2)&&(len == i);
+        for(k = 0; k < 3; k++){
+            n = sprintf(buf, "%s%.*s]", (k == 0) ? "1." : (k == 1) ? "-0.000" : "12345678.", i, "123456789012345678901234");
+            len = n;
+            rc = json_atonum(buf, &len, &r);
+            ok &= (rc == 2)&&(len == n - 1)&&(r.d == strtod(buf, NULL));
+        }
+        if(!ok){
+            printf("%d digits\n", i);
+            break;
+        }
+    }
+    CHECK(ok, "digit runs of 1 to 24 digits");
+    /* the lengths of the literals - the 8 digit blocks must not read past them */
+    len = strlen("-9223372036854775808]");
+    rc = json_atonum("-9223372036854775808]", &len, &r);
+    CHECK((rc == 1)&&(r.i == LLONG_MIN)&&(len == 20), "LLONG_MIN is an integer");
+    len = strlen("9223372036854775808]");
+    rc = json_atonum("9223372036854775808]", &len, &r);
+    CHECK((rc == -2)&&(len == 19), "an integer out of long long range is a string");
+    len = strlen("1.8e308]");
+    rc = json_atonum("1.8e308]", &len, &r);
+    CHECK((rc == -2)&&(len == 7), "a number out of double range is a string");
+    /* random bit patterns */
+    uint64_t x = 88172645463325252ULL;
+    int bad = 0;
+    for(i = 0; i < 200000; i++){
+        union{ double d; uint64_t u; } v;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        v.u = (i & 3) ? x : x & 0x800FFFFFFFFFFFFFULL; /* subnormals too */
+        if((v.u & 0x7FF0000000000000ULL) == 0x7FF0000000000000ULL) continue; /* Inf, NaN */
+        len = dtoa_aux(v.d, buf, sizeof(buf));
+        rc = json_atonum(buf, &len, &r);
+        if(rc == 1) r.d = (double)r.i;
+        if(((rc != 1)&&(rc != 2))||(memcmp(&r.d, &v.d, sizeof(double)))){
+            if(!bad++) printf("%.17g\n", v.d);
+        }
+    }
+    CHECK(!bad, "dtoa_aux() output reads back bit-exact");
+    json_ctx* ctx = json_init();
+    char in[MY_BUF_SIZE], out[MY_BUF_SIZE];
+    len = parse_print(ctx, "[0.001,-0.02,0.5,-0.0,1e23,0.30000000000000004]", in, out);
+    CHECK((len > 0)&&(!memcmp(out, "[0.001,-0.02,0.5,-0.0,1e+23,0.30000000000000004]", len)), "the doubles are written as valid JSON");
+    json_destroy(ctx);
+}
+
+static int run_view(test_run* run)
+{
+    run->root = json_parse_view(run->ctx, run->buf, run->len, run->decode);
+    run->err = run->ctx->err;
+    run->pos = run->ctx->pos;
+    run->readonly = 1;
+    return run->root != NULL;
+}
+
+static void test_view(void)
+{
+    char buf[MY_BUF_SIZE];
+    int i, ok;
+    CHECK(docs_compare(run_view, NULL, DOCS_NO_ROOM), "the documents of test_docs[] - the trees and the errors of json_parse()");
+    for(i = 500, ok = 1; (i < 530)&&(ok); i++){
+        int len = sprintf(buf, "[\"%*s\\\"\"]", i, "");
+        ok = run_compare(run_view, NULL, buf, len, 1, 0, NULL)&&run_compare(run_view, NULL, buf, len - 2, 1, 0, NULL);
+        if(!ok) printf("%d\n", i);
+    }
+    CHECK(ok, "long strings");
+    /* the views */
+    const char* src = "{\"a\":\"xyz\",\"b\\n\":\"q\\\"r\",\"\":\"\",\"n\":123456789012345678901234567890}";
+    int len = strlen(src);
+    json_ctx* ctx = json_init();
+    json_node* root = json_parse_view(ctx, src, len, 1);
+    json_node* nd = json_get_node(root, "a");
+    CHECK(nd&&(nd->val.string_value == src + 6)&&(nd->str_len == 3)&&(nd->key == src + 2)&&(nd->key_len == 1),
+          "a string without escapes points into the buffer");
+    nd = json_get_node(root, "b\n");
+    CHECK(nd&&(nd->key_len == 2)&&(!strcmp(nd->key, "b\n"))&&(nd->str_len == 3)&&(!strcmp(nd->val.string_value, "q\"r"))&&
+          ((nd->val.string_value < src)||(nd->val.string_value >= src + len)), "an escaped string is decoded to the scratch memory");
+    nd = json_get_node(root, "");
+    CHECK(nd&&(nd->str_len == 0)&&(!strcmp(nd->val.string_value, "")), "empty key and string");
+    nd = json_get_node(root, "n");
+    CHECK(nd&&(nd->type == JSON_STRING)&&(nd->str_len == 30)&&(nd->val.string_value == src + len - 31),
+          "a long number is a view of its digits");
+    CHECK((!json_get_node(root, "ab"))&&(!json_get_node(root, "b")), "a key is matched by its length");
+    /* the empty key is the 1 byte "" - no word reads of it */
+    json_reset(ctx);
+    root = json_parse_view(ctx, "{\"\":1}", 6, 1);
+    nd = json_get_node(root, "");
+    CHECK(nd&&(nd->key_len == 0)&&(nd->val.integer_value == 1)&&(!json_get_node(root, "k")), "an empty key");
+    /* a long number at the end needs no null terminator */
+    json_reset(ctx);
+    root = json_parse_view(ctx, src + len - 31, 30, 1);
+    CHECK(root&&(root->type == JSON_STRING)&&(root->str_len == 30), "a long number at the root");
+    json_reset(ctx);
+    root = json_parse_view(ctx, src, len - 1, 1);
+    CHECK((!root)&&(ctx->err == ERR_JSON_INCOMPLETE)&&(ctx->pos == (size_t)len - 1), "a long number at the end");
+    json_destroy(ctx);
+}
+
+/** json_parse_file() must build the tree json_parse() builds from the file read into memory */
+static void test_file(void)
+{
+    static char out1[1 << 22], out2[1 << 22];
+    const char* files[] = {
+        "./test/sample/example_1.json", "./test/sample/example_2.json", "./test/sample/example_3.json",
+        "./test/sample/example_4.json", "./test/sample/example_6big.json"
+    };
+    int i, ok = 1;
+    json_ctx* ctx1 = json_init_arena(0);
+    json_ctx* ctx2 = json_init_arena(0);
+    if((!ctx1)||(!ctx2)){
+        printf("json_init_arena() failed\n");
+        exit(-1);
+    }
+    ctx1->max_depth = ctx2->max_depth = 0;
+    for(i = 0; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        FILE* fl = fopen(files[i], "rb");
+        if(!fl){
+            printf("File open error: %s\n", files[i]);
+            exit(-1);
+        }
+        fseek(fl, 0, SEEK_END);
+        int len = ftell(fl);
+        fseek(fl, 0, SEEK_SET);
+        char* buf = malloc(len);
+        if((!buf)||((int)fread(buf, 1, len, fl) != len)){
+            printf("Reading from file failed!\n");
+            exit(-1);
+        }
+        fclose(fl);
+        json_reset(ctx1);
+        json_node* root1 = json_parse(ctx1, buf, len, 1);
+        json_node* root2 = json_parse_file(ctx2, files[i], 1);
+        ok = (root1)&&(root2)&&(json_to_string(root1, out1, sizeof(out1), 1) > 0)&&
+             (json_to_string(root2, out2, sizeof(out2), 1) > 0)&&(!strcmp(out1, out2))&&
+             (ctx2->file_buf)&&((int)ctx2->file_size == len);
+        if(!ok) printf("%s\n", files[i]);
+        free(buf);
+    }
+    CHECK(ok, "json_parse_file() and json_parse() agree");
+    json_reset(ctx2);
+    CHECK((!ctx2->file_buf)&&(!ctx2->file_size), "json_reset() releases the file");
+    CHECK((!json_parse_file(ctx2, "./test/sample/no_such_file.json", 1))&&(ctx2->err == ERR_JSON_FILE),
+          "ERR_JSON_FILE is reported");
+    json_destroy(ctx1);
+    json_destroy(ctx2);
+}
+
+/** json_parse_batch() must give every record the tree (or the error) json_parse() gives it alone */
+static void test_batch(void)
+{
+    static char rec_buf[MY_BUF_SIZE], out1[MY_BUF_SIZE], out2[MY_BUF_SIZE];
+    const int nrec = 20000;
+    size_t size = nrec * 96, len = 0;
+    char* buf = malloc(size);
+    char* src = malloc(size);
+    size_t* offs = malloc(nrec * sizeof(size_t));
+    int i, ok = 1, nthreads[] = {4, 1, 0};
+    if((!buf)||(!src)||(!offs)){
+        printf("test_batch() failed\n");
+        exit(-1);
+    }
+    /* blank lines, CRLF, scalars, a number kept as string, errors, no line feed at the end */
+    for(i = 0; i < nrec; i++){
+        if(i % 7 == 0) len += sprintf(src + len, (i % 2) ? "\n" : "  \r\n");
+        offs[i] = len;
+        if(i % 997 == 0) len += sprintf(src + len, "{\"id\":%d,", i);
+        else if(i % 1009 == 0) len += sprintf(src + len, "{\"a\":%d} x", i);
+        else switch(i % 5){
+            case 0: len += sprintf(src + len, "{\"id\":%d,\"name\":\"user\\u00e9 %d\",\"tags\":[\"a\",\"b\"],\"score\":%d.5}", i, i, i); break;
+            case 1: len += sprintf(src + len, "[%d, true, null, \"x\"]", i); break;
+            case 2: len += sprintf(src + len, "%d", i); break;
+            case 3: len += sprintf(src + len, "\"str %d\"", i); break;
+            default: len += sprintf(src + len, "1234567890123456789012345678%02d", i % 100); break;
+        }
+        if(i < nrec - 1) len += sprintf(src + len, (i % 3) ? "\n" : "\r\n");
+    }
+    json_ctx* ctx = json_init();
+    for(int t = 0; t < (int)(sizeof(nthreads)/sizeof(nthreads[0])); t++){
+        json_batch* batch = json_batch_init(nthreads[t]);
+        if(!batch){
+            printf("json_batch_init() failed\n");
+            exit(-1);
+        }
+        memcpy(buf, src, len);
+        ok = json_parse_batch(batch, buf, len, 1)&&(batch->nrecords == (size_t)nrec);
+        size_t nbad = 0;
+        for(i = 0; (ok)&&(i < nrec); i++){
+            json_record* rec = &batch->records[i];
+            char* eol = strchr(src + offs[i], '\n');
+            int rlen = eol ? (int)(eol - src - offs[i]) : (int)(len - offs[i]);
+            memcpy(rec_buf, src + offs[i], rlen);
+            rec_buf[rlen] = '\n';
+            json_reset(ctx);
+            /* the last one has no line feed: a number kept as string has no room for its null terminator */
+            json_node* root = json_parse(ctx, rec_buf, eol ? rlen + 1 : rlen, 1);
+            ok = (rec->offset == offs[i]);
+            if((i % 997 == 0)||(i % 1009 == 0)){
+                nbad++;
+                ok = ok&&(!rec->root)&&(rec->err == ((i % 997 == 0) ? ERR_JSON_INCOMPLETE : ERR_JSON_UNEXPECTED));
+            }
+            else if(!root){
+                nbad++;
+                ok = ok&&(!rec->root)&&(rec->err == ctx->err)&&(rec->pos == ctx->pos);
+            }
+            else{
+                ok = ok&&(rec->root)&&(rec->err == ERR_JSON_OK)&&
+                     (json_to_string(root, out1, sizeof(out1), 1) > 0)&&
+                     (json_to_string(rec->root, out2, sizeof(out2), 1) > 0)&&(!strcmp(out1, out2));
+            }
+            if(!ok) printf("record %d, %d threads\n", i, nthreads[t]);
+        }
+        ok = ok&&(batch->nfailed == nbad);
+        CHECK(ok, (t == 0) ? "4 threads: the records and the errors in input order" :
+                  (t == 1) ? "1 thread: the records and the errors in input order" :
+                             "# online CPUs: the records and the errors in input order");
+        /* the workers' pools are reused */
+        memcpy(buf, src, len);
+        CHECK(json_parse_batch(batch, buf, offs[5], 1)&&(batch->nrecords == 5)&&(batch->records[0].err == ERR_JSON_INCOMPLETE)&&
+              (batch->records[2].root->val.integer_value == 2)&&(batch->records[4].root->type == JSON_STRING), "the next batch");
+        json_batch_destroy(batch);
+    }
+    json_destroy(ctx);
+    free(buf);
+    free(src);
+    free(offs);
+}
+
+/** json_parse_parallel() of the batch run->user */
+static int run_parallel(test_run* run)
+{
+    json_batch* batch = run->user;
+    /* json_parse() gets the limits of the batch */
+    run->ctx->max_nodes = batch->max_nodes;
+    run->ctx->max_depth = batch->max_depth;
+    run->root = json_parse_parallel(batch, run->buf, run->len, run->decode);
+    run->err = batch->err;
+    run->pos = batch->pos;
+    return run->root != NULL;
+}
+
+/** A big array of mixed elements: escapes, brackets and commas in strings,
+*   numbers kept as strings next to the commas and the closing bracket
+*   Return: # bytes written
+*/
+static size_t make_mixed_array(char* buf, int nelem)
+{
+    size_t len = 0;
+    buf[len++] = '[';
+    for(int i = 0; i < nelem; i++){
+        if(i) buf[len++] = ',';
+        switch(i % 6){
+            case 0: len += sprintf(buf + len, "{\"id\":%d,\"s\":\"a,]}[\\\"\\u00e9\",\"n\":[1,[2,{\"x\":null}]]}", i); break;
+            case 1: len += sprintf(buf + len, " \"str\\n%d\" ", i); break;
+            case 2: len += sprintf(buf + len, "12345678901234567890123456%04d", i % 10000); break;
+            case 3: len += sprintf(buf + len, "[true,false,%d.25e-3]", i); break;
+            case 4: len += sprintf(buf + len, "\n%d\n", -i); break;
+            default: len += sprintf(buf + len, "{}"); break;
+        }
+    }
+    len += sprintf(buf + len, ",98765432109876543210987654321]");
+    return len;
+}
+
+static void test_parallel(void)
+{
+    const int nelem = 40000;
+    char* src = malloc(nelem * 80 + 256);
+    char* doc = malloc(nelem * 80 + 512);
+    size_t len, dlen;
+    int ok;
+    json_batch* batch = json_batch_init(4);
+    if((!src)||(!doc)||(!batch)){
+        printf("test_parallel() failed\n");
+        exit(-1);
+    }
+    batch->max_nodes = 1 << 24;
+    batch->max_depth = 0;
+    FILE* fl = fopen("./test/sample/example_6big.json", "rb");
+    if(!fl){
+        printf("File open error: example_6big.json\n");
+        exit(-1);
+    }
+    len = fread(src, 1, nelem * 80, fl);
+    fclose(fl);
+    CHECK(docs_compare(run_parallel, batch, 0), "the documents of test_docs[] - the trees and the errors of json_parse()");
+    CHECK(run_compare(run_parallel, batch, src, len, 1, 0, NULL), "json_parse_parallel() and json_parse() agree: example_6big.json");
+    len = make_mixed_array(src, nelem);
+    CHECK(run_compare(run_parallel, batch, src, len, 1, 0, NULL), "the root array");
+    /* the largest array is split, what comes before and after it is the spine */
+    dlen = sprintf(doc, "{\"a\":[1,2],\"big\":");
+    memcpy(doc + dlen, src, len);
+    dlen += len;
+    dlen += sprintf(doc + dlen, ",\"z\":{\"k\":[\"\\t\"]},\"n\":12345678901234567890123456789}");
+    CHECK(run_compare(run_parallel, batch, doc, dlen, 1, 0, NULL), "a member of the root object");
+    CHECK(run_compare(run_parallel, batch, doc, 1000, 1, 0, NULL), "a small document");
+    batch->max_depth = 2;
+    CHECK(run_compare(run_parallel, batch, doc, dlen, 1, 0, NULL), "the depth limit");
+    batch->max_depth = 4;
+    CHECK(run_compare(run_parallel, batch, doc, dlen, 1, 0, NULL), "the depth limit of the elements");
+    batch->max_depth = 0;
+    /* the errors: in an element, before the array and after it */
+    ok = 1;
+    for(int i = 0; (i < 4)&&(ok); i++){
+        size_t pos = len / 4 * i + len / 8;
+        char ch = src[pos];
+        src[pos] = (i % 2) ? ']' : ':';
+        ok = run_compare(run_parallel, batch, src, len, 1, 0, NULL);
+        src[pos] = ch;
+    }
+    CHECK(ok, "an error in an element");
+    doc[3] = 'x';
+    ok = run_compare(run_parallel, batch, doc, dlen, 1, 0, NULL);
+    doc[3] = '"';
+    doc[dlen - 3] = 'x';
+    ok = ok&&run_compare(run_parallel, batch, doc, dlen, 1, 0, NULL);
+    CHECK(ok, "an error before or after the array");
+    batch->max_nodes = 1000;
+    CHECK(run_compare(run_parallel, batch, src, len, 1, 0, NULL)&&(batch->err == ERR_JSON_NODES), "the nodes limit");
+    /* every worker is below the limit, all of them together are not */
+    memcpy(doc, src, len);
+    json_ctx* ctx = json_init();
+    if((!ctx)||(!json_parse(ctx, doc, len, 1))){
+        printf("test_parallel() failed\n");
+        exit(-1);
+    }
+    batch->max_nodes = ctx->nused - 1;
+    json_destroy(ctx);
+    CHECK(run_compare(run_parallel, batch, src, len, 1, 0, NULL)&&(batch->err == ERR_JSON_NODES), "the nodes limit: the last node");
+    batch->max_nodes++;
+    CHECK(run_compare(run_parallel, batch, src, len, 1, 0, NULL)&&(batch->err == ERR_JSON_OK), "the nodes limit: all nodes");
+    json_batch_destroy(batch);
+    free(src);
+    free(doc);
+}
+
+/* the output of a callback writer is collected here */
+typedef struct wr_sink{
+    char*   buf;
+    size_t  len;
+    size_t  size;
+    int     ncalls;     /* # flush calls */
+    int     fail_at;    /* the call which fails, 0 - none */
+} wr_sink;
+
+static int wr_collect(void* user, const char* data, size_t len)
+{
+    wr_sink* sk = user;
+    if(++sk->ncalls == sk->fail_at) return 0;
+    if(sk->len + len > sk->size) return 0;
+    memcpy(sk->buf + sk->len, data, len);
+    sk->len += len;
+    return ~0;
+}
+
+/** json_write() must give the output json_to_string() gives whatever the sink is */
+static void test_writer(void)
+{
+    static char out[1 << 22], stage[64];
+    const char* fname = "./test/sample/example_6big.json";
+    json_writer w;
+    wr_sink sk = {0};
+    ptrdiff_t len[2];
+    int compact, ok;
+    json_ctx* ctx = json_init_arena(0);
+    ctx->max_depth = 0;
+    json_node* root = json_parse_file(ctx, fname, 1);
+    sk.size = sizeof(out);
+    sk.buf = malloc(sk.size);
+    if((!root)||(!sk.buf)){
+        printf("test_writer() failed\n");
+        exit(-1);
+    }
+    for(compact = 0; compact < 2; compact++){
+        len[compact] = json_to_string(root, out, sizeof(out), compact);
+        /* a growable buffer which starts small */
+        ok = json_writer_buffer(&w, 0)&&(json_write(&w, root, compact) == len[compact])&&
+             (w.pos == (size_t)len[compact])&&(!memcmp(w.buf, out, len[compact]))&&(!w.buf[w.pos]);
+        ok = json_writer_close(&w)&&ok;
+        CHECK(ok, compact ? "growable buffer - compact" : "growable buffer - formatted");
+        /* a callback with a tiny staging buffer */
+        sk.len = sk.ncalls = 0;
+        ok = json_writer_callback(&w, wr_collect, &sk, stage, sizeof(stage))&&
+             (json_write(&w, root, compact) == len[compact])&&json_writer_close(&w)&&
+             (sk.len == (size_t)len[compact])&&(!memcmp(sk.buf, out, len[compact]));
+        CHECK(ok, compact ? "callback - compact" : "callback - formatted");
+    }
+    /* a file gets the compact output twice */
+    FILE* fl = tmpfile();
+    ok = (fl)&&json_writer_file(&w, fl)&&(json_write(&w, root, 1) == len[1])&&
+         json_writer_put(&w, "\n", 1)&&(json_write(&w, root, 1) == len[1])&&(w.total + w.pos == (size_t)(2*len[1] + 1))&&
+         json_writer_close(&w);
+    if(ok){
+        rewind(fl);
+        ok = (fread(sk.buf, 1, sk.size, fl) == (size_t)(2*len[1] + 1))&&(!memcmp(sk.buf, out, len[1]))&&
+             (sk.buf[len[1]] == '\n')&&(!memcmp(sk.buf + len[1] + 1, out, len[1]));
+    }
+    if(fl) fclose(fl);
+    CHECK(ok, "file - two values and a line feed between them");
+    /* a string far longer than the staging buffer goes to the sink as is */
+    json_reset(ctx);
+    root = json_add_last(ctx, NULL, JSON_ARRAY, NULL);
+    json_node* nd = json_add_last(ctx, root, JSON_STRING, NULL);
+    memset(out, 'a', 1000);
+    out[1000] = '\0';
+    nd->val.string_value = out;
+    sk.len = sk.ncalls = 0;
+    ok = json_writer_callback(&w, wr_collect, &sk, stage, sizeof(stage))&&(json_write(&w, root, 1) == 1004)&&
+         json_writer_close(&w)&&(sk.len == 1004)&&(sk.buf[0] == '[')&&(sk.buf[1] == '"')&&
+         (!memcmp(sk.buf + 2, out, 1000))&&(sk.buf[1002] == '"')&&(sk.buf[1003] == ']');
+    CHECK(ok, "long string through a small staging buffer");
+    /* the sink fails */
+    sk.len = sk.ncalls = 0;
+    sk.fail_at = 2;
+    ok = json_writer_callback(&w, wr_collect, &sk, stage, sizeof(stage))&&(json_write(&w, root, 1) == -1)&&
+         (w.err == ERR_JSON_FILE)&&(json_write(&w, root, 1) == -1)&&(!json_writer_close(&w));
+    CHECK(ok, "a failed sink stops the output");
+    CHECK(!json_writer_callback(&w, wr_collect, &sk, stage, 16), "staging buffer too small");
+    free(sk.buf);
+    json_destroy(ctx);
+}
+
+/** json_serialized_size() must give the length json_to_string() writes */
+static void test_serialized_size(void)
+{
+    static char out[1 << 22];
+    const char* files[] = {
+        "./test/sample/example_1.json", "./test/sample/example_2.json", "./test/sample/example_3.json",
+        "./test/sample/example_4.json", "./test/sample/example_6big.json"
+    };
+    const long long ints[] = {0, 9, 10, -1, -10, 99, 100, 123456789, 1000000000000000000LL,
+                              9999999999999999LL, LLONG_MAX, LLONG_MIN, LLONG_MIN + 1};
+    char str[256];
+    int i, compact, ok = 1;
+    json_ctx* ctx = json_init_arena(0);
+    ctx->max_depth = 0;
+    for(i = 0; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        json_node* root = json_parse_file(ctx, files[i], 1);
+        for(compact = 0; (compact < 2)&&(ok); compact++){
+            ptrdiff_t size = json_serialized_size(root, compact);
+            ok = (root)&&(size > 0)&&(json_to_string(root, out, sizeof(out), compact) == size);
+        }
+        if(!ok) printf("%s\n", files[i]);
+    }
+    CHECK(ok, "sample files");
+    /* every byte in a string and a key, the numbers */
+    json_reset(ctx);
+    json_node* root = json_add_last(ctx, NULL, JSON_OBJECT, NULL);
+    for(i = 0; i < 256; i++) str[i] = (char)(255 - i);
+    json_node* nd = json_add_last(ctx, root, JSON_STRING, "k\t/\"ey");
+    nd->val.string_value = str;
+    nd->str_len = 255;
+    json_node* arr = json_add_last(ctx, root, JSON_ARRAY, str + 128);
+    for(i = 0; i < (int)(sizeof(ints)/sizeof(ints[0])); i++){
+        nd = json_add_last(ctx, arr, JSON_INTEGER, NULL);
+        nd->val.integer_value = ints[i];
+        nd = json_add_last(ctx, arr, JSON_DOUBLE, NULL);
+        nd->val.double_value = ints[i] / 7.0;
+    }
+    nd = json_add_last(ctx, arr, JSON_OBJECT, NULL);
+    json_add_last(ctx, nd, JSON_OBJECT, "empty");
+    json_add_last(ctx, nd, JSON_ARRAY, "");
+    for(compact = 0; compact < 2; compact++){
+        ptrdiff_t size = json_serialized_size(root, compact);
+        ok = (size > 0)&&(json_to_string(root, out, size + 1, compact) == size)&&
+             (json_to_string(root, out, size, compact) == -1);
+        CHECK(ok, compact ? "escapes and numbers - compact" : "escapes and numbers - formatted");
+    }
+    CHECK((itoa_aux(LLONG_MIN, out, 19) == -1)&&(itoa_aux(LLONG_MIN, out, 20) == 20)&&
+          (!memcmp(out, "-9223372036854775808", 20)), "LLONG_MIN digits");
+    nd = json_add_last(ctx, nd, JSON_INTEGER, NULL);
+    nd->key = NULL;
+    CHECK(json_serialized_size(root, 1) == -1, "a member without a key");
+    /* '/' escaped or not: the size of the output of the writer */
+    char url[] = "{\"a/b\":[\"http://example.com/x/y\",\"/\"]}";
+    const json_format lf2 = {2, 1, 0};
+    json_reset(ctx);
+    root = json_parse(ctx, url, strlen(url), 0);
+    for(i = 0, ok = (root != NULL); (ok)&&(i < 4); i++){
+        json_writer w;
+        ok = json_writer_buffer(&w, 0);
+        w.no_escape_slash = i & 1;
+        w.format = (i & 2) ? &lf2 : NULL;
+        ptrdiff_t size = json_write_size(&w, root, 0);
+        ok = (ok)&&(size > 0)&&(json_write(&w, root, 0) == size)&&(json_write_size(&w, root, 1) == json_write(&w, root, 1));
+        ok = (ok)&&((i & 1) ? (size == json_serialized_size_fmt(root, w.format) - 6) :
+                              (size == json_serialized_size_fmt(root, w.format)));
+        json_writer_close(&w);
+    }
+    CHECK(ok, "json_write_size() - '/' escaped or not");
+    json_destroy(ctx);
+}
+
+/** json_to_string_fmt(): the line breaks, the indentation, the arrays on their lines */
+static void test_format_output(void)
+{
+    static char out[1 << 22], out2[1 << 22], stage[64];
+    const char* files[] = {
+        "./test/sample/example_1.json", "./test/sample/example_2.json", "./test/sample/example_3.json",
+        "./test/sample/example_4.json", "./test/sample/example_5.json"
+    };
+    const json_format fmts[] = {{0, 0, 0}, {2, 1, 0}, {4, 1, 1}, {0, 1, 1}, {300, 0, 1}};
+    const json_format lf2 = {2, 1, 0}, lf4x = {4, 1, 1}, zero = {0, 0, 0};
+    char doc[] = "{\"a\":[1,{\"b\":true}],\"c\":{}}";
+    int i, j, ok = 1;
+    json_writer w;
+    wr_sink sk = {out2, 0, sizeof(out2), 0, 0};
+    json_ctx* ctx = json_init_arena(0);
+    ctx->max_depth = 0;
+    json_node* root = json_parse(ctx, doc, sizeof(doc) - 1, 0);
+    ptrdiff_t len = json_to_string(root, out2, sizeof(out2), 0);
+    CHECK((len > 0)&&(json_to_string_fmt(root, out, sizeof(out), &zero) == len)&&(!memcmp(out, out2, len))&&
+          (json_to_string_fmt(root, out, sizeof(out), NULL) == len)&&(!memcmp(out, out2, len)),
+          "zeroed format - the output of json_to_string()");
+    const char* exp = "{\n\"a\": [1,\n  {\n  \"b\": true\n  }],\n\"c\": {\n  }\n}";
+    CHECK((json_to_string_fmt(root, out, sizeof(out), &lf2) == (ptrdiff_t)strlen(exp))&&(!strcmp(out, exp)),
+          "LF, 2 spaces");
+    exp = "{\n\"a\": [\n    1,\n    {\n        \"b\": true\n        }\n    ],\n\"c\": {\n    }\n}";
+    CHECK((json_to_string_fmt(root, out, sizeof(out), &lf4x) == (ptrdiff_t)strlen(exp))&&(!strcmp(out, exp)),
+          "LF, 4 spaces, an element of an array per line");
+    CHECK(json_to_string_fmt(root, out, strlen(exp), &lf4x) == -1, "output buffer too small");
+    /* the sizes and json_write() with a staging buffer smaller than a line break */
+    for(i = 0; (i < (int)(sizeof(files)/sizeof(files[0])))&&(ok); i++){
+        root = json_parse_file(ctx, files[i], 1);
+        for(j = 0; (j < (int)(sizeof(fmts)/sizeof(fmts[0])))&&(ok); j++){
+            ptrdiff_t size = json_serialized_size_fmt(root, &fmts[j]);
+            sk.len = 0;
+            ok = (root)&&(size > 0)&&(json_to_string_fmt(root, out, sizeof(out), &fmts[j]) == size)&&
+                 json_writer_callback(&w, wr_collect, &sk, stage, sizeof(stage));
+            w.format = &fmts[j];
+            ok = (ok)&&(json_write(&w, root, 0) == size)&&(json_writer_close(&w))&&
+                 (sk.len == (size_t)size)&&(!memcmp(out, out2, size));
+        }
+        if(!ok) printf("%s, format %d\n", files[i], j - 1);
+    }
+    CHECK(ok, "sample files - json_serialized_size_fmt(), json_write()");
+    /* the indentation deeper than the table of a line break */
+    json_reset(ctx);
+    root = json_add_last(ctx, NULL, JSON_OBJECT, NULL);
+    json_node* nd = root;
+    for(i = 0; i < 20; i++) nd = json_add_last(ctx, nd, JSON_OBJECT, "k");
+    ptrdiff_t size = json_serialized_size_fmt(root, &fmts[4]);
+    ok = (size > 0)&&(json_to_string_fmt(root, out, sizeof(out), &fmts[4]) == size);
+    /* the innermost object: "{\r\n", 20 levels of 300 spaces, "}" */
+    for(j = (int)size - 1; (j > 0)&&(out[j] != '{'); j--);
+    ok = (ok)&&(out[j + 1] == '\r')&&(out[j + 2] == '\n')&&(out[j + 3 + 20 * 300] == '}');
+    for(i = 0; (ok)&&(i < 20 * 300); i++) ok = (out[j + 3 + i] == ' ');
+    CHECK(ok, "indentation longer than the table");
+    json_destroy(ctx);
+}
+
+/** The serializer is not recursive: a tree of any depth, a subtree without its siblings */
+static void test_deep_output(void)
+{
+    const int pairs = 500000;
+    int i, ok;
+    json_ctx* ctx = json_init_pool(0, 2 * pairs + 4);
+    json_node* root = json_add_last(ctx, NULL, JSON_ARRAY, NULL);
+    json_node* nd = root;
+    /* [{"a":[{"a": ... [1] ... }]}] */
+    for(i = 0; (nd)&&(i < pairs); i++){
+        nd = json_add_last(ctx, nd, JSON_OBJECT, NULL);
+        if(nd) nd = json_add_last(ctx, nd, JSON_ARRAY, "a");
+    }
+    nd = (nd) ? json_add_last(ctx, nd, JSON_INTEGER, NULL) : NULL;
+    if(!nd){
+        printf("test_deep_output() failed\n");
+        exit(-1);
+    }
+    nd->val.integer_value = 1;
+    size_t len = (size_t)pairs * 8 + 3;
+    char* expected = malloc(len + 1);
+    char* out = malloc(len + 1);
+    if(!expected || !out){
+        printf("test_deep_output() failed\n");
+        exit(-1);
+    }
+    for(i = 0; i < pairs; i++){
+        memcpy(expected + i * 6, "[{\"a\":", 6);
+        memcpy(expected + len - 2 * (i + 1), "}]", 2);
+    }
+    memcpy(expected + pairs * 6, "[1]", 3);
+    CHECK(json_serialized_size(root, 1) == (ptrdiff_t)len, "1000001 levels - json_serialized_size()");
+    ok = (json_to_string(root, out, len + 1, 1) == (ptrdiff_t)len)&&(!memcmp(out, expected, len));
+    CHECK(ok, "1000001 levels - compact output");
+    free(expected);
+    free(out);
+    /* a subtree stops at its own closing bracket, the siblings of its top are not written */
+    nd = root;
+    for(i = 0; i < 2 * pairs - 100; i++) nd = nd->first_child;
+    json_node* sibling = json_add_after(ctx, nd, JSON_BOOL, "b");
+    if(!sibling){
+        printf("test_deep_output() failed\n");
+        exit(-1);
+    }
+    sibling->val.bool_value = 0;
+    ptrdiff_t size = json_serialized_size(nd, 0);
+    out = malloc(size + 1);
+    ok = (out)&&(size > 0)&&(json_to_string(nd, out, size + 1, 0) == size)&&
+         (out[0] == '[')&&(out[size - 1] == ']')&&(!strstr(out, "false"));
+    CHECK(ok, "formatted subtree of a deep tree");
+    free(out);
+    json_destroy(ctx);
+}
+
+/** Documents and outputs larger than 2 GB: positions and sizes must not wrap around */
+static void test_large(void)
+{
+    const size_t len = ((size_t)1 << 31) + 4096;
+    const size_t nstr = 4200, slen = 512 * 1024;
+    const char* tail = "\"tail\",12345678901]";
+    size_t tlen = strlen(tail), outlen;
+    char* buf = malloc(len);
+    if(!buf){
+        printf("not enough memory - skipped\n");
+        return;
+    }
+    /* ["head",<2 GB of whitespace>"tail",12345678901] */
+    memset(buf, ' ', len);
+    memcpy(buf, "[\"head\",", 8);
+    memcpy(buf + len - tlen, tail, tlen);
+    json_ctx* ctx = json_init();
+    json_node* root = json_parse_view(ctx, buf, len, 0);
+    json_node* nd = json_get_element(root, 1);
+    CHECK((root)&&(ctx->pos == len)&&(json_get_nelements(root) == 3)&&(nd)&&
+          (nd->val.string_value == buf + len - tlen + 1)&&(nd->str_len == 4)&&
+          (json_get_element(root, 2)->val.integer_value == 12345678901LL), "json_parse_view() of a 2 GB document");
+    json_reset(ctx);
+    CHECK(json_validate(ctx, buf, len), "json_validate() of a 2 GB document");
+    buf[len - 1] = 'x';
+    json_reset(ctx);
+    CHECK((!json_parse_view(ctx, buf, len, 0))&&(ctx->pos == len - 1), "the error position is past 2 GB");
+    json_reset(ctx);
+    buf[len - 1] = ']';
+    root = json_parse(ctx, buf, len, 0);
+    CHECK((root)&&(!strcmp(json_get_element(root, 1)->val.string_value, "tail")), "json_parse() of a 2 GB document");
+    free(buf);
+    /* a 2 GB output: many views of the same string */
+    json_reset(ctx);
+    char* str = malloc(slen);
+    root = json_add_last(ctx, NULL, JSON_ARRAY, NULL);
+    for(size_t i = 0; (str)&&(i < nstr); i++){
+        nd = json_add_last(ctx, root, JSON_STRING, NULL);
+        nd->val.string_value = str;
+        nd->str_len = slen;
+    }
+    outlen = nstr * (slen + 3) + 1;      /* ["aaa",...,"aaa"] */
+    char* out = malloc(outlen + 1);
+    if((!str)||(!out)){
+        printf("not enough memory - skipped\n");
+    }
+    else{
+        memset(str, 'a', slen);
+        ptrdiff_t rc = json_to_string(root, out, outlen + 1, 1);
+        CHECK((rc == (ptrdiff_t)outlen)&&(rc > INT_MAX)&&(out[rc - 1] == ']')&&(out[rc - 2] == '"')&&(!out[rc]),
+              "json_to_string() of 2 GB");
+        CHECK(json_to_string(root, out, outlen, 1) == -1, "the output buffer 1 byte short");
+    }
+    free(out);
+    free(str);
+    json_destroy(ctx);
+}
+
+int main(void)
+{
+    printf("\n...Testing null values and node reuse\n");
+    test_nulls(json_init());
+    printf("\n...Testing null values and node reuse - arena mode\n");
+    /* tiny slabs make the arena grow a few times */
+    test_nulls(json_init_arena(2));
+    printf("\n...Testing json_reset()\n");
+    test_reset(json_init());
+    printf("\n...Testing json_reset() - arena mode\n");
+    test_reset(json_init_arena(4));
+    printf("\n...Testing the nodes pool limits\n");
+    test_pool_limits();
+    printf("\n...Testing strings\n");
+    test_strspec();
+    test_strings();
+    test_escape_output();
+    printf("\n...Testing json_parse_indexed()\n");
+    test_indexed();
+    printf("\n...Testing nesting depth and strictness\n");
+    test_depth();
+    test_strict();
+    printf("\n...Testing json_parse_feed()\n");
+    test_feed();
+    printf("\n...Testing json_parse_sax()\n");
+    test_sax();
+    printf("\n...Testing json_ondemand()\n");
+    test_ondemand(json_init());
+    printf("\n...Testing json_ondemand() - arena mode\n");
+    test_ondemand(json_init_arena(4));
+    printf("\n...Testing json_validate()\n");
+    test_validate();
+    printf("\n...Testing numbers\n");
+    test_numbers();
+    test_raw_numbers();
+    printf("\n...Testing json_parse_view()\n");
+    test_view();
+    printf("\n...Testing json_parse_file()\n");
+    test_file();
+    printf("\n...Testing json_parse_batch()\n");
+    test_batch();
+    printf("\n...Testing json_parse_parallel()\n");
+    test_parallel();
+    printf("\n...Testing json_write()\n");
+    test_writer();
+    printf("\n...Testing json_serialized_size()\n");
+    test_serialized_size();
+    printf("\n...Testing formatted output\n");
+    test_format_output();
+    printf("\n...Testing deep trees output\n");
+    test_deep_output();
+    printf("\n...Testing documents larger than 2 GB\n");
+    test_large();
+    printf("\n%d check(s) failed\n", nfailed);
+    return nfailed ? 1 : 0;
+}